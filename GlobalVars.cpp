@@ -1,189 +1,541 @@
-#include "chess.h"
+// need the declarations (and constants) from the move generator, but not the GPU copies of the tables
+#define SKIP_CUDA_CODE
+#include "MoveGeneratorBitboard.h"
+#undef SKIP_CUDA_CODE
+
+// all the lookup tables in this file are generated at compile time (and end up in read only data of the executable)
+// with compilers that don't support C++14 constexpr (loops in constexpr functions), they get filled during static initialization
+// (so does MSVC: building these needs a lot more than its default /constexpr:steps limit)
+#if __cpp_constexpr >= 201304 && !defined(_MSC_VER)
+#define TABLE_CONSTEXPR constexpr
+#else
+#define TABLE_CONSTEXPR
+#endif
+
+// f(square) for all the 64 squares (as initializer of a per square table)
+#define SQUARES_8(f, i)  f(i), f(i + 1), f(i + 2), f(i + 3), f(i + 4), f(i + 5), f(i + 6), f(i + 7)
+#define SQUARE_TABLE(f)  SQUARES_8(f, 0),  SQUARES_8(f, 8),  SQUARES_8(f, 16), SQUARES_8(f, 24), \
+                         SQUARES_8(f, 32), SQUARES_8(f, 40), SQUARES_8(f, 48), SQUARES_8(f, 56)
+
+
+// helper routines for generating the tables
+// simple and slow - only meant to be run by the compiler
+
+// (file, rank) increments for the four rook directions and the four bishop directions
+// opposite directions are next to each other, even ones go towards H8 (increasing square index)
+TABLE_CONSTEXPR const int slidingDirections[2][4][2] =
+{
+    { {  0, 1 }, { 0, -1 }, { 1,  0 }, { -1,  0 } },
+    { {  1, 1 }, {-1, -1 }, {-1,  1 }, {  1, -1 } }
+};
+
+TABLE_CONSTEXPR int bitCount(uint64 x)
+{
+    int n = 0;
+    for (; x; x &= x - 1)
+        n++;
+    return n;
+}
+
+// squares attacked by a sliding piece on 'square' in direction (df, dr), the first piece in 'occ' stops the ray
+TABLE_CONSTEXPR uint64 rayAttacks(int square, int df, int dr, uint64 occ)
+{
+    uint64 attacks = 0;
+    for (int file = (square & 7) + df, rank = (square >> 3) + dr; file >= 0 && file < 8 && rank >= 0 && rank < 8; file += df, rank += dr)
+    {
+        attacks |= BIT(rank * 8 + file);
+        if (occ & BIT(rank * 8 + file))
+            break;
+    }
+    return attacks;
+}
+
+// empty board rays of a sliding piece (in slidingDirections order)
+struct SlidingRays
+{
+    uint64 ray[4];
+};
+
+TABLE_CONSTEXPR SlidingRays slidingRays(int square, int bishop)
+{
+    SlidingRays rays = {};
+    for (int d = 0; d < 4; d++)
+        rays.ray[d] = rayAttacks(square, slidingDirections[bishop][d][0], slidingDirections[bishop][d][1], 0);
+    return rays;
+}
+
+// a ray stops at the nearest blocker: the lowest one for even directions (towards H8), the highest one for odd directions
+TABLE_CONSTEXPR uint64 blockedRay(uint64 ray, uint64 occ, int d)
+{
+    uint64 blockers = ray & occ;
+    if (blockers == 0)
+        return ray;
+
+    if ((d & 1) == 0)
+        return ray & (blockers ^ (blockers - 1));
+
+    while (blockers & (blockers - 1))
+        blockers &= blockers - 1;
+    return ray & ~(blockers - 1);
+}
+
+TABLE_CONSTEXPR uint64 slidingAttacks(const SlidingRays &rays, uint64 occ)
+{
+    uint64 attacks = 0;
+    for (int d = 0; d < 4; d++)
+        attacks |= blockedRay(rays.ray[d], occ, d);
+    return attacks;
+}
+
+TABLE_CONSTEXPR uint64 stepAttacks(int square, int df, int dr)
+{
+    int file = (square & 7) + df;
+    int rank = (square >> 3) + dr;
+    return (file >= 0 && file < 8 && rank >= 0 && rank < 8) ? BIT(rank * 8 + file) : 0;
+}
+
+TABLE_CONSTEXPR uint64 knightAttacksFrom(int square)
+{
+    return stepAttacks(square,  1,  2) | stepAttacks(square,  2,  1) | stepAttacks(square,  2, -1) | stepAttacks(square,  1, -2) |
+           stepAttacks(square, -1, -2) | stepAttacks(square, -2, -1) | stepAttacks(square, -2,  1) | stepAttacks(square, -1,  2);
+}
+
+TABLE_CONSTEXPR uint64 kingAttacksFrom(int square)
+{
+    return stepAttacks(square,  0,  1) | stepAttacks(square,  1,  1) | stepAttacks(square,  1,  0) | stepAttacks(square,  1, -1) |
+           stepAttacks(square,  0, -1) | stepAttacks(square, -1, -1) | stepAttacks(square, -1,  0) | stepAttacks(square, -1,  1);
+}
+
+TABLE_CONSTEXPR uint64 rookAttacksFrom  (int square) { return slidingAttacks(slidingRays(square, false), 0); }
+TABLE_CONSTEXPR uint64 bishopAttacksFrom(int square) { return slidingAttacks(slidingRays(square, true),  0); }
+TABLE_CONSTEXPR uint64 queenAttacksFrom (int square) { return rookAttacksFrom(square) | bishopAttacksFrom(square); }
+
+// the squares at the edge of the board don't matter for magics
+TABLE_CONSTEXPR uint64 rookAttacksMaskedFrom(int square)
+{
+    uint64 thisSquare = BIT(square);
+    uint64 mask = rookAttacksFrom(square);
+
+    if ((thisSquare & RANK1) == 0)
+        mask &= ~RANK1;
+
+    if ((thisSquare & RANK8) == 0)
+        mask &= ~RANK8;
+
+    if ((thisSquare & FILEA) == 0)
+        mask &= ~FILEA;
+
+    if ((thisSquare & FILEH) == 0)
+        mask &= ~FILEH;
+
+    return mask;
+}
+
+TABLE_CONSTEXPR uint64 bishopAttacksMaskedFrom(int square)
+{
+    return bishopAttacksFrom(square) & CENTRAL_SQUARES;
+}
+
+TABLE_CONSTEXPR LookupTable<uint64, 64> betweenRow(int sq1)
+{
+    LookupTable<uint64, 64> row = {};
+    for (int piece = 0; piece < 2; piece++)
+        for (int d = 0; d < 4; d++)
+        {
+            int df = slidingDirections[piece][d][0], dr = slidingDirections[piece][d][1];
+            uint64 inBetween = 0;
+            for (int file = (sq1 & 7) + df, rank = (sq1 >> 3) + dr; file >= 0 && file < 8 && rank >= 0 && rank < 8; file += df, rank += dr)
+            {
+                row.v[rank * 8 + file] = inBetween;
+                inBetween |= BIT(rank * 8 + file);
+            }
+        }
+    return row;
+}
+
+TABLE_CONSTEXPR LookupTable<uint64, 64> lineRow(int sq1)
+{
+    LookupTable<uint64, 64> row = {};
+    for (int piece = 0; piece < 2; piece++)
+        for (int d = 0; d < 4; d += 2)
+        {
+            uint64 line = BIT(sq1) | rayAttacks(sq1, slidingDirections[piece][d][0],     slidingDirections[piece][d][1],     0)
+                                   | rayAttacks(sq1, slidingDirections[piece][d + 1][0], slidingDirections[piece][d + 1][1], 0);
+            for (int sq2 = 0; sq2 < 64; sq2++)
+                if (line & BIT(sq2))
+                    row.v[sq2] = line;
+        }
+
+    // same as squaresInLine()
+    row.v[sq1] = FILEA << (sq1 & 7);
+    return row;
+}
+
+// position of the attack set among all the distinct attack sets of the piece on the square (for byte lookup fancy magics)
+// the attack set is decided by the no. of squares attacked in each direction, so just treat those as digits
+TABLE_CONSTEXPR int uniqueAttackIndex(const SlidingRays &rays, uint64 occ)
+{
+    int index = 0;
+    for (int d = 0; d < 4; d++)
+    {
+        int length = bitCount(rays.ray[d]);
+        if (length)
+            index = index * length + bitCount(blockedRay(rays.ray[d], occ, d)) - 1;
+    }
+    return index;
+}
+
 
 // bit mask containing squares between two given squares
-uint64 Between[64][64];
+TABLE_CONSTEXPR const LookupTable<uint64, 64> Between[64] = { SQUARE_TABLE(betweenRow) };
 
 // bit mask containing squares in the same 'line' as two given squares
-uint64 Line[64][64];
+TABLE_CONSTEXPR const LookupTable<uint64, 64> Line[64] = { SQUARE_TABLE(lineRow) };
 
 // squares a piece can attack in an empty board
-uint64 RookAttacks    [64];
-uint64 BishopAttacks  [64];
-uint64 QueenAttacks   [64];
-uint64 KingAttacks    [64];
-uint64 KnightAttacks  [64];
+TABLE_CONSTEXPR const uint64 RookAttacks    [64] = { SQUARE_TABLE(rookAttacksFrom)   };
+TABLE_CONSTEXPR const uint64 BishopAttacks  [64] = { SQUARE_TABLE(bishopAttacksFrom) };
+TABLE_CONSTEXPR const uint64 QueenAttacks   [64] = { SQUARE_TABLE(queenAttacksFrom)  };
+TABLE_CONSTEXPR const uint64 KingAttacks    [64] = { SQUARE_TABLE(kingAttacksFrom)   };
+TABLE_CONSTEXPR const uint64 KnightAttacks  [64] = { SQUARE_TABLE(knightAttacksFrom) };
 uint64 pawnAttacks[2] [64];
 
+// same as RookAttacks and BishopAttacks, but corner bits masked off
+TABLE_CONSTEXPR const uint64 RookAttacksMasked   [64] = { SQUARE_TABLE(rookAttacksMaskedFrom)   };
+TABLE_CONSTEXPR const uint64 BishopAttacksMasked [64] = { SQUARE_TABLE(bishopAttacksMaskedFrom) };
+
+
+// Fixed shift fancy magics
+// taken from http://www.open-aurec.com/wbforum/viewtopic.php?f=4&t=51162
+// third column is the offset in the byte lookup table: sum of no. of distinct attack sets of the previous squares
+
+TABLE_CONSTEXPR const FancyMagicEntry bishop_magics_fancy[64] =
+{
+    { 0x007bfeffbfeffbffull,  16530,    0 },
+    { 0x003effbfeffbfe08ull,   9162,    7 },
+    { 0x0000401020200000ull,   9674,   13 },
+    { 0x0000200810000000ull,  18532,   23 },
+    { 0x0000110080000000ull,  19172,   35 },
+    { 0x0000080100800000ull,  17700,   47 },
+    { 0x0007efe0bfff8000ull,   5730,   57 },
+    { 0x00000fb0203fff80ull,  19661,   63 },
+    { 0x00007dff7fdff7fdull,  17065,   70 },
+    { 0x0000011fdff7efffull,  12921,   76 },
+    { 0x0000004010202000ull,  15683,   82 },
+    { 0x0000002008100000ull,  17764,   92 },
+    { 0x0000001100800000ull,  19684,  104 },
+    { 0x0000000801008000ull,  18724,  116 },
+    { 0x000007efe0bfff80ull,   4108,  126 },
+    { 0x000000080f9fffc0ull,  12936,  132 },
+    { 0x0000400080808080ull,  15747,  138 },
+    { 0x0000200040404040ull,   4066,  148 },
+    { 0x0000400080808080ull,  14359,  158 },
+    { 0x0000200200801000ull,  36039,  198 },
+    { 0x0000240080840000ull,  20457,  246 },
+    { 0x0000080080840080ull,  43291,  294 },
+    { 0x0000040010410040ull,   5606,  334 },
+    { 0x0000020008208020ull,   9497,  344 },
+    { 0x0000804000810100ull,  15715,  354 },
+    { 0x0000402000408080ull,  13388,  366 },
+    { 0x0000804000810100ull,   5986,  378 },
+    { 0x0000404004010200ull,  11814,  426 },
+    { 0x0000404004010040ull,  92656,  534 },
+    { 0x0000101000804400ull,   9529,  642 },
+    { 0x0000080800104100ull,  18118,  690 },
+    { 0x0000040400082080ull,   5826,  702 },
+    { 0x0000410040008200ull,   4620,  714 },
+    { 0x0000208020004100ull,  12958,  726 },
+    { 0x0000110080040008ull,  55229,  738 },
+    { 0x0000020080080080ull,   9892,  786 },
+    { 0x0000404040040100ull,  33767,  894 },
+    { 0x0000202040008040ull,  20023, 1002 },
+    { 0x0000101010002080ull,   6515, 1050 },
+    { 0x0000080808001040ull,   6483, 1062 },
+    { 0x0000208200400080ull,  19622, 1074 },
+    { 0x0000104100200040ull,   6274, 1084 },
+    { 0x0000208200400080ull,  18404, 1094 },
+    { 0x0000008840200040ull,  14226, 1134 },
+    { 0x0000020040100100ull,  17990, 1182 },
+    { 0x007fff80c0280050ull,  18920, 1230 },
+    { 0x0000202020200040ull,  13862, 1270 },
+    { 0x0000101010100020ull,  19590, 1280 },
+    { 0x0007ffdfc17f8000ull,   5884, 1290 },
+    { 0x0003ffefe0bfc000ull,  12946, 1296 },
+    { 0x0000000820806000ull,   5570, 1302 },
+    { 0x00000003ff004000ull,  18740, 1312 },
+    { 0x0000000100202000ull,   6242, 1324 },
+    { 0x0000004040802000ull,  12326, 1336 },
+    { 0x007ffeffbfeff820ull,   4156, 1346 },
+    { 0x003fff7fdff7fc10ull,  12876, 1352 },
+    { 0x0003ffdfdfc27f80ull,  17047, 1358 },
+    { 0x000003ffefe0bfc0ull,  17780, 1365 },
+    { 0x0000000008208060ull,   2494, 1371 },
+    { 0x0000000003ff0040ull,  17716, 1381 },
+    { 0x0000000001002020ull,  17067, 1393 },
+    { 0x0000000040408020ull,   9465, 1405 },
+    { 0x00007ffeffbfeff9ull,  16196, 1415 },
+    { 0x007ffdff7fdff7fdull,   6166, 1421 }
+};
+
+TABLE_CONSTEXPR const FancyMagicEntry rook_magics_fancy[64] =
+{
+    { 0x00a801f7fbfeffffull,  85487,    0 },
+    { 0x00180012000bffffull,  43101,   49 },
+    { 0x0040080010004004ull,      0,   91 },
+    { 0x0040040008004002ull,  49085,  161 },
+    { 0x0040020004004001ull,  93168,  245 },
+    { 0x0020008020010202ull,  78956,  329 },
+    { 0x0040004000800100ull,  60703,  399 },
+    { 0x0810020990202010ull,  64799,  441 },
+    { 0x000028020a13fffeull,  30640,  490 },
+    { 0x003fec008104ffffull,   9256,  532 },
+    { 0x00001800043fffe8ull,  28647,  568 },
+    { 0x00001800217fffe8ull,  10404,  628 },
+    { 0x0000200100020020ull,  63775,  700 },
+    { 0x0000200080010020ull,  14500,  772 },
+    { 0x0000300043ffff40ull,  52819,  832 },
+    { 0x000038010843fffdull,   2048,  868 },
+    { 0x00d00018010bfff8ull,  52037,  910 },
+    { 0x0009000c000efffcull,  16435,  980 },
+    { 0x0004000801020008ull,  29104, 1040 },
+    { 0x0002002004002002ull,  83439, 1140 },
+    { 0x0001002002002001ull,  86842, 1260 },
+    { 0x0001001000801040ull,  27623, 1380 },
+    { 0x0000004040008001ull,  26599, 1480 },
+    { 0x0000802000200040ull,  89583, 1540 },
+    { 0x0040200010080010ull,   7042, 1610 },
+    { 0x0000080010040010ull,  84463, 1694 },
+    { 0x0004010008020008ull,  82415, 1766 },
+    { 0x0000020020040020ull,  95216, 1886 },
+    { 0x0000010020020020ull,  35015, 2030 },
+    { 0x0000008020010020ull,  10790, 2174 },
+    { 0x0000008020200040ull,  53279, 2294 },
+    { 0x0000200020004081ull,  70684, 2366 },
+    { 0x0040001000200020ull,  38640, 2450 },
+    { 0x0000080400100010ull,  32743, 2534 },
+    { 0x0004010200080008ull,  68894, 2606 },
+    { 0x0000200200200400ull,  62751, 2726 },
+    { 0x0000200100200200ull,  41670, 2870 },
+    { 0x0000200080200100ull,  25575, 3014 },
+    { 0x0000008000404001ull,   3042, 3134 },
+    { 0x0000802000200040ull,  36591, 3206 },
+    { 0x00ffffb50c001800ull,  69918, 3290 },
+    { 0x007fff98ff7fec00ull,   9092, 3360 },
+    { 0x003ffff919400800ull,  17401, 3420 },
+    { 0x001ffff01fc03000ull,  40688, 3520 },
+    { 0x0000010002002020ull,  96240, 3640 },
+    { 0x0000008001002020ull,  91632, 3760 },
+    { 0x0003fff673ffa802ull,  32495, 3860 },
+    { 0x0001fffe6fff9001ull,  51133, 3920 },
+    { 0x00ffffd800140028ull,  78319, 3990 },
+    { 0x007fffe87ff7ffecull,  12595, 4032 },
+    { 0x003fffd800408028ull,   5152, 4068 },
+    { 0x001ffff111018010ull,  32110, 4128 },
+    { 0x000ffff810280028ull,  13894, 4200 },
+    { 0x0007fffeb7ff7fd8ull,   2546, 4272 },
+    { 0x0003fffc0c480048ull,  41052, 4332 },
+    { 0x0001ffffa2280028ull,  77676, 4368 },
+    { 0x00ffffe4ffdfa3baull,  73580, 4410 },
+    { 0x007ffb7fbfdfeff6ull,  44947, 4459 },
+    { 0x003fffbfdfeff7faull,  73565, 4501 },
+    { 0x001fffeff7fbfc22ull,  17682, 4571 },
+    { 0x000ffffbf7fc2ffeull,  56607, 4655 },
+    { 0x0007fffdfa03ffffull,  56135, 4739 },
+    { 0x0003ffdeff7fbdecull,  44989, 4809 },
+    { 0x0001ffff99ffab2full,  21479, 4851 }
+};
+
+
 // magic lookup tables
-// plain magics (Fancy magic lookup tables in FancyMagics.h)
-#define ROOK_MAGIC_BITS    12
-#define BISHOP_MAGIC_BITS  9
+// plain magics: one table per square, uses the same (fixed shift) factors as fancy magics
+TABLE_CONSTEXPR uint64 rookMagicFactor  (int square) { return rook_magics_fancy  [square].factor; }
+TABLE_CONSTEXPR uint64 bishopMagicFactor(int square) { return bishop_magics_fancy[square].factor; }
 
-uint64 rookMagics            [64];
-uint64 bishopMagics          [64];
+TABLE_CONSTEXPR const uint64 rookMagics            [64] = { SQUARE_TABLE(rookMagicFactor)   };
+TABLE_CONSTEXPR const uint64 bishopMagics          [64] = { SQUARE_TABLE(bishopMagicFactor) };
 
-// same as RookAttacks and BishopAttacks, but corner bits masked off
-uint64 RookAttacksMasked   [64];
-uint64 BishopAttacksMasked [64];
+template <int bits>
+TABLE_CONSTEXPR LookupTable<uint64, 1 << bits> magicAttackTable(int square, uint64 mask, uint64 magic, int bishop)
+{
+    LookupTable<uint64, 1 << bits> table = {};
+    SlidingRays rays = slidingRays(square, bishop);
 
-uint64 rookMagicAttackTables      [64][1 << ROOK_MAGIC_BITS  ];    // 2 MB
-uint64 bishopMagicAttackTables    [64][1 << BISHOP_MAGIC_BITS];    // 256 KB
+    // all subsets of the mask
+    uint64 occ = 0;
+    do
+    {
+        table.v[(occ * magic) >> (64 - bits)] = slidingAttacks(rays, occ);
+        occ = (occ - mask) & mask;
+    } while (occ);
 
-// set of random numbers for zobrist hashing
-ZobristRandoms zob;
+    return table;
+}
 
-// another set used for 128-bit hashes
-ZobristRandoms zob2;
+TABLE_CONSTEXPR LookupTable<uint64, 1 << ROOK_MAGIC_BITS> rookMagicAttackTable(int square)
+{
+    return magicAttackTable<ROOK_MAGIC_BITS>(square, RookAttacksMasked[square], rookMagics[square], false);
+}
 
+TABLE_CONSTEXPR LookupTable<uint64, 1 << BISHOP_MAGIC_BITS> bishopMagicAttackTable(int square)
+{
+    return magicAttackTable<BISHOP_MAGIC_BITS>(square, BishopAttacksMasked[square], bishopMagics[square], true);
+}
 
-// Fixed shift fancy magics
-// taken from http://www.open-aurec.com/wbforum/viewtopic.php?f=4&t=51162
+TABLE_CONSTEXPR const LookupTable<uint64, 1 << ROOK_MAGIC_BITS  > rookMagicAttackTables   [64] = { SQUARE_TABLE(rookMagicAttackTable)   };    // 2 MB
+TABLE_CONSTEXPR const LookupTable<uint64, 1 << BISHOP_MAGIC_BITS> bishopMagicAttackTables [64] = { SQUARE_TABLE(bishopMagicAttackTable) };    // 256 KB
 
-uint64 fancy_magic_lookup_table[97264];
-
-
-FancyMagicEntry bishop_magics_fancy[64] =
-{
-    { 0x007bfeffbfeffbffull,  16530 },
-    { 0x003effbfeffbfe08ull,   9162 },
-    { 0x0000401020200000ull,   9674 },
-    { 0x0000200810000000ull,  18532 },
-    { 0x0000110080000000ull,  19172 },
-    { 0x0000080100800000ull,  17700 },
-    { 0x0007efe0bfff8000ull,   5730 },
-    { 0x00000fb0203fff80ull,  19661 },
-    { 0x00007dff7fdff7fdull,  17065 },
-    { 0x0000011fdff7efffull,  12921 },
-    { 0x0000004010202000ull,  15683 },
-    { 0x0000002008100000ull,  17764 },
-    { 0x0000001100800000ull,  19684 },
-    { 0x0000000801008000ull,  18724 },
-    { 0x000007efe0bfff80ull,   4108 },
-    { 0x000000080f9fffc0ull,  12936 },
-    { 0x0000400080808080ull,  15747 },
-    { 0x0000200040404040ull,   4066 },
-    { 0x0000400080808080ull,  14359 },
-    { 0x0000200200801000ull,  36039 },
-    { 0x0000240080840000ull,  20457 },
-    { 0x0000080080840080ull,  43291 },
-    { 0x0000040010410040ull,   5606 },
-    { 0x0000020008208020ull,   9497 },
-    { 0x0000804000810100ull,  15715 },
-    { 0x0000402000408080ull,  13388 },
-    { 0x0000804000810100ull,   5986 },
-    { 0x0000404004010200ull,  11814 },
-    { 0x0000404004010040ull,  92656 },
-    { 0x0000101000804400ull,   9529 },
-    { 0x0000080800104100ull,  18118 },
-    { 0x0000040400082080ull,   5826 },
-    { 0x0000410040008200ull,   4620 },
-    { 0x0000208020004100ull,  12958 },
-    { 0x0000110080040008ull,  55229 },
-    { 0x0000020080080080ull,   9892 },
-    { 0x0000404040040100ull,  33767 },
-    { 0x0000202040008040ull,  20023 },
-    { 0x0000101010002080ull,   6515 },
-    { 0x0000080808001040ull,   6483 },
-    { 0x0000208200400080ull,  19622 },
-    { 0x0000104100200040ull,   6274 },
-    { 0x0000208200400080ull,  18404 },
-    { 0x0000008840200040ull,  14226 },
-    { 0x0000020040100100ull,  17990 },
-    { 0x007fff80c0280050ull,  18920 },
-    { 0x0000202020200040ull,  13862 },
-    { 0x0000101010100020ull,  19590 },
-    { 0x0007ffdfc17f8000ull,   5884 },
-    { 0x0003ffefe0bfc000ull,  12946 },
-    { 0x0000000820806000ull,   5570 },
-    { 0x00000003ff004000ull,  18740 },
-    { 0x0000000100202000ull,   6242 },
-    { 0x0000004040802000ull,  12326 },
-    { 0x007ffeffbfeff820ull,   4156 },
-    { 0x003fff7fdff7fc10ull,  12876 },
-    { 0x0003ffdfdfc27f80ull,  17047 },
-    { 0x000003ffefe0bfc0ull,  17780 },
-    { 0x0000000008208060ull,   2494 },
-    { 0x0000000003ff0040ull,  17716 },
-    { 0x0000000001002020ull,  17067 },
-    { 0x0000000040408020ull,   9465 },
-    { 0x00007ffeffbfeff9ull,  16196 },
-    { 0x007ffdff7fdff7fdull,   6166 }
-};
 
-FancyMagicEntry rook_magics_fancy[64] =
-{
-    { 0x00a801f7fbfeffffull,  85487 },
-    { 0x00180012000bffffull,  43101 },
-    { 0x0040080010004004ull,      0 },
-    { 0x0040040008004002ull,  49085 },
-    { 0x0040020004004001ull,  93168 },
-    { 0x0020008020010202ull,  78956 },
-    { 0x0040004000800100ull,  60703 },
-    { 0x0810020990202010ull,  64799 },
-    { 0x000028020a13fffeull,  30640 },
-    { 0x003fec008104ffffull,   9256 },
-    { 0x00001800043fffe8ull,  28647 },
-    { 0x00001800217fffe8ull,  10404 },
-    { 0x0000200100020020ull,  63775 },
-    { 0x0000200080010020ull,  14500 },
-    { 0x0000300043ffff40ull,  52819 },
-    { 0x000038010843fffdull,   2048 },
-    { 0x00d00018010bfff8ull,  52037 },
-    { 0x0009000c000efffcull,  16435 },
-    { 0x0004000801020008ull,  29104 },
-    { 0x0002002004002002ull,  83439 },
-    { 0x0001002002002001ull,  86842 },
-    { 0x0001001000801040ull,  27623 },
-    { 0x0000004040008001ull,  26599 },
-    { 0x0000802000200040ull,  89583 },
-    { 0x0040200010080010ull,   7042 },
-    { 0x0000080010040010ull,  84463 },
-    { 0x0004010008020008ull,  82415 },
-    { 0x0000020020040020ull,  95216 },
-    { 0x0000010020020020ull,  35015 },
-    { 0x0000008020010020ull,  10790 },
-    { 0x0000008020200040ull,  53279 },
-    { 0x0000200020004081ull,  70684 },
-    { 0x0040001000200020ull,  38640 },
-    { 0x0000080400100010ull,  32743 },
-    { 0x0004010200080008ull,  68894 },
-    { 0x0000200200200400ull,  62751 },
-    { 0x0000200100200200ull,  41670 },
-    { 0x0000200080200100ull,  25575 },
-    { 0x0000008000404001ull,   3042 },
-    { 0x0000802000200040ull,  36591 },
-    { 0x00ffffb50c001800ull,  69918 },
-    { 0x007fff98ff7fec00ull,   9092 },
-    { 0x003ffff919400800ull,  17401 },
-    { 0x001ffff01fc03000ull,  40688 },
-    { 0x0000010002002020ull,  96240 },
-    { 0x0000008001002020ull,  91632 },
-    { 0x0003fff673ffa802ull,  32495 },
-    { 0x0001fffe6fff9001ull,  51133 },
-    { 0x00ffffd800140028ull,  78319 },
-    { 0x007fffe87ff7ffecull,  12595 },
-    { 0x003fffd800408028ull,   5152 },
-    { 0x001ffff111018010ull,  32110 },
-    { 0x000ffff810280028ull,  13894 },
-    { 0x0007fffeb7ff7fd8ull,   2546 },
-    { 0x0003fffc0c480048ull,  41052 },
-    { 0x0001ffffa2280028ull,  77676 },
-    { 0x00ffffe4ffdfa3baull,  73580 },
-    { 0x007ffb7fbfdfeff6ull,  44947 },
-    { 0x003fffbfdfeff7faull,  73565 },
-    { 0x001fffeff7fbfc22ull,  17682 },
-    { 0x000ffffbf7fc2ffeull,  56607 },
-    { 0x0007fffdfa03ffffull,  56135 },
-    { 0x0003ffdeff7fbdecull,  44989 },
-    { 0x0001ffff99ffab2full,  21479 }
-};
+// fancy magics: tables of different squares overlap
+// (an entry is either unused by the other square, or contains the same attack set)
+TABLE_CONSTEXPR LookupTable<uint64, 97264> fancyMagicLookupTable()
+{
+    LookupTable<uint64, 97264> table = {};
+    for (int square = A1; square <= H8; square++)
+        for (int bishop = 0; bishop < 2; bishop++)
+        {
+            const FancyMagicEntry &entry = bishop ? bishop_magics_fancy[square] : rook_magics_fancy[square];
+            uint64 mask = bishop ? BishopAttacksMasked[square] : RookAttacksMasked[square];
+            int    bits = bishop ? BISHOP_MAGIC_BITS : ROOK_MAGIC_BITS;
+            SlidingRays rays = slidingRays(square, bishop);
+
+            uint64 occ = 0;
+            do
+            {
+                table.v[entry.position + ((occ * entry.factor) >> (64 - bits))] = slidingAttacks(rays, occ);
+                occ = (occ - mask) & mask;
+            } while (occ);
+        }
+    return table;
+}
 
+TABLE_CONSTEXPR const LookupTable<uint64, 97264> fancy_magic_lookup_table = fancyMagicLookupTable();
 
 
 // byte lookup version of the above table
 // 'inspired from': http://chessprogramming.wikispaces.com/Magic+Bitboards#Implementations-Byte Lookup
 // smallest set of magic tables ( < 150 KB including everything)? 
 
-uint8  fancy_byte_magic_lookup_table[97264];  // 95 KB
-uint64 fancy_byte_RookLookup        [4900] ;  // 39 K
-uint64 fancy_byte_BishopLookup      [1428] ;  // 11 K
+TABLE_CONSTEXPR LookupTable<uint8, 97264> fancyByteMagicLookupTable()
+{
+    LookupTable<uint8, 97264> table = {};
+    for (int square = A1; square <= H8; square++)
+        for (int bishop = 0; bishop < 2; bishop++)
+        {
+            const FancyMagicEntry &entry = bishop ? bishop_magics_fancy[square] : rook_magics_fancy[square];
+            uint64 mask = bishop ? BishopAttacksMasked[square] : RookAttacksMasked[square];
+            int    bits = bishop ? BISHOP_MAGIC_BITS : ROOK_MAGIC_BITS;
+            SlidingRays rays = slidingRays(square, bishop);
+
+            uint64 occ = 0;
+            do
+            {
+                table.v[entry.position + ((occ * entry.factor) >> (64 - bits))] = (uint8) uniqueAttackIndex(rays, occ);
+                occ = (occ - mask) & mask;
+            } while (occ);
+        }
+    return table;
+}
+
+// the distinct attack sets of all squares, the digits of uniqueAttackIndex() give the no. of squares attacked in each direction
+template <int size>
+TABLE_CONSTEXPR LookupTable<uint64, size> fancyByteAttackTable(const FancyMagicEntry *entries, int bishop)
+{
+    LookupTable<uint64, size> table = {};
+    for (int square = A1; square <= H8; square++)
+    {
+        SlidingRays rays = slidingRays(square, bishop);
+
+        int numAttackSets = 1;
+        for (int d = 0; d < 4; d++)
+            if (rays.ray[d])
+                numAttackSets *= bitCount(rays.ray[d]);
+
+        for (int i = 0; i < numAttackSets; i++)
+        {
+            uint64 attacks = 0;
+            int digits = i;
+            for (int d = 3; d >= 0; d--)
+            {
+                int length = bitCount(rays.ray[d]);
+                if (length == 0)
+                    continue;
+
+                // first (digit + 1) squares of the ray
+                int df = slidingDirections[bishop][d][0], dr = slidingDirections[bishop][d][1];
+                int file = square & 7, rank = square >> 3;
+                for (int n = digits % length; n >= 0; n--)
+                {
+                    file += df;
+                    rank += dr;
+                    attacks |= BIT(rank * 8 + file);
+                }
+                digits /= length;
+            }
+            table.v[entries[square].offset + i] = attacks;
+        }
+    }
+    return table;
+}
+
+TABLE_CONSTEXPR const LookupTable<uint8,  97264> fancy_byte_magic_lookup_table = fancyByteMagicLookupTable();                       // 95 KB
+TABLE_CONSTEXPR const LookupTable<uint64, NUM_UNIQUE_ROOK_ATTACKS  > fancy_byte_RookLookup =
+    fancyByteAttackTable<NUM_UNIQUE_ROOK_ATTACKS>  (rook_magics_fancy,   false);                                                                               // 39 K
+TABLE_CONSTEXPR const LookupTable<uint64, NUM_UNIQUE_BISHOP_ATTACKS> fancy_byte_BishopLookup =
+    fancyByteAttackTable<NUM_UNIQUE_BISHOP_ATTACKS>(bishop_magics_fancy, true);                                                                                 // 11 K
+
+
+// PEXT indexed sliding attack tables (see USE_PEXT_SLIDING)
+// contains pext(attacks, empty board attacks) for every subset of the masked attacks
+// pext() of an occupancy with the mask is simply the position of the occupancy in the
+// carry-rippler enumeration of subsets of the mask, so no BMI2 is needed to build the tables
+// one fixed size table per square (like plain magics) - only the first 2^(bits in mask) entries are used
+template <int bits>
+TABLE_CONSTEXPR LookupTable<uint16, 1 << bits> pextAttackTable(int square, uint64 mask, int bishop)
+{
+    LookupTable<uint16, 1 << bits> table = {};
+    SlidingRays rays = slidingRays(square, bishop);
+    uint64 emptyBoardAttacks = slidingAttacks(rays, 0);
+
+    int index = 0;
+    uint64 occ = 0;
+    do
+    {
+        uint64 attacks = slidingAttacks(rays, occ);
+
+        uint16 compressed = 0;
+        int bit = 0;
+        for (uint64 m = emptyBoardAttacks; m; m &= m - 1, bit++)
+        {
+            if (attacks & m & (0 - m))
+                compressed |= (1 << bit);
+        }
+        table.v[index++] = compressed;
+
+        occ = (occ - mask) & mask;
+    } while (occ);
+
+    return table;
+}
+
+TABLE_CONSTEXPR LookupTable<uint16, 1 << ROOK_MAGIC_BITS> rookPextAttackTable(int square)
+{
+    return pextAttackTable<ROOK_MAGIC_BITS>(square, RookAttacksMasked[square], false);
+}
+
+TABLE_CONSTEXPR LookupTable<uint16, 1 << BISHOP_MAGIC_BITS> bishopPextAttackTable(int square)
+{
+    return pextAttackTable<BISHOP_MAGIC_BITS>(square, BishopAttacksMasked[square], true);
+}
+
+TABLE_CONSTEXPR const LookupTable<uint16, 1 << ROOK_MAGIC_BITS  > rookPextAttackTables   [64] = { SQUARE_TABLE(rookPextAttackTable)   };    // 512 KB
+TABLE_CONSTEXPR const LookupTable<uint16, 1 << BISHOP_MAGIC_BITS> bishopPextAttackTables [64] = { SQUARE_TABLE(bishopPextAttackTable) };    // 64 KB
+
+
+// sliding attack lookup used by CPU code (one of SlidingBackend)
+int    slidingBackend = SLIDING_FANCY_MAGICS;
+
+// set of random numbers for zobrist hashing
+ZobristRandoms zob;
+
+// another set used for 128-bit hashes
+ZobristRandoms zob2;
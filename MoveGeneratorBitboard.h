@@ -9,6 +9,7 @@
 #endif
 
 #include <time.h>
+#include <chrono>
 
 
 // bit board constants
@@ -138,20 +139,134 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE uint8 bitScan(uint64 x)
 #endif
 }
 
+#if USE_PEXT_SLIDING == 1
+// BMI2 parallel bits extract/deposit (CPU only)
+// the instructions are emitted directly so that the rest of the program doesn't need to be built for BMI2
+// (only called when the CPU supports BMI2)
+CPU_FORCE_INLINE uint64 pext(uint64 x, uint64 mask)
+{
+#ifdef __linux__
+    uint64 res;
+    asm ("pextq %2, %1, %0" : "=r" (res) : "r" (x), "r" (mask));
+    return res;
+#else
+    return _pext_u64(x, mask);
+#endif
+}
+
+CPU_FORCE_INLINE uint64 pdep(uint64 x, uint64 mask)
+{
+#ifdef __linux__
+    uint64 res;
+    asm ("pdepq %2, %1, %0" : "=r" (res) : "r" (x), "r" (mask));
+    return res;
+#else
+    return _pdep_u64(x, mask);
+#endif
+}
+#endif
+
+// flip the board vertically (rank 1 <-> rank 8)
+CPU_FORCE_INLINE uint64 flipVertical(uint64 x)
+{
+#ifdef __GNUC__
+    return __builtin_bswap64(x);
+#else
+    return _byteswap_uint64(x);
+#endif
+}
+
+// features of the CPU the code paths picked at runtime depend on
+// (PEXT sliding lookups, AVX2 kogge stone fills, SIMD countMoves)
+// all of them are detected here in one go, straight from CPUID and XGETBV
+#ifdef __linux__
+#include <cpuid.h>
+#endif
+
+struct CpuFeatures
+{
+    bool bmi2;
+    bool fastPext;      // BMI2, and PEXT/PDEP are not microcoded (they are on AMD and Hygon CPUs before Zen 3 - family 19h)
+    bool avx2;          // AVX2, and the OS saves the AVX register state
+    bool avx512Popcnt;  // AVX-512F and VPOPCNTDQ (Ice Lake, Zen 4 and newer), and the OS saves the AVX-512 register state
+};
+
+// regs: eax, ebx, ecx, edx
+static void cpuid(uint32 regs[4], uint32 leaf, uint32 subLeaf)
+{
+#ifdef __linux__
+    __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#else
+    int info[4];
+    __cpuidex(info, leaf, subLeaf);
+    memcpy(regs, info, sizeof(info));
+#endif
+}
+
+static uint64 xgetbv0()
+{
+#ifdef __linux__
+    uint32 lo, hi;
+    asm ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    return ((uint64) hi << 32) | lo;
+#else
+    return _xgetbv(0);
+#endif
+}
+
+static CpuFeatures detectCpuFeatures()
+{
+    CpuFeatures features = {};
+    uint32 regs[4];
+
+    cpuid(regs, 0, 0);
+    uint32 maxLeaf = regs[0];
+    char vendor[13] = {};
+    memcpy(&vendor[0], &regs[1], 4);
+    memcpy(&vendor[4], &regs[3], 4);
+    memcpy(&vendor[8], &regs[2], 4);
+    if (maxLeaf < 7)
+        return features;
+
+    cpuid(regs, 1, 0);
+    uint32 family = (regs[0] >> 8) & 0xF;
+    if (family == 0xF)
+        family += (regs[0] >> 20) & 0xFF;
+    bool osxsave = (regs[2] >> 27) & 1;
+    uint64 xcr0 = osxsave ? xgetbv0() : 0;
+
+    cpuid(regs, 7, 0);
+    features.bmi2         = (regs[1] >> 8) & 1;
+    features.fastPext     = features.bmi2 &&
+                            !((strcmp(vendor, "AuthenticAMD") == 0 || strcmp(vendor, "HygonGenuine") == 0) && family < 0x19);
+    features.avx2         = ((regs[1] >> 5) & 1) && (xcr0 & 0x6) == 0x6;
+    features.avx512Popcnt = ((regs[1] >> 16) & 1) && ((regs[2] >> 14) & 1) && (xcr0 & 0xE6) == 0xE6;
+
+    return features;
+}
+
+static const CpuFeatures cpuFeatures = detectCpuFeatures();
+
+#if USE_SIMD_KOGGE_STONE == 1 && !defined(__CUDACC__)
+// kogge stone fills for all eight directions run in SIMD lanes when this is set (otherwise the SSE2 version)
+static bool useAvx2KoggeStone = cpuFeatures.avx2;
+#endif
+
 
 // CPU copy of all the below global variables are defined in GlobalVars.cpp
+// (generated at compile time)
 // bit mask containing squares between two given squares
-extern uint64 Between[64][64];
+extern const LookupTable<uint64, 64> Between[64];
 
 // bit mask containing squares in the same 'line' as two given squares
-extern uint64 Line[64][64];
+extern const LookupTable<uint64, 64> Line[64];
 
 // squares a piece can attack in an empty board
-extern uint64 RookAttacks    [64];
-extern uint64 BishopAttacks  [64];
-extern uint64 QueenAttacks   [64];
-extern uint64 KingAttacks    [64];
-extern uint64 KnightAttacks  [64];
+extern const uint64 RookAttacks    [64];
+extern const uint64 BishopAttacks  [64];
+extern const uint64 QueenAttacks   [64];
+extern const uint64 KingAttacks    [64];
+extern const uint64 KnightAttacks  [64];
 extern uint64 pawnAttacks[2] [64];
 
 // magic lookup tables
@@ -159,23 +274,32 @@ extern uint64 pawnAttacks[2] [64];
 #define ROOK_MAGIC_BITS    12
 #define BISHOP_MAGIC_BITS  9
 
-extern uint64 rookMagics            [64];
-extern uint64 bishopMagics          [64];
+extern const uint64 rookMagics            [64];
+extern const uint64 bishopMagics          [64];
 
 // same as RookAttacks and BishopAttacks, but corner bits masked off
-extern uint64 RookAttacksMasked   [64];
-extern uint64 BishopAttacksMasked [64];
+extern const uint64 RookAttacksMasked   [64];
+extern const uint64 BishopAttacksMasked [64];
+
+extern const LookupTable<uint64, 1 << ROOK_MAGIC_BITS  > rookMagicAttackTables   [64];    // 2 MB
+extern const LookupTable<uint64, 1 << BISHOP_MAGIC_BITS> bishopMagicAttackTables [64];    // 256 KB
+
+// sliding attack lookup used by CPU code (one of SlidingBackend)
+extern int    slidingBackend;
+
+static const char *slidingBackendNames[NUM_SLIDING_BACKENDS] = {"kogge", "magics", "fancy", "bytefancy", "pext"};
 
-extern uint64 rookMagicAttackTables      [64][1 << ROOK_MAGIC_BITS  ];    // 2 MB
-extern uint64 bishopMagicAttackTables    [64][1 << BISHOP_MAGIC_BITS];    // 256 KB
+// PEXT indexed tables (CPU only)
+extern const LookupTable<uint16, 1 << ROOK_MAGIC_BITS  > rookPextAttackTables   [64];    // 512 KB
+extern const LookupTable<uint16, 1 << BISHOP_MAGIC_BITS> bishopPextAttackTables [64];    // 64 KB
 
 // fancy and byte-lookup fancy magic tables
-extern uint64 fancy_magic_lookup_table[97264];
-extern FancyMagicEntry bishop_magics_fancy[64];
-extern FancyMagicEntry rook_magics_fancy[64];
-extern uint8  fancy_byte_magic_lookup_table[97264];  // 95 KB
-extern uint64 fancy_byte_RookLookup        [4900] ;  // 39 K
-extern uint64 fancy_byte_BishopLookup      [1428] ;  // 11 K
+extern const LookupTable<uint64, 97264> fancy_magic_lookup_table;
+extern const FancyMagicEntry bishop_magics_fancy[64];
+extern const FancyMagicEntry rook_magics_fancy[64];
+extern const LookupTable<uint8,  97264> fancy_byte_magic_lookup_table;                       // 95 KB
+extern const LookupTable<uint64, NUM_UNIQUE_ROOK_ATTACKS  > fancy_byte_RookLookup;          // 39 K
+extern const LookupTable<uint64, NUM_UNIQUE_BISHOP_ATTACKS> fancy_byte_BishopLookup;        // 11 K
 
 
 uint64 findRookMagicForSquare  (int square, uint64 magicAttackTable[], uint64 magic = 0, uint64 *uniqueAttackTable = NULL, uint8 *byteIndices = NULL, int *numUniqueAttacks = 0);
@@ -445,6 +569,187 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE uint64 sq_fancy_byte_RookLookup(int index)
 #endif
 }
 
+
+// kind of piece of a MoveSet entry (decides how the flags of the moves are worked out)
+#define MOVE_SET_PIECE      0   // knight, bishop, rook or queen
+#define MOVE_SET_KING       1   // a king move of two squares is castling
+#define MOVE_SET_PAWN       2   // a pawn move of two squares is a double push, a move to the en-passent target is an en-passent capture
+#define MOVE_SET_PROMOTION  3   // pawn that promotes: every destination square is four moves (knight, bishop, rook, queen)
+
+// compact representation of all the legal moves of a position (instead of an expanded CMove list)
+// one entry per piece that can move: source square and bitboard of destination squares.
+// Flags of a move aren't stored but worked out from the kind of piece and the destination square when the move is read.
+// ~200 bytes vs 512 bytes for CMove[MAX_MOVES] and 12 KB for HexaBitBoardPosition[MAX_MOVES]
+struct MoveSet
+{
+    uint64 targets[16];         // destination squares of each entry
+    uint8  from[16];            // source square of each entry
+    uint8  kind[16];            // MOVE_SET_*
+    uint32 nEntries;
+
+    uint64 enemyPieces;         // to set capture flags
+    uint64 enPassentTarget;     // square a pawn moves to when capturing en-passent (0 if none)
+
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE void addEntry(uint8 src, uint64 dst, uint8 pieceKind)
+    {
+        if (dst)
+        {
+            targets[nEntries] = dst;
+            from[nEntries]    = src;
+            kind[nEntries]    = pieceKind;
+            nEntries++;
+        }
+    }
+
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE uint32 entryMoves(uint32 entry) const
+    {
+        return popCount(targets[entry]) << (kind[entry] == MOVE_SET_PROMOTION ? 2 : 0);
+    }
+
+    // total no. of moves
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE uint32 count() const
+    {
+        uint32 nMoves = 0;
+        for (uint32 i = 0; i < nEntries; i++)
+            nMoves += entryMoves(i);
+        return nMoves;
+    }
+
+    // the move of the given entry to the given square
+    // promotion: 0 - knight, 1 - bishop, 2 - rook, 3 - queen (only used for MOVE_SET_PROMOTION)
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE CMove getMove(uint32 entry, uint8 to, uint32 promotion) const
+    {
+        uint8  src   = from[entry];
+        uint64 dst   = BIT(to);
+        uint8  flags = (dst & enemyPieces) ? CM_FLAG_CAPTURE : CM_FLAG_QUIET_MOVE;
+
+        switch (kind[entry])
+        {
+            case MOVE_SET_KING:
+                if (to == src + 2)
+                    flags = CM_FLAG_KING_CASTLE;
+                else if (to + 2 == src)
+                    flags = CM_FLAG_QUEEN_CASTLE;
+                break;
+            case MOVE_SET_PAWN:
+                if (to == src + 16 || to + 16 == src)
+                    flags = CM_FLAG_DOUBLE_PAWN_PUSH;
+                else if (dst & enPassentTarget)
+                    flags = CM_FLAG_EP_CAPTURE;
+                break;
+            case MOVE_SET_PROMOTION:
+                flags |= CM_FLAG_PROMOTION | promotion;
+                break;
+        }
+
+        return CMove(src, to, flags);
+    }
+
+    // indexed access (same order as iteration)
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE CMove getMove(uint32 index) const
+    {
+        uint32 entry = 0;
+        while (index >= entryMoves(entry))
+        {
+            index -= entryMoves(entry);
+            entry++;
+        }
+
+        uint32 promotion = 0;
+        if (kind[entry] == MOVE_SET_PROMOTION)
+        {
+            promotion = index & 3;
+            index >>= 2;
+        }
+
+        uint64 dst = targets[entry];
+        while (index--)
+            dst &= dst - 1;
+
+        return getMove(entry, bitScan(dst), promotion);
+    }
+
+    // iterates over all the moves of a MoveSet without expanding them:
+    //     MoveSet::Iterator it(&moveSet);
+    //     CMove move;
+    //     while (it.next(&move)) ...
+    struct Iterator
+    {
+        const MoveSet *set;
+        uint32 entry;
+        uint64 remaining;       // destination squares of current entry not visited yet
+        uint32 promotion;
+
+        CUDA_CALLABLE_MEMBER Iterator(const MoveSet *moveSet)
+        {
+            set = moveSet;
+            entry = 0;
+            remaining = moveSet->nEntries ? moveSet->targets[0] : 0;
+            promotion = 0;
+        }
+
+        CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE bool next(CMove *move)
+        {
+            while (!remaining)
+            {
+                if (++entry >= set->nEntries)
+                    return false;
+                remaining = set->targets[entry];
+            }
+
+            *move = set->getMove(entry, bitScan(remaining), promotion);
+
+            if (set->kind[entry] == MOVE_SET_PROMOTION && promotion < 3)
+            {
+                promotion++;
+            }
+            else
+            {
+                promotion = 0;
+                remaining &= remaining - 1;
+            }
+            return true;
+        }
+    };
+};
+
+// zobrist keys (128 bit) of a position and of its symmetric variants, key[0] is the regular key of the position
+// (see computeSymmetricZobristKeys128b())
+struct SymmetricKeys128b
+{
+    HashKey128b key[4];
+};
+
+// position classes (see USE_POSITION_CLASS_OPT)
+// the move generator is instantiated for every combination of these - with the code for missing features left out
+#define POS_CLASS_EP            1   // en-passent capture might be possible
+#define POS_CLASS_CASTLE        2   // side to move has castling rights
+#define POS_CLASS_PINNED        4   // side to move has pinned pieces
+#define POS_CLASS_PROMOTION     8   // side to move has pawns on 7th rank
+#define POS_CLASS_ALL           15
+
+// calls func<chance, posClass>(...) instantiated for the (run time) position class
+#define POS_CLASS_DISPATCH(func, chance, posClass, ...)                         \
+    switch (posClass)                                                           \
+    {                                                                           \
+        case 0:  return func<chance, 0> (__VA_ARGS__);                          \
+        case 1:  return func<chance, 1> (__VA_ARGS__);                          \
+        case 2:  return func<chance, 2> (__VA_ARGS__);                          \
+        case 3:  return func<chance, 3> (__VA_ARGS__);                          \
+        case 4:  return func<chance, 4> (__VA_ARGS__);                          \
+        case 5:  return func<chance, 5> (__VA_ARGS__);                          \
+        case 6:  return func<chance, 6> (__VA_ARGS__);                          \
+        case 7:  return func<chance, 7> (__VA_ARGS__);                          \
+        case 8:  return func<chance, 8> (__VA_ARGS__);                          \
+        case 9:  return func<chance, 9> (__VA_ARGS__);                          \
+        case 10: return func<chance, 10>(__VA_ARGS__);                          \
+        case 11: return func<chance, 11>(__VA_ARGS__);                          \
+        case 12: return func<chance, 12>(__VA_ARGS__);                          \
+        case 13: return func<chance, 13>(__VA_ARGS__);                          \
+        case 14: return func<chance, 14>(__VA_ARGS__);                          \
+        default: return func<chance, 15>(__VA_ARGS__);                          \
+    }
+
 class MoveGeneratorBitboard
 {
 public:
@@ -727,15 +1032,175 @@ public:
                westAttacks (rooks, pro) ;
     }
 
+#if USE_SIMD_KOGGE_STONE == 1 && !defined(__CUDACC__)
+    // all eight kogge stone fills at once using SIMD (CPU only)
+
+    // AVX2: directions going up the board (north, east, north-east, north-west) in the lanes of one register
+    // and the ones going down (south, west, south-west, south-east) in another - each lane shifting by its own amount
+#ifdef __GNUC__
+    __attribute__((target("avx2")))
+#endif
+    static uint64 slidingAttacksKoggeStoneAvx2(uint64 rooks, uint64 bishops, uint64 pro)
+    {
+        const __m256i shift1 = _mm256_setr_epi64x(8,  1, 9,  7);
+        const __m256i shift2 = _mm256_setr_epi64x(16, 2, 18, 14);
+        const __m256i shift4 = _mm256_setr_epi64x(32, 4, 36, 28);
+
+        // squares that can't be reached in each direction (wrap-around)
+        const __m256i maskUp   = _mm256_setr_epi64x(ALLSET, ~FILEA, ~FILEA, ~FILEH);
+        const __m256i maskDown = _mm256_setr_epi64x(ALLSET, ~FILEH, ~FILEH, ~FILEA);
+
+        __m256i genUp   = _mm256_setr_epi64x(rooks, rooks, bishops, bishops);
+        __m256i genDown = genUp;
+        __m256i proUp   = _mm256_and_si256(_mm256_set1_epi64x(pro), maskUp);
+        __m256i proDown = _mm256_and_si256(_mm256_set1_epi64x(pro), maskDown);
+
+        genUp   = _mm256_or_si256 (genUp,   _mm256_and_si256(_mm256_sllv_epi64(genUp,   shift1), proUp));
+        genDown = _mm256_or_si256 (genDown, _mm256_and_si256(_mm256_srlv_epi64(genDown, shift1), proDown));
+        proUp   = _mm256_and_si256(proUp,   _mm256_sllv_epi64(proUp,   shift1));
+        proDown = _mm256_and_si256(proDown, _mm256_srlv_epi64(proDown, shift1));
+
+        genUp   = _mm256_or_si256 (genUp,   _mm256_and_si256(_mm256_sllv_epi64(genUp,   shift2), proUp));
+        genDown = _mm256_or_si256 (genDown, _mm256_and_si256(_mm256_srlv_epi64(genDown, shift2), proDown));
+        proUp   = _mm256_and_si256(proUp,   _mm256_sllv_epi64(proUp,   shift2));
+        proDown = _mm256_and_si256(proDown, _mm256_srlv_epi64(proDown, shift2));
+
+        genUp   = _mm256_or_si256 (genUp,   _mm256_and_si256(_mm256_sllv_epi64(genUp,   shift4), proUp));
+        genDown = _mm256_or_si256 (genDown, _mm256_and_si256(_mm256_srlv_epi64(genDown, shift4), proDown));
+
+        __m256i attacks = _mm256_or_si256(_mm256_and_si256(_mm256_sllv_epi64(genUp,   shift1), maskUp),
+                                          _mm256_and_si256(_mm256_srlv_epi64(genDown, shift1), maskDown));
+
+        __m128i x = _mm_or_si128(_mm256_castsi256_si128(attacks), _mm256_extracti128_si256(attacks, 1));
+        x = _mm_or_si128(x, _mm_unpackhi_epi64(x, x));
+        return _mm_cvtsi128_si64(x);
+    }
+
+    // SSE2 has no per-lane shifts: a direction going down is the mirrored direction going up on the vertically flipped board,
+    // so the low lane holds the board and the high lane the flipped board (north/south, north-east/south-east and north-west/south-west)
+    // east and west are done the regular way
+    template<int shift>
+    CPU_FORCE_INLINE static __m128i fillUpSse(__m128i gen, __m128i pro)
+    {
+        gen = _mm_or_si128 (gen, _mm_and_si128(_mm_slli_epi64(gen, shift), pro));
+        pro = _mm_and_si128(pro, _mm_slli_epi64(pro, shift));
+        gen = _mm_or_si128 (gen, _mm_and_si128(_mm_slli_epi64(gen, 2 * shift), pro));
+        pro = _mm_and_si128(pro, _mm_slli_epi64(pro, 2 * shift));
+        gen = _mm_or_si128 (gen, _mm_and_si128(_mm_slli_epi64(gen, 4 * shift), pro));
+        return _mm_slli_epi64(gen, shift);
+    }
+
+    CPU_FORCE_INLINE static __m128i withFlipped(uint64 x)
+    {
+        return _mm_set_epi64x(flipVertical(x), x);
+    }
+
+    CPU_FORCE_INLINE static uint64 slidingAttacksKoggeStoneSse(uint64 rooks, uint64 bishops, uint64 pro)
+    {
+        const __m128i notFileA = _mm_set1_epi64x(~FILEA);
+        const __m128i notFileH = _mm_set1_epi64x(~FILEH);
+
+        __m128i proPair     = withFlipped(pro);
+        __m128i bishopsPair = withFlipped(bishops);
+
+        __m128i attacks = fillUpSse<8>(withFlipped(rooks), proPair);
+        attacks = _mm_or_si128(attacks, _mm_and_si128(fillUpSse<9>(bishopsPair, _mm_and_si128(proPair, notFileA)), notFileA));
+        attacks = _mm_or_si128(attacks, _mm_and_si128(fillUpSse<7>(bishopsPair, _mm_and_si128(proPair, notFileH)), notFileH));
+
+        uint64 lo = _mm_cvtsi128_si64(attacks);
+        uint64 hi = _mm_cvtsi128_si64(_mm_unpackhi_epi64(attacks, attacks));
+        return lo | flipVertical(hi) | eastAttacks(rooks, pro) | westAttacks(rooks, pro);
+    }
+#endif
+
+    // combined attacks of rooks and bishops
+    // pro - empty squares
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 slidingAttacksKoggeStone(uint64 rooks, uint64 bishops, uint64 pro)
+    {
+#if USE_SIMD_KOGGE_STONE == 1 && !defined(__CUDACC__)
+        if (useAvx2KoggeStone)
+            return slidingAttacksKoggeStoneAvx2(rooks, bishops, pro);
+        return slidingAttacksKoggeStoneSse(rooks, bishops, pro);
+#else
+        return rookAttacksKoggeStone(rooks, pro) | bishopAttacksKoggeStone(bishops, pro);
+#endif
+    }
+
 
 #if USE_SLIDING_LUT == 1
+#ifndef __CUDA_ARCH__
+    // CPU versions of the sliding attack lookup variants
+    // occ - occupancy masked with sqBishopAttacksMasked/sqRookAttacksMasked of the square
+
+    CPU_FORCE_INLINE static uint64 bishopAttacksPlainMagics(uint8 square, uint64 occ)
+    {
+        uint64 index = (bishopMagics[square] * occ) >> (64 - BISHOP_MAGIC_BITS);
+        return bishopMagicAttackTables[square][index];
+    }
+
+    CPU_FORCE_INLINE static uint64 rookAttacksPlainMagics(uint8 square, uint64 occ)
+    {
+        uint64 index = (rookMagics[square] * occ) >> (64 - ROOK_MAGIC_BITS);
+        return rookMagicAttackTables[square][index];
+    }
+
+    // this version is slightly faster for CPUs.. why ?
+    CPU_FORCE_INLINE static uint64 bishopAttacksFancyMagics(uint8 square, uint64 occ)
+    {
+        uint64 magic  = bishop_magics_fancy[square].factor;
+        uint64 index = (magic * occ) >> (64 - BISHOP_MAGIC_BITS);
+        const uint64 *table = &fancy_magic_lookup_table[bishop_magics_fancy[square].position];
+        return table[index];
+    }
+
+    CPU_FORCE_INLINE static uint64 rookAttacksFancyMagics(uint8 square, uint64 occ)
+    {
+        uint64 magic  = rook_magics_fancy[square].factor;
+        uint64 index = (magic * occ) >> (64 - ROOK_MAGIC_BITS);
+        const uint64 *table = &fancy_magic_lookup_table[rook_magics_fancy[square].position];
+        return table[index];
+    }
+
+    CPU_FORCE_INLINE static uint64 bishopAttacksByteFancyMagics(uint8 square, uint64 occ)
+    {
+        uint64 magic  = bishop_magics_fancy[square].factor;
+        uint64 index = (magic * occ) >> (64 - BISHOP_MAGIC_BITS);
+        const uint8 *table = &fancy_byte_magic_lookup_table[bishop_magics_fancy[square].position];
+        int index2 = table[index] + bishop_magics_fancy[square].offset;
+        return fancy_byte_BishopLookup[index2];
+    }
+
+    CPU_FORCE_INLINE static uint64 rookAttacksByteFancyMagics(uint8 square, uint64 occ)
+    {
+        uint64 magic  = rook_magics_fancy[square].factor;
+        uint64 index = (magic * occ) >> (64 - ROOK_MAGIC_BITS);
+        const uint8 *table = &fancy_byte_magic_lookup_table[rook_magics_fancy[square].position];
+        int index2 = table[index] + rook_magics_fancy[square].offset;
+        return fancy_byte_RookLookup[index2];
+    }
+
+#if USE_PEXT_SLIDING == 1
+    CPU_FORCE_INLINE static uint64 bishopAttacksPext(uint8 square, uint64 occ)
+    {
+        uint64 index = pext(occ, BishopAttacksMasked[square]);
+        return pdep(bishopPextAttackTables[square][index], BishopAttacks[square]);
+    }
+
+    CPU_FORCE_INLINE static uint64 rookAttacksPext(uint8 square, uint64 occ)
+    {
+        uint64 index = pext(occ, RookAttacksMasked[square]);
+        return pdep(rookPextAttackTables[square][index], RookAttacks[square]);
+    }
+#endif
+#endif // #ifndef __CUDA_ARCH__
+
     CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 bishopAttacks(uint64 bishop, uint64 pro)
     {
         uint8 square = bitScan(bishop);
         uint64 occ = (~pro) & sqBishopAttacksMasked(square);
 
-#if USE_FANCY_MAGICS == 1
 #ifdef __CUDA_ARCH__
+#if USE_FANCY_MAGICS == 1
         FancyMagicEntry magicEntry = sq_bishop_magics_fancy(square);
         int index = (magicEntry.factor * occ) >> (64 - BISHOP_MAGIC_BITS);
 
@@ -745,25 +1210,44 @@ public:
 #else // USE_BYTE_LOOKUP_FANCY == 1
         return sq_fancy_magic_lookup_table(magicEntry.position + index);
 #endif // USE_BYTE_LOOKUP_FANCY == 1
-
-#else // #ifdef __CUDA_ARCH__
-        // this version is slightly faster for CPUs.. why ?
-        uint64 magic  = bishop_magics_fancy[square].factor;
-        uint64 index = (magic * occ) >> (64 - BISHOP_MAGIC_BITS);
-#if USE_BYTE_LOOKUP_FANCY == 1
-        uint8 *table = &fancy_byte_magic_lookup_table[bishop_magics_fancy[square].position];
-        int index2 = table[index] + bishop_magics_fancy[square].offset;
-        return fancy_byte_BishopLookup[index2];
-#else // USE_BYTE_LOOKUP_FANCY == 1
-        uint64 *table = &fancy_magic_lookup_table[bishop_magics_fancy[square].position];
-        return table[index];
-#endif // USE_BYTE_LOOKUP_FANCY == 1
-#endif // #ifdef __CUDA_ARCH__
 #else // USE_FANCY_MAGICS == 1
         uint64 magic = sqBishopMagics(square);
         uint64 index = (magic * occ) >> (64 - BISHOP_MAGIC_BITS);
         return sqBishopMagicAttackTables(square, index);
 #endif // USE_FANCY_MAGICS == 1
+
+#elif RUNTIME_SLIDING_BACKEND == 1
+        switch (slidingBackend)
+        {
+            case SLIDING_KOGGE_STONE:
+                return bishopAttacksKoggeStone(bishop, pro);
+            case SLIDING_PLAIN_MAGICS:
+                return bishopAttacksPlainMagics(square, occ);
+            case SLIDING_BYTE_FANCY_MAGICS:
+                return bishopAttacksByteFancyMagics(square, occ);
+#if USE_PEXT_SLIDING == 1
+            case SLIDING_PEXT:
+                return bishopAttacksPext(square, occ);
+#endif
+            default:
+                return bishopAttacksFancyMagics(square, occ);
+        }
+
+#else // #ifdef __CUDA_ARCH__
+#if USE_PEXT_SLIDING == 1
+        if (slidingBackend == SLIDING_PEXT)
+            return bishopAttacksPext(square, occ);
+#endif
+#if USE_FANCY_MAGICS == 1
+#if USE_BYTE_LOOKUP_FANCY == 1
+        return bishopAttacksByteFancyMagics(square, occ);
+#else
+        return bishopAttacksFancyMagics(square, occ);
+#endif
+#else
+        return bishopAttacksPlainMagics(square, occ);
+#endif
+#endif // #ifdef __CUDA_ARCH__
     }
 
     CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 rookAttacks(uint64 rook, uint64 pro)
@@ -771,8 +1255,8 @@ public:
         uint8 square = bitScan(rook);
         uint64 occ = (~pro) & sqRookAttacksMasked(square);
 
-#if USE_FANCY_MAGICS == 1
 #ifdef __CUDA_ARCH__
+#if USE_FANCY_MAGICS == 1
         FancyMagicEntry magicEntry = sq_rook_magics_fancy(square);
         int index = (magicEntry.factor * occ) >> (64 - ROOK_MAGIC_BITS);
 #if USE_BYTE_LOOKUP_FANCY == 1
@@ -781,29 +1265,53 @@ public:
 #else
         return sq_fancy_magic_lookup_table(magicEntry.position + index);
 #endif
-
 #else
-        // this version is slightly faster for CPUs.. why ?
-        uint64 magic  = rook_magics_fancy[square].factor;
+        uint64 magic = sqRookMagics(square);
         uint64 index = (magic * occ) >> (64 - ROOK_MAGIC_BITS);
+        return sqRookMagicAttackTables(square, index);
+#endif
+
+#elif RUNTIME_SLIDING_BACKEND == 1
+        switch (slidingBackend)
+        {
+            case SLIDING_KOGGE_STONE:
+                return rookAttacksKoggeStone(rook, pro);
+            case SLIDING_PLAIN_MAGICS:
+                return rookAttacksPlainMagics(square, occ);
+            case SLIDING_BYTE_FANCY_MAGICS:
+                return rookAttacksByteFancyMagics(square, occ);
+#if USE_PEXT_SLIDING == 1
+            case SLIDING_PEXT:
+                return rookAttacksPext(square, occ);
+#endif
+            default:
+                return rookAttacksFancyMagics(square, occ);
+        }
+
+#else // #ifdef __CUDA_ARCH__
+#if USE_PEXT_SLIDING == 1
+        if (slidingBackend == SLIDING_PEXT)
+            return rookAttacksPext(square, occ);
+#endif
+#if USE_FANCY_MAGICS == 1
 #if USE_BYTE_LOOKUP_FANCY == 1
-        uint8 *table = &fancy_byte_magic_lookup_table[rook_magics_fancy[square].position];
-        int index2 = table[index] + rook_magics_fancy[square].offset;
-        return fancy_byte_RookLookup[index2];
+        return rookAttacksByteFancyMagics(square, occ);
 #else
-        uint64 *table = &fancy_magic_lookup_table[rook_magics_fancy[square].position];
-        return table[index];
-#endif
+        return rookAttacksFancyMagics(square, occ);
 #endif
 #else
-        uint64 magic = sqRookMagics(square);
-        uint64 index = (magic * occ) >> (64 - ROOK_MAGIC_BITS);
-        return sqRookMagicAttackTables(square, index);
+        return rookAttacksPlainMagics(square, occ);
 #endif
+#endif // #ifdef __CUDA_ARCH__
     }
 
     CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiBishopAttacks(uint64 bishops, uint64 pro)
     {
+#if RUNTIME_SLIDING_BACKEND == 1 && !defined(__CUDA_ARCH__)
+        // kogge stone handles multiple attackers automatically
+        if (slidingBackend == SLIDING_KOGGE_STONE)
+            return bishopAttacksKoggeStone(bishops, pro);
+#endif
         uint64 attacks = 0;
         while(bishops)
         {
@@ -817,6 +1325,10 @@ public:
 
     CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiRookAttacks(uint64 rooks, uint64 pro)
     {
+#if RUNTIME_SLIDING_BACKEND == 1 && !defined(__CUDA_ARCH__)
+        if (slidingBackend == SLIDING_KOGGE_STONE)
+            return rookAttacksKoggeStone(rooks, pro);
+#endif
         uint64 attacks = 0;
         while(rooks)
         {
@@ -979,105 +1491,153 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
 #endif
     }
 
-    static void init()
+#if RUNTIME_SLIDING_BACKEND == 1
+    // pick the sliding attack lookup used by CPU code (call after init())
+    // forced: name of the lookup to use (see slidingBackendNames), or NULL/"auto" to time all of them
+    // on a fixed set of positions and pick the fastest
+    static void selectSlidingBackend(const char *forced)
     {
-        // initialize zobrist keys
-        memcpy(&zob, &randoms[1200], sizeof(zob));
-        memcpy(&zob2, &randoms[333], sizeof(zob2));
-
-        // initialize the empty board attack tables
-        for (uint8 i=0; i < 64; i++)
-        {
-            uint64 x = BIT(i);
-            uint64 north = northAttacks(x, ALLSET);
-            uint64 south = southAttacks(x, ALLSET);
-            uint64 east  = eastAttacks (x, ALLSET);
-            uint64 west  = westAttacks (x, ALLSET);
-            uint64 ne    = northEastAttacks(x, ALLSET);
-            uint64 nw    = northWestAttacks(x, ALLSET);
-            uint64 se    = southEastAttacks(x, ALLSET);
-            uint64 sw    = southWestAttacks(x, ALLSET);
-            
-            RookAttacks  [i] = north | south | east | west;
-            BishopAttacks[i] = ne | nw | se | sw;
-            QueenAttacks [i] = RookAttacks[i] | BishopAttacks[i];
-            KnightAttacks[i] = knightAttacks(x);
-            KingAttacks[i]   = kingAttacks(x);
-
-            // TODO: initialize pawn attack table
-            // probably not really needed (as pawn attack calculation is simple enough)
-        }
+        bool available[NUM_SLIDING_BACKENDS];
+        for (int b = 0; b < NUM_SLIDING_BACKENDS; b++)
+            available[b] = true;
+#if USE_PEXT_SLIDING == 1
+        available[SLIDING_PEXT] = cpuFeatures.bmi2;
+#else
+        available[SLIDING_PEXT] = false;
+#endif
 
-        // initialize the Between and Line tables
-        for (uint8 i=0; i<64; i++)
-            for (uint8 j=0; j<64; j++)
+        if (forced && strcmp(forced, "auto") != 0)
+        {
+            for (int b = 0; b < NUM_SLIDING_BACKENDS; b++)
             {
-                if (i <= j)
+                if (strcmp(forced, slidingBackendNames[b]) == 0)
                 {
-                    Between[i][j] = squaresInBetween(i, j);
-                    Between[j][i] = Between[i][j];
+                    if (!available[b])
+                    {
+                        printf("\nsliding attack lookup %s not supported on this CPU\n", forced);
+                        exit(0);
+                    }
+                    slidingBackend = b;
+                    printf("\nSliding attacks: %s\n", slidingBackendNames[b]);
+                    return;
                 }
-                Line[i][j] = squaresInLine(i, j);
             }
+            printf("\nunknown sliding attack lookup: %s, valid values: auto", forced);
+            for (int b = 0; b < NUM_SLIDING_BACKENDS; b++)
+                printf(", %s", slidingBackendNames[b]);
+            printf("\n");
+            exit(0);
+        }
 
-        // initialize magic lookup tables
-#if USE_SLIDING_LUT == 1
-        srand (time(NULL));
-        for (int square = A1; square <= H8; square++)
+        // start position, positions 2 to 5 from cpw perft results, and all their children
+        char fens[][128] = {
+            "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+            "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+            "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
+            "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+            "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        };
+        const int numFens = sizeof(fens) / sizeof(fens[0]);
+
+        HexaBitBoardPosition *positions = (HexaBitBoardPosition *) malloc(sizeof(HexaBitBoardPosition) * numFens * (MAX_MOVES + 1));
+        int numPositions = 0;
+        for (int i = 0; i < numFens; i++)
         {
-            uint64 thisSquare = BIT(square);
-            uint64 mask    = sqRookAttacks(square) & (~thisSquare);
-
-            // mask off squares that don't matter
-            if ((thisSquare & RANK1) == 0)
-                mask &= ~RANK1;
-
-            if ((thisSquare & RANK8) == 0)
-                mask &= ~RANK8;
-
-            if ((thisSquare & FILEA) == 0)
-                mask &= ~FILEA;
-
-            if ((thisSquare & FILEH) == 0)
-                mask &= ~FILEH;
-            
-            RookAttacksMasked[square] = mask;
-
-            mask = sqBishopAttacks(square)  & (~thisSquare) & CENTRAL_SQUARES;
-            BishopAttacksMasked[square] = mask;
-#if USE_FANCY_MAGICS != 1
-            rookMagics  [square] = findRookMagicForSquare  (square, rookMagicAttackTables  [square]);
-            bishopMagics[square] = findBishopMagicForSquare(square, bishopMagicAttackTables[square]);
+            BoardPosition board;
+            Utils::readFENString(fens[i], &board);
+            Utils::board088ToHexBB(&positions[numPositions], &board);
+            HexaBitBoardPosition *parent = &positions[numPositions++];
+#if USE_TEMPLATE_CHANCE_OPT == 1
+            if (parent->chance == WHITE)
+                numPositions += generateBoards<WHITE>(parent, &positions[numPositions]);
+            else
+                numPositions += generateBoards<BLACK>(parent, &positions[numPositions]);
+#else
+            numPositions += generateBoards(parent, &positions[numPositions], parent->chance);
 #endif
         }
 
-        // initialize fancy magic lookup table
-        memset(fancy_magic_lookup_table, 0, sizeof(fancy_magic_lookup_table));
-        int globalOffsetRook = 0;
-        int globalOffsetBishop = 0;
+        // best of a few rounds (all lookups in each round) to reduce noise
+        const int numRounds = 3;
+        const int numRepeats = 200;
+        double bestTime[NUM_SLIDING_BACKENDS];
+        for (int b = 0; b < NUM_SLIDING_BACKENDS; b++)
+            bestTime[b] = 1e30;
 
-        for (int square = A1; square <= H8; square++)
+        volatile uint32 sink = 0;
+        for (int round = 0; round < numRounds; round++)
         {
-            int uniqueBishopAttacks = 0, uniqueRookAttacks=0;
-
-            uint64 rookMagic = findRookMagicForSquare  (square, &fancy_magic_lookup_table[rook_magics_fancy[square].position], rook_magics_fancy[square].factor, 
-                                                        &fancy_byte_RookLookup[globalOffsetRook], &fancy_byte_magic_lookup_table[rook_magics_fancy[square].position], &uniqueRookAttacks);
-            assert(rookMagic == rook_magics_fancy[square].factor);
-
-            uint64 bishopMagic = findBishopMagicForSquare  (square, &fancy_magic_lookup_table[bishop_magics_fancy[square].position], bishop_magics_fancy[square].factor, 
-                                                           &fancy_byte_BishopLookup[globalOffsetBishop], &fancy_byte_magic_lookup_table[bishop_magics_fancy[square].position], &uniqueBishopAttacks);
-            assert(bishopMagic == bishop_magics_fancy[square].factor);
+            for (int b = 0; b < NUM_SLIDING_BACKENDS; b++)
+            {
+                if (!available[b])
+                    continue;
 
-            rook_magics_fancy  [square].offset = globalOffsetRook;
-            globalOffsetRook += uniqueRookAttacks;
+                slidingBackend = b;
+                std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+                uint32 total = 0;
+                for (int r = 0; r < numRepeats; r++)
+                {
+                    for (int i = 0; i < numPositions; i++)
+                    {
+#if USE_TEMPLATE_CHANCE_OPT == 1
+                        if (positions[i].chance == WHITE)
+                            total += countMoves<WHITE>(&positions[i]);
+                        else
+                            total += countMoves<BLACK>(&positions[i]);
+#else
+                        total += countMoves(&positions[i], positions[i].chance);
+#endif
+                    }
+                }
+                sink += total;
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+                if (ms < bestTime[b])
+                    bestTime[b] = ms;
+            }
+        }
+        free(positions);
 
-            bishop_magics_fancy[square].offset = globalOffsetBishop;
-            globalOffsetBishop += uniqueBishopAttacks;
+        int best = SLIDING_FANCY_MAGICS;
+        printf("\nSliding attack lookup timings:");
+        for (int b = 0; b < NUM_SLIDING_BACKENDS; b++)
+        {
+            if (!available[b])
+                continue;
+            printf(" %s: %.2f ms", slidingBackendNames[b], bestTime[b]);
+            if (bestTime[b] < bestTime[best])
+                best = b;
         }
+        slidingBackend = best;
+        printf("\nSliding attacks: %s\n", slidingBackendNames[best]);
+    }
+#endif
 
-        // printf("\ntotal bishop unique attacks: %d\n", globalOffsetBishop);
-        // printf("\ntotal rook unique attacks: %d\n", globalOffsetRook);
-#endif        
+    static void init()
+    {
+        // initialize zobrist keys
+        memcpy(&zob, &randoms[1200], sizeof(zob));
+        memcpy(&zob2, &randoms[333], sizeof(zob2));
+
+        // all the other lookup tables are generated at compile time (see GlobalVars.cpp)
+
+#if USE_SLIDING_LUT == 1
+        // default lookup for CPU code is same as GPU (unless PEXT is fast)
+        // RUNTIME_SLIDING_BACKEND can change it later in selectSlidingBackend()
+#if USE_FANCY_MAGICS == 1 && USE_BYTE_LOOKUP_FANCY == 1
+        slidingBackend = SLIDING_BYTE_FANCY_MAGICS;
+#elif USE_FANCY_MAGICS == 1
+        slidingBackend = SLIDING_FANCY_MAGICS;
+#else
+        slidingBackend = SLIDING_PLAIN_MAGICS;
+#endif
+
+#if USE_PEXT_SLIDING == 1
+        if (cpuFeatures.fastPext)
+        {
+            slidingBackend = SLIDING_PEXT;
+        }
+#endif
+#endif        
 
         // copy all the lookup tables from CPU's memory to GPU memory
 #ifndef SKIP_CUDA_CODE
@@ -1121,7 +1681,7 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
         err = cudaMemcpyToSymbol(gBishopMagicAttackTables, bishopMagicAttackTables, sizeof(bishopMagicAttackTables));
         if (err != S_OK) printf("For copying bishopMagicAttackTables, Err id: %d, str: %s\n", err, cudaGetErrorString(err));  
 
-        err = cudaMemcpyToSymbol(g_fancy_magic_lookup_table, fancy_magic_lookup_table, sizeof(fancy_magic_lookup_table));
+        err = cudaMemcpyToSymbol(g_fancy_magic_lookup_table, &fancy_magic_lookup_table, sizeof(fancy_magic_lookup_table));
         if (err != S_OK) printf("For copying fancy_magic_lookup_table, Err id: %d, str: %s\n", err, cudaGetErrorString(err));  
 
         err = cudaMemcpyToSymbol(g_bishop_magics_fancy, bishop_magics_fancy, sizeof(bishop_magics_fancy));
@@ -1130,13 +1690,13 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
         err = cudaMemcpyToSymbol(g_rook_magics_fancy, rook_magics_fancy, sizeof(rook_magics_fancy));
         if (err != S_OK) printf("For copying rook_magics_fancy, Err id: %d, str: %s\n", err, cudaGetErrorString(err));  
 
-        err = cudaMemcpyToSymbol(g_fancy_byte_magic_lookup_table, fancy_byte_magic_lookup_table, sizeof(fancy_byte_magic_lookup_table));
+        err = cudaMemcpyToSymbol(g_fancy_byte_magic_lookup_table, &fancy_byte_magic_lookup_table, sizeof(fancy_byte_magic_lookup_table));
         if (err != S_OK) printf("For copying fancy_byte_magic_lookup_table, Err id: %d, str: %s\n", err, cudaGetErrorString(err));  
         
-        err = cudaMemcpyToSymbol(g_fancy_byte_BishopLookup, fancy_byte_BishopLookup, sizeof(fancy_byte_BishopLookup));
+        err = cudaMemcpyToSymbol(g_fancy_byte_BishopLookup, &fancy_byte_BishopLookup, sizeof(fancy_byte_BishopLookup));
         if (err != S_OK) printf("For copying fancy_byte_BishopLookup, Err id: %d, str: %s\n", err, cudaGetErrorString(err));  
 
-        err = cudaMemcpyToSymbol(g_fancy_byte_RookLookup, fancy_byte_RookLookup, sizeof(fancy_byte_RookLookup));
+        err = cudaMemcpyToSymbol(g_fancy_byte_RookLookup, &fancy_byte_RookLookup, sizeof(fancy_byte_RookLookup));
         if (err != S_OK) printf("For copying fancy_byte_RookLookup, Err id: %d, str: %s\n", err, cudaGetErrorString(err));  
 
 
@@ -1277,11 +1837,16 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
         attacked |= knightAttacks(enemyKnights);	
 #endif
         
+#if USE_SIMD_KOGGE_STONE == 1 && !defined(__CUDACC__)
+        // 3, 4. bishop and rook attacks together
+        attacked |= slidingAttacksKoggeStone(enemyRooks, enemyBishops, emptySquares | myKing);
+#else
         // 3. bishop attacks
 		attacked |= multiBishopAttacks(enemyBishops, emptySquares | myKing); // squares behind king are also under threat (in the sense that king can't go there)
 
         // 4. rook attacks
 		attacked |= multiRookAttacks(enemyRooks, emptySquares | myKing); // squares behind king are also under threat
+#endif
 
         // 5. King attacks
 #if 0   // USE_KING_LUT == 1
@@ -1298,6 +1863,30 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
     }
 
 
+    // enemy pieces attacking the king of the given side
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 findCheckers(HexaBitBoardPosition *pos, uint64 myKing, uint64 allPieces, uint64 enemyPieces, uint8 chance)
+    {
+        uint64 checkers = 0;
+        checkers |= ((chance == WHITE) ? (northEastOne(myKing) | northWestOne(myKing)) :
+                                         (southEastOne(myKing) | southWestOne(myKing)) ) & (pos->pawns & RANKS2TO7) & enemyPieces;
+        checkers |= knightAttacks(myKing) & pos->knights & enemyPieces;
+        checkers |= bishopAttacks(myKing, ~allPieces) & pos->bishopQueens & enemyPieces;
+        checkers |= rookAttacks(myKing, ~allPieces) & pos->rookQueens & enemyPieces;
+        return checkers;
+    }
+
+    // features of the position that need special handling in the move generator (see POS_CLASS_*)
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint8 getPositionClass(HexaBitBoardPosition *pos, uint64 myPawns, uint64 pinned, uint8 chance)
+    {
+        uint8  castleFlags = (chance == WHITE) ? pos->whiteCastle : pos->blackCastle;
+        uint64 rank7       = (chance == WHITE) ? RANK7 : RANK2;
+
+        return (pos->enPassent      ? POS_CLASS_EP        : 0) |
+               (castleFlags         ? POS_CLASS_CASTLE    : 0) |
+               (pinned              ? POS_CLASS_PINNED    : 0) |
+               ((myPawns & rank7)   ? POS_CLASS_PROMOTION : 0);
+    }
+
     // adds the given board to list and increments the move counter
     CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static void addMove(uint32 *nMoves, HexaBitBoardPosition **newPos, HexaBitBoardPosition *newBoard)
     {
@@ -1720,11 +2309,12 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
 
     // adds promotions if at promotion square
     // or normal pawn moves if not promotion
-    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static void addCompactPawnMoves(uint32 *nMoves, CMove **genMoves, uint8 from, uint64 dst, uint8 flags)
+    // canPromote: false if the pawn is known to be not on 7th rank
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static void addCompactPawnMoves(uint32 *nMoves, CMove **genMoves, uint8 from, uint64 dst, uint8 flags, bool canPromote = true)
     {
-        uint8 to = bitScan(dst); 
+        uint8 to = bitScan(dst);
         // promotion
-        if (dst & (RANK1 | RANK8))
+        if (canPromote && (dst & (RANK1 | RANK8)))
         {
             addCompactMove(nMoves, genMoves, from, to, flags | CM_FLAG_KNIGHT_PROMOTION);
             addCompactMove(nMoves, genMoves, from, to, flags | CM_FLAG_BISHOP_PROMOTION);
@@ -2463,51 +3053,30 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
     }
 
 
-    // generates moves for the given board position
-    // returns the no of moves generated
-    // genMoves contains the generated moves
+    // moves of a position not in check
+    // posClass: features of the position (see POS_CLASS_*), code for the rest is compiled out
 #if USE_TEMPLATE_CHANCE_OPT == 1
-    template <uint8 chance>
-    CUDA_CALLABLE_MEMBER static uint32 generateMoves (HexaBitBoardPosition *pos, CMove *genMoves)
-#else
-    CUDA_CALLABLE_MEMBER static uint32 generateMoves (HexaBitBoardPosition *pos, CMove *genMoves, uint8 chance)
+    template<uint8 chance, uint8 posClass>
 #endif
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint32 generateMovesNotInCheck (HexaBitBoardPosition *pos, CMove *genMoves,
+                                           uint64 allPawns, uint64 allPieces, uint64 myPieces,
+                                           uint64 enemyPieces, uint64 enemyRooks, uint64 pinned, uint64 threatened,
+                                           uint8 kingIndex
+#if USE_TEMPLATE_CHANCE_OPT != 1
+                                           , uint8 chance
+#endif
+                                           )
     {
+#if USE_TEMPLATE_CHANCE_OPT != 1
+        const uint8 posClass = POS_CLASS_ALL;
+#endif
         uint32 nMoves = 0;
 
-        uint64 allPawns     = pos->pawns & RANKS2TO7;    // get rid of game state variables
-
-        uint64 allPieces    = pos->kings |  allPawns | pos->knights | pos->bishopQueens | pos->rookQueens;
-        uint64 blackPieces  = allPieces & (~pos->whitePieces);
-        
-        uint64 myPieces     = (chance == WHITE) ? pos->whitePieces : blackPieces;
-        uint64 enemyPieces  = (chance == WHITE) ? blackPieces      : pos->whitePieces;
-
-        uint64 enemyBishops = pos->bishopQueens & enemyPieces;
-        uint64 enemyRooks   = pos->rookQueens & enemyPieces;
-
-        uint64 myKing     = pos->kings & myPieces;
-        uint8  kingIndex  = bitScan(myKing);
-
-        uint64 pinned     = findPinnedPieces(pos->kings & myPieces, myPieces, enemyBishops, enemyRooks, allPieces, kingIndex);
-
-        uint64 threatened = findAttackedSquares(~allPieces, enemyBishops, enemyRooks, allPawns & enemyPieces, 
-                                                pos->knights & enemyPieces, pos->kings & enemyPieces, 
-                                                myKing, !chance);
-
+        // lets the compiler drop the code for pinned pieces
+        if (!(posClass & POS_CLASS_PINNED))
+            pinned = 0;
 
-
-        // king is in check: call special generate function to generate only the moves that take king out of check
-        if (threatened & (pos->kings & myPieces))
-        {
-#if USE_TEMPLATE_CHANCE_OPT == 1
-            return generateMovesOutOfCheck<chance>(pos, genMoves, allPawns, allPieces, myPieces, enemyPieces, 
-                                                              pinned, threatened, kingIndex);
-#else
-            return generateMovesOutOfCheck (pos, genMoves, allPawns, allPieces, myPieces, enemyPieces, 
-                                            pinned, threatened, kingIndex, chance);
-#endif
-        }
+        const bool canPromote = (posClass & POS_CLASS_PROMOTION) != 0;
 
 
         // generate king moves
@@ -2659,7 +3228,7 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
 
         // generate en-passent moves
         uint64 enPassentTarget = 0;
-        if (pos->enPassent)
+        if ((posClass & POS_CLASS_EP) && pos->enPassent)
         {
             if (chance == BLACK)
             {
@@ -2746,7 +3315,7 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
             
             if (dst & enemyPieces) 
             {
-                addCompactPawnMoves(&nMoves, &genMoves, pawnIndex, dst, CM_FLAG_CAPTURE);
+                addCompactPawnMoves(&nMoves, &genMoves, pawnIndex, dst, CM_FLAG_CAPTURE, canPromote);
             }
 
             pinnedPawns ^= pawn;  // same as &= ~pawn (but only when we know that the first set contain the element we want to clear)
@@ -2762,64 +3331,416 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
             uint64 dst = ((chance == WHITE) ? northOne(pawn) : southOne(pawn)) & (~allPieces);
             if (dst) 
             {
-                addCompactPawnMoves(&nMoves, &genMoves, bitScan(pawn), dst, 0);
+                addCompactPawnMoves(&nMoves, &genMoves, bitScan(pawn), dst, 0, canPromote);
 
                 // double push (only possible if single push was possible)
                 dst = ((chance == WHITE) ? northOne(dst & checkingRankDoublePush): 
                                            southOne(dst & checkingRankDoublePush) ) & (~allPieces);
 
-                if (dst) addCompactPawnMoves(&nMoves, &genMoves, bitScan(pawn), dst, CM_FLAG_DOUBLE_PAWN_PUSH);
+                if (dst) addCompactPawnMoves(&nMoves, &genMoves, bitScan(pawn), dst, CM_FLAG_DOUBLE_PAWN_PUSH, false);
             }
 
             // captures
             uint64 westCapture = (chance == WHITE) ? northWestOne(pawn) : southWestOne(pawn);
             dst = westCapture & enemyPieces;
-            if (dst) addCompactPawnMoves(&nMoves, &genMoves, bitScan(pawn), dst, CM_FLAG_CAPTURE);
+            if (dst) addCompactPawnMoves(&nMoves, &genMoves, bitScan(pawn), dst, CM_FLAG_CAPTURE, canPromote);
 
             uint64 eastCapture = (chance == WHITE) ? northEastOne(pawn) : southEastOne(pawn);
             dst = eastCapture & enemyPieces;
-            if (dst) addCompactPawnMoves(&nMoves, &genMoves, bitScan(pawn), dst, CM_FLAG_CAPTURE);
+            if (dst) addCompactPawnMoves(&nMoves, &genMoves, bitScan(pawn), dst, CM_FLAG_CAPTURE, canPromote);
 
             myPawns ^= pawn;
         }
 
         // generate castling moves
-        if (chance == WHITE)
+        if (posClass & POS_CLASS_CASTLE)
         {
-            if ((pos->whiteCastle & CASTLE_FLAG_KING_SIDE) &&   // castle flag is set
-                !(F1G1 & allPieces) &&                          // squares between king and rook are empty
-                !(F1G1 & threatened))                           // and not in threat from enemy pieces
+            if (chance == WHITE)
             {
-                // white king side castle
-                addCompactMove(&nMoves, &genMoves, E1, G1, CM_FLAG_KING_CASTLE);
+                if ((pos->whiteCastle & CASTLE_FLAG_KING_SIDE) &&   // castle flag is set
+                    !(F1G1 & allPieces) &&                          // squares between king and rook are empty
+                    !(F1G1 & threatened))                           // and not in threat from enemy pieces
+                {
+                    // white king side castle
+                    addCompactMove(&nMoves, &genMoves, E1, G1, CM_FLAG_KING_CASTLE);
+                }
+                if ((pos->whiteCastle & CASTLE_FLAG_QUEEN_SIDE) &&  // castle flag is set
+                    !(B1D1 & allPieces) &&                          // squares between king and rook are empty
+                    !(C1D1 & threatened))                           // and not in threat from enemy pieces
+                {
+                    // white queen side castle
+                    addCompactMove(&nMoves, &genMoves, E1, C1, CM_FLAG_QUEEN_CASTLE);
+                }
             }
-            if ((pos->whiteCastle & CASTLE_FLAG_QUEEN_SIDE) &&  // castle flag is set
-                !(B1D1 & allPieces) &&                          // squares between king and rook are empty
-                !(C1D1 & threatened))                           // and not in threat from enemy pieces
+            else
             {
-                // white queen side castle
-                addCompactMove(&nMoves, &genMoves, E1, C1, CM_FLAG_QUEEN_CASTLE);
+                if ((pos->blackCastle & CASTLE_FLAG_KING_SIDE) &&   // castle flag is set
+                    !(F8G8 & allPieces) &&                          // squares between king and rook are empty
+                    !(F8G8 & threatened))                           // and not in threat from enemy pieces
+                {
+                    // black king side castle
+                    addCompactMove(&nMoves, &genMoves, E8, G8, CM_FLAG_KING_CASTLE);
+                }
+                if ((pos->blackCastle & CASTLE_FLAG_QUEEN_SIDE) &&  // castle flag is set
+                    !(B8D8 & allPieces) &&                          // squares between king and rook are empty
+                    !(C8D8 & threatened))                           // and not in threat from enemy pieces
+                {
+                    // black queen side castle
+                    addCompactMove(&nMoves, &genMoves, E8, C8, CM_FLAG_QUEEN_CASTLE);
+                }
             }
         }
-        else
+
+        return nMoves;
+    }
+
+    // generates moves for the given board position
+    // returns the no of moves generated
+    // genMoves contains the generated moves
+#if USE_TEMPLATE_CHANCE_OPT == 1
+    template <uint8 chance>
+    CUDA_CALLABLE_MEMBER static uint32 generateMoves (HexaBitBoardPosition *pos, CMove *genMoves)
+#else
+    CUDA_CALLABLE_MEMBER static uint32 generateMoves (HexaBitBoardPosition *pos, CMove *genMoves, uint8 chance)
+#endif
+    {
+        uint64 allPawns     = pos->pawns & RANKS2TO7;    // get rid of game state variables
+
+        uint64 allPieces    = pos->kings |  allPawns | pos->knights | pos->bishopQueens | pos->rookQueens;
+        uint64 blackPieces  = allPieces & (~pos->whitePieces);
+        
+        uint64 myPieces     = (chance == WHITE) ? pos->whitePieces : blackPieces;
+        uint64 enemyPieces  = (chance == WHITE) ? blackPieces      : pos->whitePieces;
+
+        uint64 enemyBishops = pos->bishopQueens & enemyPieces;
+        uint64 enemyRooks   = pos->rookQueens & enemyPieces;
+
+        uint64 myKing     = pos->kings & myPieces;
+        uint8  kingIndex  = bitScan(myKing);
+
+        uint64 pinned     = findPinnedPieces(pos->kings & myPieces, myPieces, enemyBishops, enemyRooks, allPieces, kingIndex);
+
+        uint64 threatened = findAttackedSquares(~allPieces, enemyBishops, enemyRooks, allPawns & enemyPieces, 
+                                                pos->knights & enemyPieces, pos->kings & enemyPieces, 
+                                                myKing, !chance);
+
+
+
+        // king is in check: call special generate function to generate only the moves that take king out of check
+        if (threatened & (pos->kings & myPieces))
         {
-            if ((pos->blackCastle & CASTLE_FLAG_KING_SIDE) &&   // castle flag is set
-                !(F8G8 & allPieces) &&                          // squares between king and rook are empty
-                !(F8G8 & threatened))                           // and not in threat from enemy pieces
+#if USE_TEMPLATE_CHANCE_OPT == 1
+            return generateMovesOutOfCheck<chance>(pos, genMoves, allPawns, allPieces, myPieces, enemyPieces, 
+                                                              pinned, threatened, kingIndex);
+#else
+            return generateMovesOutOfCheck (pos, genMoves, allPawns, allPieces, myPieces, enemyPieces, 
+                                            pinned, threatened, kingIndex, chance);
+#endif
+        }
+
+#if USE_TEMPLATE_CHANCE_OPT == 1
+#if USE_POSITION_CLASS_OPT == 1 && !defined(__CUDA_ARCH__)
+        uint8 posClass = getPositionClass(pos, allPawns & myPieces, pinned, chance);
+        POS_CLASS_DISPATCH(generateMovesNotInCheck, chance, posClass, pos, genMoves, allPawns, allPieces, myPieces, enemyPieces,
+                                                                      enemyRooks, pinned, threatened, kingIndex);
+#else
+        return generateMovesNotInCheck<chance, POS_CLASS_ALL>(pos, genMoves, allPawns, allPieces, myPieces, enemyPieces,
+                                                              enemyRooks, pinned, threatened, kingIndex);
+#endif
+#else
+        return generateMovesNotInCheck (pos, genMoves, allPawns, allPieces, myPieces, enemyPieces,
+                                        enemyRooks, pinned, threatened, kingIndex, chance);
+#endif
+    }
+
+#if USE_TEMPLATE_CHANCE_OPT == 1
+    template<uint8 chance>
+#endif
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static void generateMoveSetOutOfCheck (HexaBitBoardPosition *pos, MoveSet *moveSet,
+                                           uint64 allPawns, uint64 allPieces, uint64 myPieces,
+                                           uint64 enemyPieces, uint64 pinned, uint64 threatened, uint64 attackers,
+                                           uint8 kingIndex
+#if USE_TEMPLATE_CHANCE_OPT != 1
+                                           , uint8 chance
+#endif
+                                           )
+    {
+        // attackers - enemy pieces giving check (see findCheckers())
+
+        // A. Try king moves to get the king out of check
+#if USE_KING_LUT == 1
+        uint64 kingMoves = sqKingAttacks(kingIndex);
+#else
+        uint64 kingMoves = kingAttacks(king);
+#endif
+        kingMoves &= ~(threatened | myPieces);  // king can't move to a square under threat or a square containing piece of same side
+        moveSet->addEntry(kingIndex, kingMoves, MOVE_SET_KING);
+
+        // B. try moves to kill/block attacking pieces
+        // (multiple threats => only king moves possible)
+        if (!isSingular(attackers))
+            return;
+
+        // for pawn and knight attack, the only option is to kill the attacking piece
+        // for bishops rooks and queens, it's the line between the attacker and the king, including the attacker
+        uint64 safeSquares = attackers | sqsInBetween(kingIndex, bitScan(attackers));
+
+        // pieces that are pinned don't have any hope of saving the king
+        myPieces &= ~pinned;
+
+        // 1. pawn moves
+        uint64 myPawns = allPawns & myPieces;
+
+        // checking rank for pawn double pushes
+        uint64 checkingRankDoublePush = RANK3 << (chance * 24);           // rank 3 or rank 6
+        uint64 promotionRank = (chance == WHITE) ? RANK7 : RANK2;
+
+        // en-passent can only save the king if the piece captured is the attacker
+        uint64 enPassentTarget = moveSet->enPassentTarget;
+        uint64 enPassentCapturedPiece = (chance == WHITE) ? southOne(enPassentTarget) : northOne(enPassentTarget);
+        if (enPassentCapturedPiece != attackers)
+            enPassentTarget = 0;
+
+        while (myPawns)
+        {
+            uint64 pawn = getOne(myPawns);
+
+            // pawn push
+            uint64 dst = ((chance == WHITE) ? northOne(pawn) : southOne(pawn)) & (~allPieces);
+
+            // double push (only possible if single push was possible)
+            uint64 dst2 = ((chance == WHITE) ? northOne(dst & checkingRankDoublePush): 
+                                               southOne(dst & checkingRankDoublePush) ) & (~allPieces);
+
+            uint64 captures = ((chance == WHITE) ? (northWestOne(pawn) | northEastOne(pawn)) :
+                                                   (southWestOne(pawn) | southEastOne(pawn)) );
+
+            uint64 pawnMoves = ((dst | dst2) & safeSquares) | (captures & enemyPieces & safeSquares) | (captures & enPassentTarget);
+            moveSet->addEntry(bitScan(pawn), pawnMoves, (pawn & promotionRank) ? MOVE_SET_PROMOTION : MOVE_SET_PAWN);
+
+            myPawns ^= pawn;
+        }
+
+        // 2. knight moves
+        uint64 myKnights = (pos->knights & myPieces);
+        while (myKnights)
+        {
+            uint64 knight = getOne(myKnights);
+            uint8 knightIndex = bitScan(knight);
+#if USE_KNIGHT_LUT == 1
+            uint64 knightMoves = sqKnightAttacks(knightIndex) & safeSquares;
+#else
+            uint64 knightMoves = knightAttacks(knight) & safeSquares;
+#endif
+            moveSet->addEntry(knightIndex, knightMoves, MOVE_SET_PIECE);
+            myKnights ^= knight;
+        }
+
+        // 3. bishop, rook and queen moves (one entry per piece: queens are in both bitboards)
+        uint64 sliders = (pos->bishopQueens | pos->rookQueens) & myPieces;
+        while (sliders)
+        {
+            uint64 slider = getOne(sliders);
+            uint64 sliderMoves = 0;
+            if (slider & pos->bishopQueens)
+                sliderMoves |= bishopAttacks(slider, ~allPieces);
+            if (slider & pos->rookQueens)
+                sliderMoves |= rookAttacks(slider, ~allPieces);
+
+            moveSet->addEntry(bitScan(slider), sliderMoves & safeSquares, MOVE_SET_PIECE);
+            sliders ^= slider;
+        }
+    }
+
+
+    // generates all the legal moves of the given board position in a MoveSet
+    // (same moves as generateMoves)
+#if USE_TEMPLATE_CHANCE_OPT == 1
+    template <uint8 chance>
+    CUDA_CALLABLE_MEMBER static void generateMoveSet (HexaBitBoardPosition *pos, MoveSet *moveSet)
+#else
+    CUDA_CALLABLE_MEMBER static void generateMoveSet (HexaBitBoardPosition *pos, MoveSet *moveSet, uint8 chance)
+#endif
+    {
+        uint64 allPawns     = pos->pawns & RANKS2TO7;    // get rid of game state variables
+
+        uint64 allPieces    = pos->kings |  allPawns | pos->knights | pos->bishopQueens | pos->rookQueens;
+        uint64 blackPieces  = allPieces & (~pos->whitePieces);
+        
+        uint64 myPieces     = (chance == WHITE) ? pos->whitePieces : blackPieces;
+        uint64 enemyPieces  = (chance == WHITE) ? blackPieces      : pos->whitePieces;
+
+        uint64 enemyBishops = pos->bishopQueens & enemyPieces;
+        uint64 enemyRooks   = pos->rookQueens & enemyPieces;
+
+        uint64 myKing     = pos->kings & myPieces;
+        uint8  kingIndex  = bitScan(myKing);
+
+        uint64 pinned     = findPinnedPieces(pos->kings & myPieces, myPieces, enemyBishops, enemyRooks, allPieces, kingIndex);
+
+        uint64 threatened = findAttackedSquares(~allPieces, enemyBishops, enemyRooks, allPawns & enemyPieces, 
+                                                pos->knights & enemyPieces, pos->kings & enemyPieces, 
+                                                myKing, !chance);
+
+        uint64 enPassentTarget = 0;
+        if (pos->enPassent)
+        {
+            if (chance == BLACK)
             {
-                // black king side castle
-                addCompactMove(&nMoves, &genMoves, E8, G8, CM_FLAG_KING_CASTLE);
+                enPassentTarget = BIT(pos->enPassent - 1) << (8 * 2);
             }
-            if ((pos->blackCastle & CASTLE_FLAG_QUEEN_SIDE) &&  // castle flag is set
-                !(B8D8 & allPieces) &&                          // squares between king and rook are empty
-                !(C8D8 & threatened))                           // and not in threat from enemy pieces
+            else
             {
-                // black queen side castle
-                addCompactMove(&nMoves, &genMoves, E8, C8, CM_FLAG_QUEEN_CASTLE);
+                enPassentTarget = BIT(pos->enPassent - 1) << (8 * 5);
+            }
+        }
+
+        moveSet->nEntries        = 0;
+        moveSet->enemyPieces     = enemyPieces;
+        moveSet->enPassentTarget = enPassentTarget;
+
+        // king is in check: call special generate function to generate only the moves that take king out of check
+        if (threatened & (pos->kings & myPieces))
+        {
+            uint64 checkers = findCheckers(pos, myKing, allPieces, enemyPieces, chance);
+#if USE_TEMPLATE_CHANCE_OPT == 1
+            generateMoveSetOutOfCheck<chance>(pos, moveSet, allPawns, allPieces, myPieces, enemyPieces, 
+                                              pinned, threatened, checkers, kingIndex);
+#else
+            generateMoveSetOutOfCheck (pos, moveSet, allPawns, allPieces, myPieces, enemyPieces, 
+                                       pinned, threatened, checkers, kingIndex, chance);
+#endif
+            return;
+        }
+
+
+        // king moves (and castling)
+#if USE_KING_LUT == 1
+        uint64 kingMoves = sqKingAttacks(kingIndex);
+#else
+        uint64 kingMoves = kingAttacks(myKing);
+#endif
+        kingMoves &= ~(threatened | myPieces);  // king can't move to a square under threat or a square containing piece of same side
+
+        if (chance == WHITE)
+        {
+            if ((pos->whiteCastle & CASTLE_FLAG_KING_SIDE) && !(F1G1 & allPieces) && !(F1G1 & threatened))
+                kingMoves |= BIT(G1);
+            if ((pos->whiteCastle & CASTLE_FLAG_QUEEN_SIDE) && !(B1D1 & allPieces) && !(C1D1 & threatened))
+                kingMoves |= BIT(C1);
+        }
+        else
+        {
+            if ((pos->blackCastle & CASTLE_FLAG_KING_SIDE) && !(F8G8 & allPieces) && !(F8G8 & threatened))
+                kingMoves |= BIT(G8);
+            if ((pos->blackCastle & CASTLE_FLAG_QUEEN_SIDE) && !(B8D8 & allPieces) && !(C8D8 & threatened))
+                kingMoves |= BIT(C8);
+        }
+        moveSet->addEntry(kingIndex, kingMoves, MOVE_SET_KING);
+
+        // knight moves (only non-pinned knights can move)
+        uint64 myKnights = (pos->knights & myPieces) & ~pinned;
+        while (myKnights)
+        {
+            uint64 knight = getOne(myKnights);
+            uint8 knightIndex = bitScan(knight);
+#if USE_KNIGHT_LUT == 1
+            uint64 knightMoves = sqKnightAttacks(knightIndex) & ~myPieces;
+#else
+            uint64 knightMoves = knightAttacks(knight) & ~myPieces;
+#endif
+            moveSet->addEntry(knightIndex, knightMoves, MOVE_SET_PIECE);
+            myKnights ^= knight;
+        }
+
+        // bishop, rook and queen moves (one entry per piece: queens are in both bitboards)
+        uint64 sliders = (pos->bishopQueens | pos->rookQueens) & myPieces;
+        while (sliders)
+        {
+            uint64 slider = getOne(sliders);
+            uint8 sliderIndex = bitScan(slider);
+            uint64 sliderMoves = 0;
+            if (slider & pos->bishopQueens)
+                sliderMoves |= bishopAttacks(slider, ~allPieces);
+            if (slider & pos->rookQueens)
+                sliderMoves |= rookAttacks(slider, ~allPieces);
+            sliderMoves &= ~myPieces;
+
+            if (slider & pinned)
+                sliderMoves &= sqsInLine(sliderIndex, kingIndex);    // pined sliding pieces can move only along the line
+
+            moveSet->addEntry(sliderIndex, sliderMoves, MOVE_SET_PIECE);
+            sliders ^= slider;
+        }
+
+
+        uint64 myPawns = allPawns & myPieces;
+
+        // pawns that can capture en-passent
+        uint64 epPawns = 0;
+        if (enPassentTarget)
+        {
+            uint64 enPassentCapturedPiece = (chance == WHITE) ? southOne(enPassentTarget) : northOne(enPassentTarget);
+
+            uint64 epSources = (eastOne(enPassentCapturedPiece) | westOne(enPassentCapturedPiece)) & myPawns;
+
+            while (epSources)
+            {
+                uint64 pawn = getOne(epSources);
+                if (pawn & pinned)
+                {
+                    // the direction of the pin (mask containing all squares in the line joining the king and the current piece)
+                    uint64 line = sqsInLine(bitScan(pawn), kingIndex);
+                    
+                    if (enPassentTarget & line)
+                        epPawns |= pawn;
+                }
+                else
+                {
+                    // the captured pawn and the capturing pawn both leave the rank: check for a discovered rook attack on the king
+                    uint64 propogator = (~allPieces) | enPassentCapturedPiece | pawn;
+                    uint64 causesCheck = (eastAttacks(enemyRooks, propogator) | westAttacks(enemyRooks, propogator)) & 
+                                         (pos->kings & myPieces);
+                    if (!causesCheck)
+                        epPawns |= pawn;
+                }
+                epSources ^= pawn;
             }
         }
 
-        return nMoves;
+        // pawn moves
+
+        // checking rank for pawn double pushes
+        uint64 checkingRankDoublePush = RANK3 << (chance * 24);           // rank 3 or rank 6
+        uint64 promotionRank = (chance == WHITE) ? RANK7 : RANK2;
+
+        while (myPawns)
+        {
+            uint64 pawn = getOne(myPawns);
+            uint8 pawnIndex = bitScan(pawn);
+
+            // pawn push
+            uint64 pawnMoves = ((chance == WHITE) ? northOne(pawn) : southOne(pawn)) & (~allPieces);
+
+            // double push (only possible if single push was possible)
+            pawnMoves |= ((chance == WHITE) ? northOne(pawnMoves & checkingRankDoublePush): 
+                                              southOne(pawnMoves & checkingRankDoublePush) ) & (~allPieces);
+
+            // captures
+            pawnMoves |= ((chance == WHITE) ? (northWestOne(pawn) | northEastOne(pawn)) :
+                                              (southWestOne(pawn) | southEastOne(pawn)) ) & enemyPieces;
+
+            // pinned pawns can move only along the line joining the king and the pawn
+            if (pawn & pinned)
+                pawnMoves &= sqsInLine(pawnIndex, kingIndex);
+
+            // en-passent (pins already checked above)
+            if (pawn & epPawns)
+                pawnMoves |= enPassentTarget;
+
+            moveSet->addEntry(pawnIndex, pawnMoves, (pawn & promotionRank) ? MOVE_SET_PROMOTION : MOVE_SET_PAWN);
+            myPawns ^= pawn;
+        }
     }
 
 #if USE_TEMPLATE_CHANCE_OPT == 1
@@ -2827,7 +3748,7 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
 #endif
     CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint32 countMovesOutOfCheck (HexaBitBoardPosition *pos,
                                            uint64 allPawns, uint64 allPieces, uint64 myPieces,
-                                           uint64 enemyPieces, uint64 pinned, uint64 threatened, 
+                                           uint64 enemyPieces, uint64 pinned, uint64 threatened, uint64 attackers,
                                            uint8 kingIndex
 #if USE_TEMPLATE_CHANCE_OPT != 1
                                            , uint8 chance
@@ -2835,28 +3756,8 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
                                            )
     {
         uint32 nMoves = 0;
-        uint64 king = pos->kings & myPieces;
-
-        // figure out the no. of attackers 
-        uint64 attackers = 0;
-
-        // pawn attacks
-        uint64 enemyPawns = allPawns & enemyPieces;
-        attackers |= ((chance == WHITE) ? (northEastOne(king) | northWestOne(king)) :
-                                          (southEastOne(king) | southWestOne(king)) ) & enemyPawns;
-
-        // knight attackers
-        uint64 enemyKnights = pos->knights & enemyPieces;
-        attackers |= knightAttacks(king) & enemyKnights;
-
-        // bishop attackers
-        uint64 enemyBishops = pos->bishopQueens & enemyPieces;
-        attackers |= bishopAttacks(king, ~allPieces) & enemyBishops;
-
-        // rook attackers
-        uint64 enemyRooks = pos->rookQueens & enemyPieces;
-        attackers |= rookAttacks(king, ~allPieces) & enemyRooks;
 
+        // attackers - enemy pieces giving check (see findCheckers())
 
         // A. Try king moves to get the king out of check
 #if USE_KING_LUT == 1
@@ -3003,60 +3904,33 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
 
 
 
-    // count moves for the given board position
-    // returns the no of moves generated
+    // count moves of a position not in check
+    // posClass: features of the position (see POS_CLASS_*), code for the rest is compiled out
 #if USE_TEMPLATE_CHANCE_OPT == 1
-    template <uint8 chance>
-    CUDA_CALLABLE_MEMBER static uint32 countMoves (HexaBitBoardPosition *pos)
-#else
-    CUDA_CALLABLE_MEMBER static uint32 countMoves (HexaBitBoardPosition *pos, uint8 chance)
+    template<uint8 chance, uint8 posClass>
 #endif
-    {
-#if COUNT_NUM_COUNT_MOVES == 1        
-#ifdef __CUDA_ARCH__
-        atomicAdd(&numCountMoves, 1);
+    CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint32 countMovesNotInCheck (HexaBitBoardPosition *pos,
+                                           uint64 allPawns, uint64 allPieces, uint64 myPieces,
+                                           uint64 enemyPieces, uint64 enemyRooks, uint64 pinned, uint64 threatened,
+                                           uint8 kingIndex
+#if USE_TEMPLATE_CHANCE_OPT != 1
+                                           , uint8 chance
 #endif
+                                           )
+    {
+#if USE_TEMPLATE_CHANCE_OPT != 1
+        const uint8 posClass = POS_CLASS_ALL;
 #endif
         uint32 nMoves = 0;
-
-        uint64 allPawns     = pos->pawns & RANKS2TO7;    // get rid of game state variables
-
-        uint64 allPieces    = pos->kings |  allPawns | pos->knights | pos->bishopQueens | pos->rookQueens;
-        uint64 blackPieces  = allPieces & (~pos->whitePieces);
-        
-        uint64 myPieces     = (chance == WHITE) ? pos->whitePieces : blackPieces;
-        uint64 enemyPieces  = (chance == WHITE) ? blackPieces      : pos->whitePieces;
-
-        uint64 enemyBishops = pos->bishopQueens & enemyPieces;
-        uint64 enemyRooks   = pos->rookQueens & enemyPieces;
-
-        uint64 myKing     = pos->kings & myPieces;
-        uint8  kingIndex  = bitScan(myKing);
-
-        uint64 pinned     = findPinnedPieces(pos->kings & myPieces, myPieces, enemyBishops, enemyRooks, allPieces, kingIndex);
-
-        uint64 threatened = findAttackedSquares(~allPieces, enemyBishops, enemyRooks, allPawns & enemyPieces, 
-                                                pos->knights & enemyPieces, pos->kings & enemyPieces, 
-                                                myKing, !chance);
-
-
-        // king is in check: call special generate function to generate only the moves that take king out of check
-        if (threatened & (pos->kings & myPieces))
-        {
-#if USE_TEMPLATE_CHANCE_OPT == 1
-            return countMovesOutOfCheck<chance>(pos, allPawns, allPieces, myPieces, enemyPieces, 
-                                                              pinned, threatened, kingIndex);
-#else
-            return countMovesOutOfCheck (pos, allPawns, allPieces, myPieces, enemyPieces, 
-                                         pinned, threatened, kingIndex, chance);
-#endif
-        }
-
         uint64 myPawns = allPawns & myPieces;
 
+        // lets the compiler drop the code for pinned pieces
+        if (!(posClass & POS_CLASS_PINNED))
+            pinned = 0;
+
         // 0. generate en-passent moves first
         uint64 enPassentTarget = 0;
-        if (pos->enPassent)
+        if ((posClass & POS_CLASS_EP) && pos->enPassent)
         {
             if (chance == BLACK)
             {
@@ -3157,8 +4031,12 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
         // pawn push
         uint64 dsts = ((chance == WHITE) ? northOne(myPawns) : southOne(myPawns)) & (~allPieces);
         nMoves += popCount(dsts);
-        uint64 promotions = dsts & (RANK1 | RANK8);
-        nMoves += 3 * popCount(promotions);
+        uint64 promotions = 0;
+        if (posClass & POS_CLASS_PROMOTION)
+        {
+            promotions = dsts & (RANK1 | RANK8);
+            nMoves += 3 * popCount(promotions);
+        }
 
         // double push
         dsts = ((chance == WHITE) ? northOne(dsts & checkingRankDoublePush): 
@@ -3168,51 +4046,60 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
         // captures
         dsts = ((chance == WHITE) ? northWestOne(myPawns) : southWestOne(myPawns)) & enemyPieces;
         nMoves += popCount(dsts);
-        promotions = dsts & (RANK1 | RANK8);
-        nMoves += 3 * popCount(promotions);
+        if (posClass & POS_CLASS_PROMOTION)
+        {
+            promotions = dsts & (RANK1 | RANK8);
+            nMoves += 3 * popCount(promotions);
+        }
 
 
         dsts = ((chance == WHITE) ? northEastOne(myPawns) : southEastOne(myPawns)) & enemyPieces;
         nMoves += popCount(dsts);
-        promotions = dsts & (RANK1 | RANK8);
-        nMoves += 3 * popCount(promotions);
-
-        // generate castling moves
-        if (chance == WHITE)
+        if (posClass & POS_CLASS_PROMOTION)
         {
-            if ((pos->whiteCastle & CASTLE_FLAG_KING_SIDE) &&   // castle flag is set
-                !(F1G1 & allPieces) &&                          // squares between king and rook are empty
-                !(F1G1 & threatened))                           // and not in threat from enemy pieces
-            {
-                // white king side castle
-                nMoves++;
-            }
-            if ((pos->whiteCastle & CASTLE_FLAG_QUEEN_SIDE) &&  // castle flag is set
-                !(B1D1 & allPieces) &&                          // squares between king and rook are empty
-                !(C1D1 & threatened))                           // and not in threat from enemy pieces
-            {
-                // white queen side castle
-                nMoves++;
-            }
+            promotions = dsts & (RANK1 | RANK8);
+            nMoves += 3 * popCount(promotions);
         }
-        else
+
+        // generate castling moves
+        if (posClass & POS_CLASS_CASTLE)
         {
-            if ((pos->blackCastle & CASTLE_FLAG_KING_SIDE) &&   // castle flag is set
-                !(F8G8 & allPieces) &&                          // squares between king and rook are empty
-                !(F8G8 & threatened))                           // and not in threat from enemy pieces
+            if (chance == WHITE)
             {
-                // black king side castle
-                nMoves++;
+                if ((pos->whiteCastle & CASTLE_FLAG_KING_SIDE) &&   // castle flag is set
+                    !(F1G1 & allPieces) &&                          // squares between king and rook are empty
+                    !(F1G1 & threatened))                           // and not in threat from enemy pieces
+                {
+                    // white king side castle
+                    nMoves++;
+                }
+                if ((pos->whiteCastle & CASTLE_FLAG_QUEEN_SIDE) &&  // castle flag is set
+                    !(B1D1 & allPieces) &&                          // squares between king and rook are empty
+                    !(C1D1 & threatened))                           // and not in threat from enemy pieces
+                {
+                    // white queen side castle
+                    nMoves++;
+                }
             }
-            if ((pos->blackCastle & CASTLE_FLAG_QUEEN_SIDE) &&  // castle flag is set
-                !(B8D8 & allPieces) &&                          // squares between king and rook are empty
-                !(C8D8 & threatened))                           // and not in threat from enemy pieces
+            else
             {
-                // black queen side castle
-                nMoves++;
+                if ((pos->blackCastle & CASTLE_FLAG_KING_SIDE) &&   // castle flag is set
+                    !(F8G8 & allPieces) &&                          // squares between king and rook are empty
+                    !(F8G8 & threatened))                           // and not in threat from enemy pieces
+                {
+                    // black king side castle
+                    nMoves++;
+                }
+                if ((pos->blackCastle & CASTLE_FLAG_QUEEN_SIDE) &&  // castle flag is set
+                    !(B8D8 & allPieces) &&                          // squares between king and rook are empty
+                    !(C8D8 & threatened))                           // and not in threat from enemy pieces
+                {
+                    // black queen side castle
+                    nMoves++;
+                }
             }
         }
-        
+
         // generate king moves
 #if USE_KING_LUT == 1
         uint64 kingMoves = sqKingAttacks(kingIndex);
@@ -3294,6 +4181,69 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
         return nMoves;
     }
 
+    // count moves for the given board position
+    // returns the no of moves generated
+#if USE_TEMPLATE_CHANCE_OPT == 1
+    template <uint8 chance>
+    CUDA_CALLABLE_MEMBER static uint32 countMoves (HexaBitBoardPosition *pos)
+#else
+    CUDA_CALLABLE_MEMBER static uint32 countMoves (HexaBitBoardPosition *pos, uint8 chance)
+#endif
+    {
+#if COUNT_NUM_COUNT_MOVES == 1        
+#ifdef __CUDA_ARCH__
+        atomicAdd(&numCountMoves, 1);
+#endif
+#endif
+        uint64 allPawns     = pos->pawns & RANKS2TO7;    // get rid of game state variables
+
+        uint64 allPieces    = pos->kings |  allPawns | pos->knights | pos->bishopQueens | pos->rookQueens;
+        uint64 blackPieces  = allPieces & (~pos->whitePieces);
+        
+        uint64 myPieces     = (chance == WHITE) ? pos->whitePieces : blackPieces;
+        uint64 enemyPieces  = (chance == WHITE) ? blackPieces      : pos->whitePieces;
+
+        uint64 enemyBishops = pos->bishopQueens & enemyPieces;
+        uint64 enemyRooks   = pos->rookQueens & enemyPieces;
+
+        uint64 myKing     = pos->kings & myPieces;
+        uint8  kingIndex  = bitScan(myKing);
+
+        uint64 pinned     = findPinnedPieces(pos->kings & myPieces, myPieces, enemyBishops, enemyRooks, allPieces, kingIndex);
+
+        uint64 threatened = findAttackedSquares(~allPieces, enemyBishops, enemyRooks, allPawns & enemyPieces, 
+                                                pos->knights & enemyPieces, pos->kings & enemyPieces, 
+                                                myKing, !chance);
+
+
+        // king is in check: call special generate function to generate only the moves that take king out of check
+        if (threatened & (pos->kings & myPieces))
+        {
+            uint64 checkers = findCheckers(pos, myKing, allPieces, enemyPieces, chance);
+#if USE_TEMPLATE_CHANCE_OPT == 1
+            return countMovesOutOfCheck<chance>(pos, allPawns, allPieces, myPieces, enemyPieces, 
+                                                              pinned, threatened, checkers, kingIndex);
+#else
+            return countMovesOutOfCheck (pos, allPawns, allPieces, myPieces, enemyPieces, 
+                                         pinned, threatened, checkers, kingIndex, chance);
+#endif
+        }
+
+#if USE_TEMPLATE_CHANCE_OPT == 1
+#if USE_POSITION_CLASS_OPT == 1 && !defined(__CUDA_ARCH__)
+        uint8 posClass = getPositionClass(pos, allPawns & myPieces, pinned, chance);
+        POS_CLASS_DISPATCH(countMovesNotInCheck, chance, posClass, pos, allPawns, allPieces, myPieces, enemyPieces,
+                                                                   enemyRooks, pinned, threatened, kingIndex);
+#else
+        return countMovesNotInCheck<chance, POS_CLASS_ALL>(pos, allPawns, allPieces, myPieces, enemyPieces,
+                                                           enemyRooks, pinned, threatened, kingIndex);
+#endif
+#else
+        return countMovesNotInCheck (pos, allPawns, allPieces, myPieces, enemyPieces,
+                                     enemyRooks, pinned, threatened, kingIndex, chance);
+#endif
+    }
+
     #ifdef __CUDA_ARCH__
         #define ZOB_KEY1(x) (__ldg(&gZob.x))    
         #define ZOB_KEY2(x) (__ldg(&gZob2.x))
@@ -3978,6 +4928,143 @@ CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE static uint64 multiKnightAttacks(uint64 kn
 
         return key;
     }
+
+#if CANONICAL_TT_KEYS == 1
+    // zobrist keys (128 bit) of all the positions with the same perft as the given one (see SymmetricKeys128b):
+    //  - key[0]: the position itself
+    //  - key[1]: colors flipped and board mirrored vertically (side to move, castling rights flipped too)
+    // and when no side has castling rights:
+    //  - key[2]: board mirrored horizontally
+    //  - key[3]: both of the above
+
+    // adds (or removes) the part of the keys from the side to move, castling rights and en-passent target
+    static CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE void symmetricStateKeys128b(HexaBitBoardPosition *pos, SymmetricKeys128b *keys)
+    {
+        HashKey128b *key = keys->key;
+
+        if (pos->chance == WHITE)
+        {
+            key[0] ^= ZOB_KEY_128(chance);
+            key[2] ^= ZOB_KEY_128(chance);
+        }
+        else
+        {
+            key[1] ^= ZOB_KEY_128(chance);
+            key[3] ^= ZOB_KEY_128(chance);
+        }
+
+        if (pos->whiteCastle & CASTLE_FLAG_KING_SIDE)
+        {
+            key[0] ^= ZOB_KEY_128(castlingRights[WHITE][0]);
+            key[1] ^= ZOB_KEY_128(castlingRights[BLACK][0]);
+        }
+        if (pos->whiteCastle & CASTLE_FLAG_QUEEN_SIDE)
+        {
+            key[0] ^= ZOB_KEY_128(castlingRights[WHITE][1]);
+            key[1] ^= ZOB_KEY_128(castlingRights[BLACK][1]);
+        }
+        if (pos->blackCastle & CASTLE_FLAG_KING_SIDE)
+        {
+            key[0] ^= ZOB_KEY_128(castlingRights[BLACK][0]);
+            key[1] ^= ZOB_KEY_128(castlingRights[WHITE][0]);
+        }
+        if (pos->blackCastle & CASTLE_FLAG_QUEEN_SIDE)
+        {
+            key[0] ^= ZOB_KEY_128(castlingRights[BLACK][1]);
+            key[1] ^= ZOB_KEY_128(castlingRights[WHITE][1]);
+        }
+
+        // the file of en-passent target is same in the vertical mirror
+        if (pos->enPassent)
+        {
+            key[0] ^= ZOB_KEY_128(enPassentTarget[pos->enPassent - 1]);
+            key[1] ^= ZOB_KEY_128(enPassentTarget[pos->enPassent - 1]);
+            key[2] ^= ZOB_KEY_128(enPassentTarget[8 - pos->enPassent]);
+            key[3] ^= ZOB_KEY_128(enPassentTarget[8 - pos->enPassent]);
+        }
+    }
+
+    // adds (or removes) the part of the keys from the piece on the given square (nothing if it's empty)
+    static CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE void symmetricPieceKeys128b(HexaBitBoardPosition *pos, uint64 piece, SymmetricKeys128b *keys)
+    {
+        int type;
+        if (piece & pos->pawns & RANKS2TO7)
+            type = ZOB_INDEX_PAWN;
+        else if (piece & pos->kings)
+            type = ZOB_INDEX_KING;
+        else if (piece & pos->knights)
+            type = ZOB_INDEX_KNIGHT;
+        else if (piece & pos->rookQueens & pos->bishopQueens)
+            type = ZOB_INDEX_QUEEN;
+        else if (piece & pos->rookQueens)
+            type = ZOB_INDEX_ROOK;
+        else if (piece & pos->bishopQueens)
+            type = ZOB_INDEX_BISHOP;
+        else
+            return;
+
+        int square = bitScan(piece);
+        int color = !(piece & pos->whitePieces);
+
+        // square ^ 56 flips the rank, square ^ 7 flips the file
+        keys->key[0] ^= ZOB_KEY_128(pieces[color][type][square]);
+        keys->key[1] ^= ZOB_KEY_128(pieces[!color][type][square ^ 56]);
+        keys->key[2] ^= ZOB_KEY_128(pieces[color][type][square ^ 7]);
+        keys->key[3] ^= ZOB_KEY_128(pieces[!color][type][square ^ 63]);
+    }
+
+    // all the keys from scratch, in a single pass over the board
+    static CUDA_CALLABLE_MEMBER void computeSymmetricZobristKeys128b(HexaBitBoardPosition *pos, SymmetricKeys128b *keys)
+    {
+        *keys = SymmetricKeys128b();
+        symmetricStateKeys128b(pos, keys);
+
+        uint64 allPawns = pos->pawns & RANKS2TO7;
+        uint64 allPieces = pos->kings | allPawns | pos->knights | pos->bishopQueens | pos->rookQueens;
+        while (allPieces)
+        {
+            uint64 piece = MoveGeneratorBitboard::getOne(allPieces);
+            symmetricPieceKeys128b(pos, piece, keys);
+            allPieces ^= piece;
+        }
+    }
+
+    // keys of the position after a move (child) from the ones of the position before it (parent)
+    // only the squares the move changed (at most four - castling) and the game state are looked at
+    static CUDA_CALLABLE_MEMBER CPU_FORCE_INLINE void updateSymmetricZobristKeys128b(HexaBitBoardPosition *parent, HexaBitBoardPosition *child,
+                                                                                  SymmetricKeys128b *keys)
+    {
+        symmetricStateKeys128b(parent, keys);
+        symmetricStateKeys128b(child, keys);
+
+        uint64 changed = ((parent->pawns ^ child->pawns) & RANKS2TO7) | (parent->knights ^ child->knights) |
+                         (parent->bishopQueens ^ child->bishopQueens) | (parent->rookQueens ^ child->rookQueens) |
+                         (parent->kings ^ child->kings) | (parent->whitePieces ^ child->whitePieces);
+        while (changed)
+        {
+            uint64 square = MoveGeneratorBitboard::getOne(changed);
+            symmetricPieceKeys128b(parent, square, keys);
+            symmetricPieceKeys128b(child, square, keys);
+            changed ^= square;
+        }
+    }
+
+    // the smallest of the keys, so that all the symmetric positions are looked up (and stored) with the same key
+    static CUDA_CALLABLE_MEMBER HashKey128b canonicalZobristKey128b(HexaBitBoardPosition *pos, const SymmetricKeys128b *keys)
+    {
+        int nKeys = (pos->whiteCastle | pos->blackCastle) ? 2 : 4;
+        HashKey128b minKey = keys->key[0];
+        for (int i = 1; i < nKeys; i++)
+        {
+            HashKey128b key = keys->key[i];
+            if (key.highPart < minKey.highPart ||
+                (key.highPart == minKey.highPart && key.lowPart < minKey.lowPart))
+                minKey = key;
+        }
+
+        return minKey;
+    }
+#endif
 };
 
 
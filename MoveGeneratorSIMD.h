@@ -0,0 +1,200 @@
+// multi-position countMoves using SIMD instructions (CPU only)
+// 4 positions per call with AVX2, 8 positions per call with AVX-512
+// used for the last level of CPU perft (see perft_bb() and makeMove_and_perft_single_level_indices())
+
+// everything is computed set-wise (kogge-stone fills in each direction) without any per-piece loops:
+// the attack sets in a single direction of different pieces never overlap, so summing the popcounts
+// of all directions gives the exact move count.
+// positions with the king in check, or with en-passent possible are rare - they fall back to the regular countMoves()
+
+#include <immintrin.h>
+
+#ifdef __GNUC__
+#define SIMD_INLINE inline __attribute__((always_inline))
+#else
+#define SIMD_INLINE __forceinline
+#endif
+
+// positions in structure of arrays form
+// boards with black to move are flipped vertically - so that side to move is always white
+struct alignas(64) SimdBoards
+{
+    uint64 pawns[8];            // without the game state bits
+    uint64 knights[8];
+    uint64 bishopQueens[8];
+    uint64 rookQueens[8];
+    uint64 kings[8];
+    uint64 myPieces[8];
+    uint64 castleKing[8];       // 1 if side to move can castle king side
+    uint64 castleQueen[8];      // 1 if side to move can castle queen side
+};
+
+#ifdef __GNUC__
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+namespace SimdAvx2
+{
+    typedef __m256i V;
+    const int width = 4;
+
+    static SIMD_INLINE V load(const uint64 *p)          { return _mm256_load_si256((const __m256i *) p); }
+    static SIMD_INLINE void store(uint64 *p, V x)       { _mm256_storeu_si256((__m256i *) p, x); }
+    static SIMD_INLINE V set1(uint64 x)                 { return _mm256_set1_epi64x((long long) x); }
+    static SIMD_INLINE V zero()                         { return _mm256_setzero_si256(); }
+    static SIMD_INLINE V and_(V a, V b)                 { return _mm256_and_si256(a, b); }
+    static SIMD_INLINE V or_(V a, V b)                  { return _mm256_or_si256(a, b); }
+    static SIMD_INLINE V andnot(V a, V b)               { return _mm256_andnot_si256(a, b); }
+    static SIMD_INLINE V xor_(V a, V b)                 { return _mm256_xor_si256(a, b); }
+    static SIMD_INLINE V add(V a, V b)                  { return _mm256_add_epi64(a, b); }
+    template<int n> static SIMD_INLINE V shl(V x)       { return _mm256_slli_epi64(x, n); }
+    template<int n> static SIMD_INLINE V shr(V x)       { return _mm256_srli_epi64(x, n); }
+
+    static SIMD_INLINE V keepIfNonZero(V cond, V val)   { return _mm256_andnot_si256(_mm256_cmpeq_epi64(cond, zero()), val); }
+    static SIMD_INLINE V keepIfZero(V cond, V val)      { return _mm256_and_si256(_mm256_cmpeq_epi64(cond, zero()), val); }
+
+    // no popcount instruction for vectors in AVX2: nibble lookup using pshufb
+    static SIMD_INLINE V popcnt(V x)
+    {
+        const V lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const V lowNibbles = _mm256_set1_epi8(0x0f);
+        V lo  = _mm256_and_si256(x, lowNibbles);
+        V hi  = _mm256_and_si256(_mm256_srli_epi16(x, 4), lowNibbles);
+        V cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+        return _mm256_sad_epu8(cnt, zero());
+    }
+
+    #include "MoveGeneratorSIMDCore.h"
+}
+#ifdef __GNUC__
+#pragma GCC pop_options
+#endif
+
+#ifdef __GNUC__
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vpopcntdq")
+#endif
+namespace SimdAvx512
+{
+    typedef __m512i V;
+    const int width = 8;
+
+    static SIMD_INLINE V load(const uint64 *p)          { return _mm512_load_si512((const void *) p); }
+    static SIMD_INLINE void store(uint64 *p, V x)       { _mm512_storeu_si512((void *) p, x); }
+    static SIMD_INLINE V set1(uint64 x)                 { return _mm512_set1_epi64((long long) x); }
+    static SIMD_INLINE V zero()                         { return _mm512_setzero_si512(); }
+    static SIMD_INLINE V and_(V a, V b)                 { return _mm512_and_si512(a, b); }
+    static SIMD_INLINE V or_(V a, V b)                  { return _mm512_or_si512(a, b); }
+    static SIMD_INLINE V andnot(V a, V b)               { return _mm512_andnot_si512(a, b); }
+    static SIMD_INLINE V xor_(V a, V b)                 { return _mm512_xor_si512(a, b); }
+    static SIMD_INLINE V add(V a, V b)                  { return _mm512_add_epi64(a, b); }
+    template<int n> static SIMD_INLINE V shl(V x)       { return _mm512_slli_epi64(x, n); }
+    template<int n> static SIMD_INLINE V shr(V x)       { return _mm512_srli_epi64(x, n); }
+    static SIMD_INLINE V popcnt(V x)                    { return _mm512_popcnt_epi64(x); }
+
+    static SIMD_INLINE V keepIfNonZero(V cond, V val)   { return _mm512_maskz_mov_epi64(_mm512_test_epi64_mask(cond, cond), val); }
+    static SIMD_INLINE V keepIfZero(V cond, V val)      { return _mm512_maskz_mov_epi64(_mm512_testn_epi64_mask(cond, cond), val); }
+
+    #include "MoveGeneratorSIMDCore.h"
+}
+#ifdef __GNUC__
+#pragma GCC pop_options
+#endif
+
+// no. of positions handled in one go by the best instruction set supported by the CPU (0 if none)
+static int simdCountMovesWidth = cpuFeatures.avx512Popcnt ? SimdAvx512::width :
+                                 cpuFeatures.avx2         ? SimdAvx2::width : 0;
+
+static CPU_FORCE_INLINE void setSimdBoard(SimdBoards *boards, int lane, HexaBitBoardPosition *pos)
+{
+    uint64 pawns     = pos->pawns & RANKS2TO7;
+    uint64 allPieces = pos->kings | pawns | pos->knights | pos->bishopQueens | pos->rookQueens;
+
+    if (pos->chance == WHITE)
+    {
+        boards->pawns[lane]        = pawns;
+        boards->knights[lane]      = pos->knights;
+        boards->bishopQueens[lane] = pos->bishopQueens;
+        boards->rookQueens[lane]   = pos->rookQueens;
+        boards->kings[lane]        = pos->kings;
+        boards->myPieces[lane]     = pos->whitePieces;
+        boards->castleKing[lane]   = pos->whiteCastle & CASTLE_FLAG_KING_SIDE;
+        boards->castleQueen[lane]  = (pos->whiteCastle & CASTLE_FLAG_QUEEN_SIDE) ? 1 : 0;
+    }
+    else
+    {
+        boards->pawns[lane]        = flipVertical(pawns);
+        boards->knights[lane]      = flipVertical(pos->knights);
+        boards->bishopQueens[lane] = flipVertical(pos->bishopQueens);
+        boards->rookQueens[lane]   = flipVertical(pos->rookQueens);
+        boards->kings[lane]        = flipVertical(pos->kings);
+        boards->myPieces[lane]     = flipVertical(allPieces & ~pos->whitePieces);
+        boards->castleKing[lane]   = pos->blackCastle & CASTLE_FLAG_KING_SIDE;
+        boards->castleQueen[lane]  = (pos->blackCastle & CASTLE_FLAG_QUEEN_SIDE) ? 1 : 0;
+    }
+}
+
+// count moves of the positions filled in boards (only the first numLanes are valid)
+static CPU_FORCE_INLINE void countSimdBoards(SimdBoards *boards, HexaBitBoardPosition **lanePositions, uint32 **laneCounts, int numLanes)
+{
+    uint64 counts[8], inCheck[8];
+    if (simdCountMovesWidth == SimdAvx512::width)
+        SimdAvx512::countMovesLanes(boards, counts, inCheck);
+    else
+        SimdAvx2::countMovesLanes(boards, counts, inCheck);
+
+    for (int i = 0; i < numLanes; i++)
+        *laneCounts[i] = inCheck[i] ? countMoves(lanePositions[i]) : (uint32) counts[i];
+}
+
+// no. of moves of every given position (in counts[])
+void countMovesSimd(HexaBitBoardPosition *positions, uint32 *counts, uint32 n)
+{
+    int width = simdCountMovesWidth;
+    if (width == 0)
+    {
+        for (uint32 i = 0; i < n; i++)
+            counts[i] = countMoves(&positions[i]);
+        return;
+    }
+
+    // unused lanes still get processed (results ignored), so keep them initialized
+    SimdBoards boards = {};
+    HexaBitBoardPosition *lanePositions[8];
+    uint32 *laneCounts[8];
+    int numLanes = 0;
+
+    for (uint32 i = 0; i < n; i++)
+    {
+        if (positions[i].enPassent)
+        {
+            counts[i] = countMoves(&positions[i]);
+            continue;
+        }
+
+        setSimdBoard(&boards, numLanes, &positions[i]);
+        lanePositions[numLanes] = &positions[i];
+        laneCounts[numLanes++] = &counts[i];
+        if (numLanes == width)
+        {
+            countSimdBoards(&boards, lanePositions, laneCounts, numLanes);
+            numLanes = 0;
+        }
+    }
+
+    if (numLanes)
+        countSimdBoards(&boards, lanePositions, laneCounts, numLanes);
+}
+
+// total no. of moves of all the given positions (at most MAX_MOVES)
+uint64 countMovesSimd(HexaBitBoardPosition *positions, uint32 n)
+{
+    uint32 counts[MAX_MOVES];
+    countMovesSimd(positions, counts, n);
+
+    uint64 total = 0;
+    for (uint32 i = 0; i < n; i++)
+        total += counts[i];
+    return total;
+}
@@ -0,0 +1,201 @@
+// lane parallel countMoves - included (once per instruction set) from MoveGeneratorSIMD.h
+// inside a namespace that provides:
+//  V (vector of 64 bit lanes), width (no. of lanes), SIMD_INLINE and the basic operations on V:
+//  load, store, set1, zero, and_, or_, andnot (~a & b), xor_, shl<n>, shr<n>, add, popcnt,
+//  keepIfNonZero(cond, val) / keepIfZero(cond, val) - per lane val if cond is non-zero / zero, otherwise 0
+
+// shift by one step in the given direction (mask gets rid of wrapped around bits)
+template<int s, uint64 mask>
+static SIMD_INLINE V shiftOne(V x)
+{
+    return and_(s > 0 ? shl<(s > 0 ? s : 0)>(x) : shr<(s < 0 ? -s : 0)>(x), set1(mask));
+}
+
+// kogge-stone occluded fill in the given direction
+// returns the attacked squares (including the first blocker)
+template<int s, uint64 mask>
+static SIMD_INLINE V slideAttacks(V gen, V pro)
+{
+    pro = and_(pro, set1(mask));
+    gen = or_(gen, and_(pro, shiftOne<s, ALLSET>(gen)));
+    pro = and_(pro, shiftOne<s, ALLSET>(pro));
+    gen = or_(gen, and_(pro, shiftOne<2 * s, ALLSET>(gen)));
+    pro = and_(pro, shiftOne<2 * s, ALLSET>(pro));
+    gen = or_(gen, and_(pro, shiftOne<4 * s, ALLSET>(gen)));
+    return shiftOne<s, mask>(gen);
+}
+
+// directions (white to move): shift and mask
+#define SIMD_N     8, ALLSET
+#define SIMD_S    -8, ALLSET
+#define SIMD_E     1, ~FILEA
+#define SIMD_W    -1, ~FILEH
+#define SIMD_NE    9, ~FILEA
+#define SIMD_NW    7, ~FILEH
+#define SIMD_SE   -7, ~FILEA
+#define SIMD_SW   -9, ~FILEH
+
+static SIMD_INLINE V knightAttacksSet(V knights)
+{
+    return or_(or_(or_(shiftOne< 17, ~FILEA>(knights),            shiftOne< 15, ~FILEH>(knights)),
+                   or_(shiftOne< 10, ~(FILEA | FILEB)>(knights),  shiftOne<  6, ~(FILEG | FILEH)>(knights))),
+               or_(or_(shiftOne< -6, ~(FILEA | FILEB)>(knights),  shiftOne<-10, ~(FILEG | FILEH)>(knights)),
+                   or_(shiftOne<-15, ~FILEA>(knights),            shiftOne<-17, ~FILEH>(knights))));
+}
+
+static SIMD_INLINE V kingAttacksSet(V king)
+{
+    return or_(or_(or_(shiftOne<SIMD_N>(king),  shiftOne<SIMD_S>(king)),
+                   or_(shiftOne<SIMD_E>(king),  shiftOne<SIMD_W>(king))),
+               or_(or_(shiftOne<SIMD_NE>(king), shiftOne<SIMD_NW>(king)),
+                   or_(shiftOne<SIMD_SE>(king), shiftOne<SIMD_SW>(king))));
+}
+
+// count of moves (per source piece) of all the given knights, in each of the 8 directions
+// (shifts are one-to-one, so no two knights can end up on the same square for a given direction)
+static SIMD_INLINE V countKnightMoves(V knights, V targets)
+{
+    V cnt = popcnt(and_(shiftOne< 17, ~FILEA>(knights), targets));
+    cnt = add(cnt, popcnt(and_(shiftOne< 15, ~FILEH>(knights), targets)));
+    cnt = add(cnt, popcnt(and_(shiftOne< 10, ~(FILEA | FILEB)>(knights), targets)));
+    cnt = add(cnt, popcnt(and_(shiftOne<  6, ~(FILEG | FILEH)>(knights), targets)));
+    cnt = add(cnt, popcnt(and_(shiftOne< -6, ~(FILEA | FILEB)>(knights), targets)));
+    cnt = add(cnt, popcnt(and_(shiftOne<-10, ~(FILEG | FILEH)>(knights), targets)));
+    cnt = add(cnt, popcnt(and_(shiftOne<-15, ~FILEA>(knights), targets)));
+    cnt = add(cnt, popcnt(and_(shiftOne<-17, ~FILEH>(knights), targets)));
+    return cnt;
+}
+
+// find the piece (if any) pinned to the king along the given direction
+// also counts moves of the pinned piece if it's a slider that can move along the pin line
+// pinner - the enemy piece pinning it (0 if nothing is pinned)
+template<int s, uint64 mask>
+static SIMD_INLINE V findPinned(V myKing, V empty, V myPieces, V mySliders, V enemySliders, V &pinner, V &cnt)
+{
+    V ray     = slideAttacks<s, mask>(myKing, empty);
+    V blocker = and_(ray, myPieces);
+    V xray    = slideAttacks<s, mask>(blocker, empty);
+
+    pinner = and_(xray, enemySliders);
+    V pinned = keepIfNonZero(pinner, blocker);
+
+    // squares between the king and the piece, and from the piece up to (and including) the pinner
+    V moves = keepIfNonZero(and_(pinned, mySliders), or_(andnot(blocker, ray), xray));
+    cnt = add(cnt, popcnt(moves));
+
+    return pinned;
+}
+
+// count moves of 'width' positions at once
+// all positions have white to move (see SimdBoards), and none of them has en-passent target
+// inCheck is set (to 1) for positions where the king is in check. counts for these aren't valid.
+static void countMovesLanes(const SimdBoards *boards, uint64 *counts, uint64 *inCheck)
+{
+    V pawns        = load(boards->pawns);
+    V knights      = load(boards->knights);
+    V bishopQueens = load(boards->bishopQueens);
+    V rookQueens   = load(boards->rookQueens);
+    V kings        = load(boards->kings);
+    V myPieces     = load(boards->myPieces);
+
+    V allPieces    = or_(or_(or_(pawns, knights), or_(bishopQueens, rookQueens)), kings);
+    V enemyPieces  = andnot(myPieces, allPieces);
+    V empty        = xor_(allPieces, set1(ALLSET));
+    V notMine      = xor_(myPieces, set1(ALLSET));
+
+    V myKing       = and_(kings, myPieces);
+    V enemyBishops = and_(bishopQueens, enemyPieces);
+    V enemyRooks   = and_(rookQueens, enemyPieces);
+    V myBishops    = and_(bishopQueens, myPieces);
+    V myRooks      = and_(rookQueens, myPieces);
+    V myPawns      = and_(pawns, myPieces);
+
+    // 1. squares attacked by the enemy (sliding pieces see through the king)
+    V enemyPawns   = and_(pawns, enemyPieces);
+    V threatened   = or_(shiftOne<SIMD_SE>(enemyPawns), shiftOne<SIMD_SW>(enemyPawns));
+    threatened     = or_(threatened, knightAttacksSet(and_(knights, enemyPieces)));
+    threatened     = or_(threatened, kingAttacksSet(and_(kings, enemyPieces)));
+
+    V pro = or_(empty, myKing);
+    threatened = or_(threatened, or_(or_(slideAttacks<SIMD_NE>(enemyBishops, pro), slideAttacks<SIMD_NW>(enemyBishops, pro)),
+                                     or_(slideAttacks<SIMD_SE>(enemyBishops, pro), slideAttacks<SIMD_SW>(enemyBishops, pro))));
+    threatened = or_(threatened, or_(or_(slideAttacks<SIMD_N>(enemyRooks, pro), slideAttacks<SIMD_S>(enemyRooks, pro)),
+                                     or_(slideAttacks<SIMD_E>(enemyRooks, pro), slideAttacks<SIMD_W>(enemyRooks, pro))));
+
+    store(inCheck, keepIfNonZero(and_(threatened, myKing), set1(1)));
+
+    // 2. pinned pieces (and moves of pinned sliding pieces)
+    V cnt = zero();
+    V pinnerN, pinnerS, pinnerE, pinnerW, pinnerNE, pinnerNW, pinnerSE, pinnerSW;
+    V pinnedN  = findPinned<SIMD_N> (myKing, empty, myPieces, myRooks,   enemyRooks,   pinnerN,  cnt);
+    V pinnedS  = findPinned<SIMD_S> (myKing, empty, myPieces, myRooks,   enemyRooks,   pinnerS,  cnt);
+    V pinnedE  = findPinned<SIMD_E> (myKing, empty, myPieces, myRooks,   enemyRooks,   pinnerE,  cnt);
+    V pinnedW  = findPinned<SIMD_W> (myKing, empty, myPieces, myRooks,   enemyRooks,   pinnerW,  cnt);
+    V pinnedNE = findPinned<SIMD_NE>(myKing, empty, myPieces, myBishops, enemyBishops, pinnerNE, cnt);
+    V pinnedNW = findPinned<SIMD_NW>(myKing, empty, myPieces, myBishops, enemyBishops, pinnerNW, cnt);
+    V pinnedSE = findPinned<SIMD_SE>(myKing, empty, myPieces, myBishops, enemyBishops, pinnerSE, cnt);
+    V pinnedSW = findPinned<SIMD_SW>(myKing, empty, myPieces, myBishops, enemyBishops, pinnerSW, cnt);
+
+    V pinned = or_(or_(or_(pinnedN, pinnedS), or_(pinnedE, pinnedW)), or_(or_(pinnedNE, pinnedNW), or_(pinnedSE, pinnedSW)));
+
+    // 3. pawn moves
+    // pawns pinned along the file can still be pushed
+    // pawns pinned diagonally can only capture the pinner (if it's the adjacent square in forward direction)
+    V freePawns   = andnot(pinned, myPawns);
+    V pushPawns   = or_(freePawns, and_(or_(pinnedN, pinnedS), myPawns));
+
+    V dsts = and_(shiftOne<SIMD_N>(pushPawns), empty);
+    cnt = add(cnt, popcnt(dsts));
+    V promotions = popcnt(and_(dsts, set1(RANK8)));
+
+    dsts = and_(shiftOne<SIMD_N>(and_(dsts, set1(RANK3))), empty);
+    cnt = add(cnt, popcnt(dsts));
+
+    dsts = or_(and_(shiftOne<SIMD_NW>(freePawns), enemyPieces), and_(shiftOne<SIMD_NW>(and_(pinnedNW, myPawns)), pinnerNW));
+    cnt = add(cnt, popcnt(dsts));
+    promotions = add(promotions, popcnt(and_(dsts, set1(RANK8))));
+
+    dsts = or_(and_(shiftOne<SIMD_NE>(freePawns), enemyPieces), and_(shiftOne<SIMD_NE>(and_(pinnedNE, myPawns)), pinnerNE));
+    cnt = add(cnt, popcnt(dsts));
+    promotions = add(promotions, popcnt(and_(dsts, set1(RANK8))));
+
+    // 3 extra moves for every promotion
+    cnt = add(cnt, add(promotions, add(promotions, promotions)));
+
+    // 4. castling
+    V blockedKingSide  = and_(or_(allPieces, threatened), set1(F1G1));
+    V blockedQueenSide = or_(and_(allPieces, set1(B1D1)), and_(threatened, set1(C1D1)));
+    cnt = add(cnt, keepIfZero(blockedKingSide,  load(boards->castleKing)));
+    cnt = add(cnt, keepIfZero(blockedQueenSide, load(boards->castleQueen)));
+
+    // 5. king moves
+    cnt = add(cnt, popcnt(andnot(or_(threatened, myPieces), kingAttacksSet(myKing))));
+
+    // 6. knight moves (pinned knights can't move)
+    cnt = add(cnt, countKnightMoves(andnot(pinned, and_(knights, myPieces)), notMine));
+
+    // 7. sliding moves of pieces that are not pinned
+    // attack sets of different pieces along a single direction never overlap (the fill stops at the first piece)
+    V bishops = andnot(pinned, myBishops);
+    cnt = add(cnt, popcnt(and_(slideAttacks<SIMD_NE>(bishops, empty), notMine)));
+    cnt = add(cnt, popcnt(and_(slideAttacks<SIMD_NW>(bishops, empty), notMine)));
+    cnt = add(cnt, popcnt(and_(slideAttacks<SIMD_SE>(bishops, empty), notMine)));
+    cnt = add(cnt, popcnt(and_(slideAttacks<SIMD_SW>(bishops, empty), notMine)));
+
+    V rooks = andnot(pinned, myRooks);
+    cnt = add(cnt, popcnt(and_(slideAttacks<SIMD_N>(rooks, empty), notMine)));
+    cnt = add(cnt, popcnt(and_(slideAttacks<SIMD_S>(rooks, empty), notMine)));
+    cnt = add(cnt, popcnt(and_(slideAttacks<SIMD_E>(rooks, empty), notMine)));
+    cnt = add(cnt, popcnt(and_(slideAttacks<SIMD_W>(rooks, empty), notMine)));
+
+    store(counts, cnt);
+}
+
+#undef SIMD_N
+#undef SIMD_S
+#undef SIMD_E
+#undef SIMD_W
+#undef SIMD_NE
+#undef SIMD_NW
+#undef SIMD_SE
+#undef SIMD_SW
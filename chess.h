@@ -358,6 +358,31 @@ struct FancyMagicEntry
     };
 };
 
+// sliding piece attack lookup variants (CPU can pick one at runtime, see RUNTIME_SLIDING_BACKEND)
+enum SlidingBackend
+{
+    SLIDING_KOGGE_STONE = 0,
+    SLIDING_PLAIN_MAGICS,
+    SLIDING_FANCY_MAGICS,
+    SLIDING_BYTE_FANCY_MAGICS,
+    SLIDING_PEXT,
+    NUM_SLIDING_BACKENDS
+};
+
+// no. of distinct attack sets of rooks and bishops (summed over all squares), size of the byte lookup fancy tables
+#define NUM_UNIQUE_ROOK_ATTACKS   4900
+#define NUM_UNIQUE_BISHOP_ATTACKS 1428
+
+// fixed size array that can be built by a constexpr function
+// used for the lookup tables that are generated at compile time (see GlobalVars.cpp)
+template <typename T, int N>
+struct LookupTable
+{
+    T v[N];
+
+    CUDA_CALLABLE_MEMBER constexpr const T &operator[](int i) const { return v[i]; }
+};
+
 // hash table entry for Perft
 struct HashEntryPerft
 {
@@ -386,14 +411,6 @@ struct HashEntryPerft
 
 CT_ASSERT(sizeof(HashEntryPerft) == 16);
 
-// Paul B's method of storing two entries per slot of hash table
-struct DualHashEntry
-{
-    HashEntryPerft deepest;
-    HashEntryPerft mostRecent;
-};
-CT_ASSERT(sizeof(DualHashEntry) == 32);
-
 struct ShallowHashEntry
 {
     union
@@ -503,6 +520,15 @@ struct  HashEntryPerft128b
 // TODO: check if it can cause problem with 128 bit atomic read/writes?
 CT_ASSERT(sizeof(HashEntryPerft128b) == 24);
 
+// Paul B's method of storing two entries per slot of hash table
+// (the buckets of the deep per-depth tables, see deepTTProbe()/deepTTStore())
+struct DualHashEntry
+{
+    HashEntryPerft128b deepest;     // depth-preferred: keeps the entry that saves the most work
+    HashEntryPerft128b mostRecent;  // always replaced
+};
+CT_ASSERT(sizeof(DualHashEntry) == 48);
+
 #include "utils.h"
 
 
@@ -515,12 +541,22 @@ struct CompleteHashEntry
 };
 CT_ASSERT(sizeof(CompleteHashEntry) == 32);
 
+// packed entry of the complete TT (see completeTTWriteEntry() in launcher.h)
+// data: perft value in the high bits, the few bits of the hash's low part not implied by the slot in the low bits
+// key:  high part of the hash XOR data
+struct CompactHashEntry
+{
+    uint64 key;
+    uint64 data;
+};
+CT_ASSERT(sizeof(CompactHashEntry) == 16);
+
 struct DiskHashEntry
 {
     HashKey128b    hash;       
     uint64         perft;       
     uint32         depth;
-    uint32         next;
+    uint32         state;      // DISK_TT_VALID once the record is complete (see diskhash.h)
 };
 CT_ASSERT(sizeof(DiskHashEntry) == 32);
 
@@ -0,0 +1,157 @@
+// host stand-ins for the parts of CUDA runtime used by the launcher
+// used instead of cuda_runtime.h when CPU_ONLY_BUILD is set
+
+// every 'device' is a CPU worker thread, and 'device' memory is plain system memory
+// so all copies are just memcpy and device pointers are same as host pointers
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+
+#define __host__
+#define __device__
+#define __global__
+#define __forceinline__ inline
+
+enum cudaError_t
+{
+    cudaSuccess = 0,
+    cudaErrorMemoryAllocation = 2,
+};
+
+enum cudaMemcpyKind
+{
+    cudaMemcpyHostToHost = 0,
+    cudaMemcpyHostToDevice = 1,
+    cudaMemcpyDeviceToHost = 2,
+    cudaMemcpyDeviceToDevice = 3,
+};
+
+#define cudaHostAllocDefault        0
+#define cudaHostAllocPortable       1
+#define cudaHostAllocMapped         2
+#define cudaHostAllocWriteCombined  4
+
+typedef void *cudaStream_t;
+typedef std::chrono::high_resolution_clock::time_point *cudaEvent_t;
+
+static inline const char *cudaGetErrorString(cudaError_t err)
+{
+    return (err == cudaSuccess) ? "no error" : "out of memory";
+}
+
+// one 'device' per hardware thread
+static inline cudaError_t cudaGetDeviceCount(int *count)
+{
+    *count = std::thread::hardware_concurrency();
+    if (*count < 1)
+        *count = 1;
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaSetDevice(int device)
+{
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaDeviceReset()
+{
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaDeviceSynchronize()
+{
+    return cudaSuccess;
+}
+
+// report system memory
+static inline cudaError_t cudaMemGetInfo(size_t *free, size_t *total)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    *total = sysconf(_SC_PHYS_PAGES) * pageSize;
+    *free  = sysconf(_SC_AVPHYS_PAGES) * pageSize;
+    return cudaSuccess;
+}
+
+template<typename T>
+static inline cudaError_t cudaMalloc(T **devPtr, size_t size)
+{
+    *devPtr = (T *) malloc(size);
+    return *devPtr ? cudaSuccess : cudaErrorMemoryAllocation;
+}
+
+template<typename T>
+static inline cudaError_t cudaHostAlloc(T **ptr, size_t size, unsigned int flags)
+{
+    return cudaMalloc(ptr, size);
+}
+
+static inline cudaError_t cudaHostGetDevicePointer(void **devPtr, void *hostPtr, unsigned int flags)
+{
+    *devPtr = hostPtr;
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaFree(void *devPtr)
+{
+    free(devPtr);
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaFreeHost(void *ptr)
+{
+    free(ptr);
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaMemcpy(void *dst, const void *src, size_t count, cudaMemcpyKind kind)
+{
+    memcpy(dst, src, count);
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaMemset(void *devPtr, int value, size_t count)
+{
+    memset(devPtr, value, count);
+    return cudaSuccess;
+}
+
+// 'symbols' are just global variables
+template<typename T>
+static inline cudaError_t cudaMemcpyFromSymbol(void *dst, const T &symbol, size_t count, size_t offset = 0, cudaMemcpyKind kind = cudaMemcpyDeviceToHost)
+{
+    memcpy(dst, ((const char *) &symbol) + offset, count);
+    return cudaSuccess;
+}
+
+// events are simply timestamps (all work is synchronous)
+static inline cudaError_t cudaEventCreate(cudaEvent_t *event)
+{
+    *event = new std::chrono::high_resolution_clock::time_point();
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaEventDestroy(cudaEvent_t event)
+{
+    delete event;
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaEventRecord(cudaEvent_t event, cudaStream_t stream = 0)
+{
+    *event = std::chrono::high_resolution_clock::now();
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaEventSynchronize(cudaEvent_t event)
+{
+    return cudaSuccess;
+}
+
+static inline cudaError_t cudaEventElapsedTime(float *ms, cudaEvent_t start, cudaEvent_t end)
+{
+    *ms = (float) std::chrono::duration<double, std::milli>(*end - *start).count();
+    return cudaSuccess;
+}
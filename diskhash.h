@@ -0,0 +1,1059 @@
+// persistent hash table of the positions at diskHashDepth (perfts of big subtrees), shared by all the perft processes
+// started in the same directory and kept across runs (see ENABLE_DISK_HASH in launcher.h)
+//
+// It's log structured:
+//  - perfthash.log: new results are appended to it, one DiskHashEntry (32 bytes) per position
+//  - perfthash.seg.<n>: segments - a header, records sorted by key (without duplicates), the first key of every
+//    block of DISK_TT_BLOCK_RECORDS records and a bloom filter of the keys
+//  - perfthash.manifest: the list of segments (oldest first), replaced by renaming a new one over it
+// A background thread turns the log into a new segment every DISK_TT_COMPACT_INTERVAL seconds and merges the two
+// newest segments when the newest one gets about as big as the one before (so there are only a few segments, and
+// each record gets copied only a few times). Only one process compacts at a time (flock on perfthash.compact).
+//
+// Every process keeps the records of the log in memory (reading the new ones before each lookup), and the first keys
+// of the blocks and the bloom filter of each segment: so a lookup reads at most a single block of each segment, and
+// only of the segments whose filter says they can have the key (most lookups of a fresh run don't read anything). The records of the log are dropped from memory when the manifest changes (they are in a segment then).
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <deque>
+
+#define DISK_TT_LOG             "perfthash.log"
+#define DISK_TT_LOG_COMPACTING  "perfthash.log.compacting"     // log being turned into a segment
+#define DISK_TT_MANIFEST        "perfthash.manifest"
+#define DISK_TT_COMPACT_LOCK    "perfthash.compact"
+#define DISK_TT_SEGMENT         "perfthash.seg.%llu"
+
+#define DISK_TT_MAGIC           0x4853414854465250ull
+#define DISK_TT_VERSION         4
+#define DISK_TT_HEADER          4096
+
+#define DISK_TT_COMPACT_INTERVAL    60      // seconds
+#define DISK_TT_BLOCK_RECORDS       128     // 4 KB blocks
+#define DISK_TT_MAX_SEGMENTS        32
+// merge the two newest segments when the newest one has at least 1/DISK_TT_MERGE_RATIO of the records of the other
+#define DISK_TT_MERGE_RATIO         2
+
+// size of the bloom filters of segments (blocks of 512 bits, 8 bits set per key: ~0.5% false positives)
+#define DISK_TT_BLOOM_BITS_PER_KEY  12
+
+// DiskHashEntry::state (a record that doesn't say valid is a partly written one)
+#define DISK_TT_VALID           0x56414C44
+
+// header of the manifest and segment files
+struct DiskTTHeader
+{
+    uint64 magic;
+    uint32 version;
+    uint32 entrySize;
+    HashKey128b zobCheck;   // records are only valid with the same zobrist keys
+    uint64 count;           // no. of records (segment), no. of segments (manifest)
+    uint64 nextId;          // id of the next segment to be created (manifest)
+    uint64 bloomBlocks;     // size of the bloom filter (segment)
+};
+
+// a cache line of a bloom filter: all the bits of a key are in one block, one bit in each word
+struct DiskTTBloomBlock
+{
+    uint64 words[8];
+};
+
+struct DiskTTManifest
+{
+    DiskTTHeader header;
+    uint64 ids[DISK_TT_MAX_SEGMENTS];
+    uint64 counts[DISK_TT_MAX_SEGMENTS];
+};
+
+// a segment as seen by lookups
+// (shared with the lookups in flight, so that the file stays open till they are done)
+struct DiskTTSegment
+{
+    int fd = -1;
+    uint64 count = 0;
+    std::vector<DiskHashEntry> firstKeys;   // of every block (only the key fields are used)
+    std::vector<DiskTTBloomBlock> bloom;
+
+    ~DiskTTSegment()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+bool diskTTEnabled = false;
+HashKey128b diskTTZobCheck;
+
+std::mutex diskTTCS;                                    // protects everything below
+std::unordered_map<uint64, DiskHashEntry> diskTTLog;    // records of the log (by low part of the hash)
+int    diskTTLogFd = -1;
+uint64 diskTTLogOffset = 0;
+uint64 diskTTManifestId = ALLSET;                       // nextId of the manifest the segments are from
+struct stat diskTTManifestStat = {};                    // (to read it again only when it changed)
+std::vector<std::shared_ptr<DiskTTSegment>> diskTTSegments;
+
+std::thread             diskTTCompactThread;
+std::mutex              diskTTCompactCS;
+std::condition_variable diskTTCompactCV;
+std::atomic<bool>       diskTTCompactStop(false);
+
+
+// order of records in segments
+bool diskTTKeyLess(const DiskHashEntry &a, const DiskHashEntry &b)
+{
+    if (a.hash.highPart != b.hash.highPart)
+        return a.hash.highPart < b.hash.highPart;
+    if (a.hash.lowPart != b.hash.lowPart)
+        return a.hash.lowPart < b.hash.lowPart;
+    return a.depth < b.depth;
+}
+
+bool diskTTKeyEqual(const DiskHashEntry &a, const DiskHashEntry &b)
+{
+    return a.hash.highPart == b.hash.highPart && a.hash.lowPart == b.hash.lowPart && a.depth == b.depth;
+}
+
+uint64 diskTTLogKey(const DiskHashEntry &entry)
+{
+    return entry.hash.lowPart ^ ((uint64) entry.depth << 56);
+}
+
+// bloom filter of the keys of a segment
+uint64 diskTTBloomBlocks(uint64 count)
+{
+    return std::max(1ull, (count * DISK_TT_BLOOM_BITS_PER_KEY + 511) / 512);
+}
+
+DiskTTBloomBlock *diskTTBloomBlock(std::vector<DiskTTBloomBlock> &bloom, const DiskHashEntry &key)
+{
+    return &bloom[key.hash.highPart % bloom.size()];
+}
+
+// the bits of the key in its block (6 bits of the low part of the hash for each word)
+uint64 diskTTBloomBits(const DiskHashEntry &key)
+{
+    return key.hash.lowPart ^ (key.depth * 0x9E3779B97F4A7C15ull);
+}
+
+void diskTTBloomAdd(std::vector<DiskTTBloomBlock> &bloom, const DiskHashEntry &key)
+{
+    DiskTTBloomBlock *block = diskTTBloomBlock(bloom, key);
+    uint64 bits = diskTTBloomBits(key);
+    for (int i = 0; i < 8; i++)
+        block->words[i] |= 1ull << ((bits >> (i * 6)) & 63);
+}
+
+// false when the key is surely not in the segment
+bool diskTTBloomMayContain(DiskTTSegment *segment, const DiskHashEntry &key)
+{
+    DiskTTBloomBlock *block = diskTTBloomBlock(segment->bloom, key);
+    uint64 bits = diskTTBloomBits(key);
+    for (int i = 0; i < 8; i++)
+        if (!(block->words[i] & (1ull << ((bits >> (i * 6)) & 63))))
+            return false;
+    return true;
+}
+
+void diskTTSegmentPath(char *path, uint64 id)
+{
+    sprintf(path, DISK_TT_SEGMENT, id);
+}
+
+// reads the manifest (an empty one if there isn't any yet), returns false if it isn't usable
+bool diskTTReadManifest(DiskTTManifest *manifest)
+{
+    *manifest = DiskTTManifest();
+    int fd = open(DISK_TT_MANIFEST, O_RDONLY);
+    if (fd < 0)
+        return true;
+
+    bool ok = read(fd, manifest, sizeof(DiskTTManifest)) == sizeof(DiskTTManifest) &&
+              manifest->header.magic == DISK_TT_MAGIC && manifest->header.version == DISK_TT_VERSION &&
+              manifest->header.entrySize == sizeof(DiskHashEntry) && manifest->header.zobCheck == diskTTZobCheck &&
+              manifest->header.count <= DISK_TT_MAX_SEGMENTS;
+    close(fd);
+    return ok;
+}
+
+bool diskTTWriteManifest(DiskTTManifest *manifest)
+{
+    manifest->header.magic = DISK_TT_MAGIC;
+    manifest->header.version = DISK_TT_VERSION;
+    manifest->header.entrySize = sizeof(DiskHashEntry);
+    manifest->header.zobCheck = diskTTZobCheck;
+
+    char tempPath[64];
+    sprintf(tempPath, DISK_TT_MANIFEST ".%d", (int) getpid());
+    int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = write(fd, manifest, sizeof(DiskTTManifest)) == sizeof(DiskTTManifest) && fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tempPath, DISK_TT_MANIFEST))
+    {
+        unlink(tempPath);
+        return false;
+    }
+    return true;
+}
+
+
+// ---- lookups ----
+
+void diskTTCloseSegments()
+{
+    diskTTSegments.clear();
+}
+
+// opens the segments of the manifest if it changed (call holding diskTTCS)
+void diskTTRefreshSegments()
+{
+    struct stat st = {};
+    stat(DISK_TT_MANIFEST, &st);
+    if (diskTTManifestId != ALLSET && st.st_ino == diskTTManifestStat.st_ino &&
+        st.st_mtim.tv_sec == diskTTManifestStat.st_mtim.tv_sec && st.st_mtim.tv_nsec == diskTTManifestStat.st_mtim.tv_nsec)
+        return;
+
+    DiskTTManifest manifest;
+    if (!diskTTReadManifest(&manifest) || manifest.header.nextId == diskTTManifestId)
+        return;
+
+    diskTTCloseSegments();
+    for (uint64 s = 0; s < manifest.header.count; s++)
+    {
+        char path[64];
+        diskTTSegmentPath(path, manifest.ids[s]);
+
+        std::shared_ptr<DiskTTSegment> segment = std::make_shared<DiskTTSegment>();
+        segment->fd = open(path, O_RDONLY);
+        segment->count = manifest.counts[s];
+        if (segment->fd < 0)
+        {
+            // (got merged and deleted by the compactor meanwhile: the next manifest has it)
+            diskTTCloseSegments();
+            return;
+        }
+
+        // the first key of every block and the bloom filter (stored after the records)
+        DiskTTHeader header;
+        uint64 nBlocks = (segment->count + DISK_TT_BLOCK_RECORDS - 1) / DISK_TT_BLOCK_RECORDS;
+        uint64 size = nBlocks * sizeof(DiskHashEntry);
+        uint64 offset = DISK_TT_HEADER + segment->count * sizeof(DiskHashEntry);
+        bool ok = pread(segment->fd, &header, sizeof(header), 0) == sizeof(header) && header.count == segment->count &&
+                  header.bloomBlocks >= 1 && header.bloomBlocks <= diskTTBloomBlocks(segment->count) * 2;
+        if (ok)
+        {
+            segment->firstKeys.resize(nBlocks);
+            segment->bloom.resize(header.bloomBlocks);
+            uint64 bloomSize = header.bloomBlocks * sizeof(DiskTTBloomBlock);
+            ok = pread(segment->fd, segment->firstKeys.data(), size, offset) == (ssize_t) size &&
+                 pread(segment->fd, segment->bloom.data(), bloomSize, offset + size) == (ssize_t) bloomSize;
+        }
+        if (!ok)
+        {
+            printf("\nFailed to read disk hash segment %s\n", path);
+            diskTTCloseSegments();
+            return;
+        }
+        diskTTSegments.push_back(segment);
+    }
+    diskTTManifestId = manifest.header.nextId;
+    diskTTManifestStat = st;
+
+    // records of the log that was compacted are in the segments now, read the log again from the start
+    diskTTLog.clear();
+    if (diskTTLogFd >= 0)
+        close(diskTTLogFd);
+    diskTTLogFd = -1;
+    diskTTLogOffset = 0;
+}
+
+// reads the records appended to the log since the last time (call holding diskTTCS)
+void diskTTReadLog()
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (diskTTLogFd < 0)
+        {
+            diskTTLogFd = open(DISK_TT_LOG, O_RDONLY);
+            diskTTLogOffset = 0;
+            if (diskTTLogFd < 0)
+                return;
+        }
+
+        DiskHashEntry records[DISK_TT_BLOCK_RECORDS];
+        ssize_t bytes;
+        while ((bytes = pread(diskTTLogFd, records, sizeof(records), diskTTLogOffset)) >= (ssize_t) sizeof(DiskHashEntry))
+        {
+            int n = (int) (bytes / sizeof(DiskHashEntry));
+            for (int i = 0; i < n; i++)
+                if (records[i].state == DISK_TT_VALID)
+                    diskTTLog[diskTTLogKey(records[i])] = records[i];
+            diskTTLogOffset += n * sizeof(DiskHashEntry);
+        }
+
+        // the compactor renamed it: move on to the new one
+        struct stat logStat, fdStat;
+        if (stat(DISK_TT_LOG, &logStat) == 0 && fstat(diskTTLogFd, &fdStat) == 0 && logStat.st_ino == fdStat.st_ino)
+            return;
+        close(diskTTLogFd);
+        diskTTLogFd = -1;
+    }
+}
+
+// the block of a segment that can have the key: returns false if there is none
+// (n: no. of records in it, offset: of the block in the file)
+bool diskTTSegmentBlock(DiskTTSegment *segment, const DiskHashEntry &key, uint64 *pN, uint64 *pOffset)
+{
+    if (!diskTTBloomMayContain(segment, key))
+        return false;
+
+    std::vector<DiskHashEntry>::iterator block = std::upper_bound(segment->firstKeys.begin(), segment->firstKeys.end(), key, diskTTKeyLess);
+    if (block == segment->firstKeys.begin())
+        return false;
+    uint64 b = (block - segment->firstKeys.begin()) - 1;
+
+    *pN = std::min((uint64) DISK_TT_BLOCK_RECORDS, segment->count - b * DISK_TT_BLOCK_RECORDS);
+    *pOffset = DISK_TT_HEADER + b * DISK_TT_BLOCK_RECORDS * sizeof(DiskHashEntry);
+    return true;
+}
+
+bool diskTTBlockFind(DiskHashEntry *records, uint64 n, const DiskHashEntry &key, uint64 *pPerft)
+{
+    DiskHashEntry *found = std::lower_bound(records, records + n, key, diskTTKeyLess);
+    if (found == records + n || !diskTTKeyEqual(*found, key))
+        return false;
+
+    *pPerft = found->perft;
+    return true;
+}
+
+// finds the key in a segment: one block read
+bool diskTTSegmentFind(DiskTTSegment *segment, const DiskHashEntry &key, uint64 *pPerft)
+{
+    uint64 n, offset;
+    if (!diskTTSegmentBlock(segment, key, &n, &offset))
+        return false;
+
+    DiskHashEntry records[DISK_TT_BLOCK_RECORDS];
+    if (pread(segment->fd, records, n * sizeof(DiskHashEntry), offset) != (ssize_t) (n * sizeof(DiskHashEntry)))
+        return false;
+
+    return diskTTBlockFind(records, n, key, pPerft);
+}
+
+// looks for the key in the records of the log (call holding diskTTCS)
+bool diskTTLogFind(const DiskHashEntry &key, uint64 *pPerft)
+{
+    std::unordered_map<uint64, DiskHashEntry>::iterator it = diskTTLog.find(diskTTLogKey(key));
+    if (it == diskTTLog.end() || !diskTTKeyEqual(it->second, key))
+        return false;
+
+    *pPerft = it->second.perft;
+    return true;
+}
+
+// the part of a lookup that doesn't need disk reads: the records of the log and the bloom filters of the segments
+// returns true when that's enough (*pPerft: ALLSET if the key isn't there), else the segments that can have the key
+// are in candidates (oldest first)
+bool diskTTMemoryProbe(const DiskHashEntry &key, uint64 *pPerft, std::vector<std::shared_ptr<DiskTTSegment>> *candidates)
+{
+    std::lock_guard<std::mutex> lock(diskTTCS);
+    diskTTRefreshSegments();
+    diskTTReadLog();
+
+    *pPerft = ALLSET;
+    if (diskTTLogFind(key, pPerft))
+        return true;
+
+    for (size_t s = 0; s < diskTTSegments.size(); s++)
+        if (diskTTBloomMayContain(diskTTSegments[s].get(), key))
+            candidates->push_back(diskTTSegments[s]);
+    return candidates->empty();
+}
+
+// reads the blocks of the candidate segments (see diskTTMemoryProbe()), newest segments first
+// returns ALLSET when the position isn't found
+uint64 diskTTCandidatesFind(const std::vector<std::shared_ptr<DiskTTSegment>> &candidates, const DiskHashEntry &key)
+{
+    uint64 perft;
+    for (int s = (int) candidates.size() - 1; s >= 0; s--)
+        if (diskTTSegmentFind(candidates[s].get(), key, &perft))
+            return perft;
+
+    return ALLSET;
+}
+
+// returns ALLSET when the position isn't found
+uint64 diskTTProbe(HashKey128b hash, int depth)
+{
+    if (!diskTTEnabled)
+        return ALLSET;
+
+    DiskHashEntry key = {};
+    key.hash = hash;
+    key.depth = depth;
+
+    uint64 perft;
+    std::vector<std::shared_ptr<DiskTTSegment>> candidates;
+    if (diskTTMemoryProbe(key, &perft, &candidates))
+        return perft;
+
+    return diskTTCandidatesFind(candidates, key);
+}
+
+// appends the record to the log
+void diskTTStore(HashKey128b hash, int depth, uint64 perft)
+{
+    if (!diskTTEnabled)
+        return;
+
+    DiskHashEntry record = {};
+    record.hash = hash;
+    record.perft = perft;
+    record.depth = depth;
+    record.state = DISK_TT_VALID;
+
+    // the shared lock keeps the compactor from reading the log before the record is written in it
+    // (and if the compactor renamed the log before we got the lock, the record goes to the new log)
+    bool written = false;
+    for (int attempt = 0; attempt < 16 && !written; attempt++)
+    {
+        int fd = open(DISK_TT_LOG, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0)
+            break;
+        flock(fd, LOCK_SH);
+
+        struct stat logStat, fdStat;
+        if (stat(DISK_TT_LOG, &logStat) == 0 && fstat(fd, &fdStat) == 0 && logStat.st_ino == fdStat.st_ino)
+            written = write(fd, &record, sizeof(record)) == sizeof(record);
+        close(fd);
+    }
+
+    if (!written)
+    {
+        printf("\nFailed to write to disk hash log %s\n", DISK_TT_LOG);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(diskTTCS);
+    diskTTLog[diskTTLogKey(record)] = record;
+}
+
+
+// ---- compaction ----
+
+// reads records of segment files in order
+struct DiskTTSegmentReader
+{
+    FILE *fp = NULL;
+    uint64 left;
+    DiskHashEntry current;
+
+    bool open(uint64 id, uint64 count)
+    {
+        char path[64];
+        diskTTSegmentPath(path, id);
+        fp = fopen(path, "rb");
+        left = count;
+        return fp && fseek(fp, DISK_TT_HEADER, SEEK_SET) == 0;
+    }
+
+    // false at the end
+    bool next()
+    {
+        if (left == 0 || fread(&current, sizeof(DiskHashEntry), 1, fp) != 1)
+            return false;
+        left--;
+        return true;
+    }
+};
+
+// writes a segment file (under a temporary name till it's complete)
+struct DiskTTSegmentWriter
+{
+    FILE *fp = NULL;
+    uint64 id;
+    uint64 count;
+    char tempPath[64];
+    std::vector<DiskHashEntry> firstKeys;
+    std::vector<DiskTTBloomBlock> bloom;
+
+    // maxCount: no. of records that can be added at most (to size the bloom filter)
+    bool open(uint64 segmentId, uint64 maxCount)
+    {
+        id = segmentId;
+        count = 0;
+        bloom.assign(diskTTBloomBlocks(maxCount), DiskTTBloomBlock());
+        sprintf(tempPath, DISK_TT_SEGMENT ".tmp", id);
+        fp = fopen(tempPath, "wb");
+        return fp && fseek(fp, DISK_TT_HEADER, SEEK_SET) == 0;
+    }
+
+    bool add(const DiskHashEntry &record)
+    {
+        if (count % DISK_TT_BLOCK_RECORDS == 0)
+            firstKeys.push_back(record);
+        diskTTBloomAdd(bloom, record);
+        count++;
+        return fwrite(&record, sizeof(DiskHashEntry), 1, fp) == 1;
+    }
+
+    bool finish()
+    {
+        DiskTTHeader header = {};
+        header.magic = DISK_TT_MAGIC;
+        header.version = DISK_TT_VERSION;
+        header.entrySize = sizeof(DiskHashEntry);
+        header.zobCheck = diskTTZobCheck;
+        header.count = count;
+
+        header.bloomBlocks = bloom.size();
+
+        bool ok = fwrite(firstKeys.data(), sizeof(DiskHashEntry), firstKeys.size(), fp) == firstKeys.size() &&
+                  fwrite(bloom.data(), sizeof(DiskTTBloomBlock), bloom.size(), fp) == bloom.size() &&
+                  fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                  fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+        ok = (fclose(fp) == 0) && ok;
+
+        char path[64];
+        diskTTSegmentPath(path, id);
+        if (!ok || rename(tempPath, path))
+        {
+            unlink(tempPath);
+            return false;
+        }
+        return true;
+    }
+
+    void abort()
+    {
+        fclose(fp);
+        unlink(tempPath);
+    }
+};
+
+// turns the log into a new segment
+bool diskTTCompactLog(DiskTTManifest *manifest)
+{
+    // (the newest segments get merged first when there's no room for another one)
+    if (manifest->header.count == DISK_TT_MAX_SEGMENTS)
+        return false;
+
+    // (a log left by a compaction that didn't finish is done first)
+    if (access(DISK_TT_LOG_COMPACTING, F_OK) != 0)
+    {
+        struct stat st;
+        if (stat(DISK_TT_LOG, &st) || st.st_size < (off_t) sizeof(DiskHashEntry))
+            return false;
+        if (rename(DISK_TT_LOG, DISK_TT_LOG_COMPACTING))
+            return false;
+    }
+
+    // wait for the writers that got the log before it was renamed
+    int fd = open(DISK_TT_LOG_COMPACTING, O_RDONLY);
+    if (fd < 0)
+        return false;
+    flock(fd, LOCK_EX);
+
+    std::vector<DiskHashEntry> records;
+    DiskHashEntry buffer[DISK_TT_BLOCK_RECORDS];
+    ssize_t bytes;
+    while ((bytes = read(fd, buffer, sizeof(buffer))) >= (ssize_t) sizeof(DiskHashEntry))
+    {
+        for (int i = 0; i < (int) (bytes / sizeof(DiskHashEntry)); i++)
+            if (buffer[i].state == DISK_TT_VALID)
+                records.push_back(buffer[i]);
+    }
+    close(fd);
+
+    std::sort(records.begin(), records.end(), diskTTKeyLess);
+    records.erase(std::unique(records.begin(), records.end(), diskTTKeyEqual), records.end());
+
+    DiskTTSegmentWriter writer;
+    if (!writer.open(manifest->header.nextId, records.size()))
+        return false;
+    for (size_t i = 0; i < records.size(); i++)
+        writer.add(records[i]);
+    if (!writer.finish())
+        return false;
+
+    manifest->ids[manifest->header.count] = manifest->header.nextId;
+    manifest->counts[manifest->header.count] = writer.count;
+    manifest->header.count++;
+    manifest->header.nextId++;
+    if (!diskTTWriteManifest(manifest))
+        return false;
+
+    unlink(DISK_TT_LOG_COMPACTING);
+    return true;
+}
+
+// merges the two newest segments into one (keeping one record of each key)
+bool diskTTMergeNewest(DiskTTManifest *manifest)
+{
+    int s = (int) manifest->header.count - 2;
+    DiskTTSegmentReader older, newer;
+    DiskTTSegmentWriter writer;
+    bool ok = older.open(manifest->ids[s], manifest->counts[s]) && newer.open(manifest->ids[s + 1], manifest->counts[s + 1]) &&
+              writer.open(manifest->header.nextId, manifest->counts[s] + manifest->counts[s + 1]);
+
+    if (ok)
+    {
+        bool haveOlder = older.next(), haveNewer = newer.next();
+        uint64 n = 0;
+        while ((haveOlder || haveNewer) && ok)
+        {
+            // (stop early when the process is exiting - the segments are merged next time)
+            if ((++n % (1024 * 1024)) == 0 && diskTTCompactStop)
+                ok = false;
+            else if (!haveNewer || (haveOlder && diskTTKeyLess(older.current, newer.current)))
+            {
+                ok = writer.add(older.current);
+                haveOlder = older.next();
+            }
+            else
+            {
+                if (haveOlder && diskTTKeyEqual(older.current, newer.current))
+                    haveOlder = older.next();
+                ok = writer.add(newer.current);
+                haveNewer = newer.next();
+            }
+        }
+        ok = ok && older.left == 0 && newer.left == 0;
+    }
+
+    if (older.fp) fclose(older.fp);
+    if (newer.fp) fclose(newer.fp);
+    if (!ok)
+    {
+        if (writer.fp)
+            writer.abort();
+        return false;
+    }
+    if (!writer.finish())
+        return false;
+
+    uint64 oldIds[2] = { manifest->ids[s], manifest->ids[s + 1] };
+    manifest->ids[s] = manifest->header.nextId;
+    manifest->counts[s] = writer.count;
+    manifest->header.count--;
+    manifest->header.nextId++;
+    if (!diskTTWriteManifest(manifest))
+        return false;
+
+    // (processes that have them open can still read them)
+    for (int i = 0; i < 2; i++)
+    {
+        char path[64];
+        diskTTSegmentPath(path, oldIds[i]);
+        unlink(path);
+    }
+    return true;
+}
+
+void diskTTCompact()
+{
+    int lockFd = open(DISK_TT_COMPACT_LOCK, O_RDWR | O_CREAT, 0644);
+    if (lockFd < 0)
+        return;
+
+    // some other process is at it
+    if (flock(lockFd, LOCK_EX | LOCK_NB))
+    {
+        close(lockFd);
+        return;
+    }
+
+    DiskTTManifest manifest;
+    if (diskTTReadManifest(&manifest))
+    {
+        diskTTCompactLog(&manifest);
+
+        while (manifest.header.count >= 2 && !diskTTCompactStop)
+        {
+            uint64 newest = manifest.counts[manifest.header.count - 1];
+            uint64 older = manifest.counts[manifest.header.count - 2];
+            if (manifest.header.count < DISK_TT_MAX_SEGMENTS && newest * DISK_TT_MERGE_RATIO < older)
+                break;
+            if (!diskTTMergeNewest(&manifest))
+                break;
+        }
+    }
+
+    flock(lockFd, LOCK_UN);
+    close(lockFd);
+}
+
+void diskTTCompactWorker()
+{
+    std::unique_lock<std::mutex> lock(diskTTCompactCS);
+    while (!diskTTCompactStop)
+    {
+        lock.unlock();
+        diskTTCompact();
+        lock.lock();
+        if (!diskTTCompactStop)
+            diskTTCompactCV.wait_for(lock, std::chrono::seconds(DISK_TT_COMPACT_INTERVAL));
+    }
+}
+
+
+// ---- asynchronous lookups ----
+//
+// diskTTSubmitProbe() queues a lookup and returns right away, the result is picked up with diskTTProbeDone() and
+// diskTTWaitProbe(). The lookups are done by a thread that reads the candidate blocks of all the segments at once
+// with io_uring, or (when io_uring isn't available) by a few threads doing regular lookups.
+
+// use io_uring for asynchronous lookups when the kernel supports it (needs linux/io_uring.h to build)
+#define DISK_TT_USE_IO_URING    1
+#define DISK_TT_IO_THREADS      4       // without io_uring
+#define DISK_TT_IO_QUEUE_DEPTH  256     // max no. of block reads in flight with io_uring
+
+#if DISK_TT_USE_IO_URING == 1
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#endif
+
+struct DiskTTRequest
+{
+    DiskHashEntry key;
+    uint64 perft;               // the result: ALLSET when not found
+    int reads;                  // block reads in flight (io_uring)
+    std::atomic<bool> done;
+    std::vector<std::shared_ptr<DiskTTSegment>> candidates;    // segments to read (found when it was submitted)
+};
+
+std::deque<DiskTTRequest *> diskTTQueue;
+std::mutex              diskTTQueueCS;
+std::condition_variable diskTTQueueCV;
+std::mutex              diskTTDoneCS;
+std::condition_variable diskTTDoneCV;
+std::vector<std::thread> diskTTIOThreads;
+std::atomic<bool>       diskTTIOStop(false);
+
+void diskTTComplete(DiskTTRequest *request, uint64 perft)
+{
+    std::lock_guard<std::mutex> lock(diskTTDoneCS);
+    request->perft = perft;
+    request->done.store(true, std::memory_order_release);
+    diskTTDoneCV.notify_all();
+}
+
+// next request in the queue, NULL when stopping (waits for one if wait is set, else returns NULL if there is none)
+DiskTTRequest *diskTTNextRequest(bool wait)
+{
+    std::unique_lock<std::mutex> lock(diskTTQueueCS);
+    if (wait)
+        diskTTQueueCV.wait(lock, [] { return !diskTTQueue.empty() || diskTTIOStop; });
+    if (diskTTQueue.empty())
+        return NULL;
+
+    DiskTTRequest *request = diskTTQueue.front();
+    diskTTQueue.pop_front();
+    return request;
+}
+
+void diskTTPoolWorker()
+{
+    DiskTTRequest *request;
+    while ((request = diskTTNextRequest(true)) != NULL)
+    {
+        uint64 perft = diskTTCandidatesFind(request->candidates, request->key);
+        request->candidates.clear();
+        diskTTComplete(request, perft);
+    }
+}
+
+#if DISK_TT_USE_IO_URING == 1
+struct DiskTTRing
+{
+    int fd = -1;
+    uint32 entries;
+    uint32 *sqTail, *sqMask, *sqArray;
+    uint32 *cqHead, *cqTail, *cqMask;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    void *sqMap, *cqMap;
+    size_t sqMapSize, cqMapSize;
+};
+
+// a block read in flight
+struct DiskTTRead
+{
+    DiskTTRequest *request;
+    std::shared_ptr<DiskTTSegment> segment;
+    uint64 n;
+    iovec iov;
+    DiskHashEntry records[DISK_TT_BLOCK_RECORDS];
+};
+
+DiskTTRing diskTTRing;
+
+void diskTTRingFree(DiskTTRing *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->entries * sizeof(io_uring_sqe));
+    if (ring->cqMap && ring->cqMap != MAP_FAILED && ring->cqMap != ring->sqMap)
+        munmap(ring->cqMap, ring->cqMapSize);
+    if (ring->sqMap && ring->sqMap != MAP_FAILED)
+        munmap(ring->sqMap, ring->sqMapSize);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    *ring = DiskTTRing();
+}
+
+bool diskTTRingSetup(DiskTTRing *ring)
+{
+    io_uring_params params = {};
+    ring->fd = (int) syscall(__NR_io_uring_setup, DISK_TT_IO_QUEUE_DEPTH, &params);
+    if (ring->fd < 0)
+        return false;
+
+    ring->entries = params.sq_entries;
+    ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(uint32);
+    ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap)
+        ring->sqMapSize = ring->cqMapSize = std::max(ring->sqMapSize, ring->cqMapSize);
+
+    ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqMap = singleMap ? ring->sqMap :
+                  mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (io_uring_sqe *) mmap(NULL, ring->entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       ring->fd, IORING_OFF_SQES);
+    if (ring->sqMap == MAP_FAILED || ring->cqMap == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        diskTTRingFree(ring);
+        return false;
+    }
+
+    uint8 *sq = (uint8 *) ring->sqMap;
+    uint8 *cq = (uint8 *) ring->cqMap;
+    ring->sqTail  = (uint32 *) (sq + params.sq_off.tail);
+    ring->sqMask  = (uint32 *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (uint32 *) (sq + params.sq_off.array);
+    ring->cqHead  = (uint32 *) (cq + params.cq_off.head);
+    ring->cqTail  = (uint32 *) (cq + params.cq_off.tail);
+    ring->cqMask  = (uint32 *) (cq + params.cq_off.ring_mask);
+    ring->cqes    = (io_uring_cqe *) (cq + params.cq_off.cqes);
+    return true;
+}
+
+// queues reads of the blocks of the candidate segments that can have the key (newest segments first), returns the
+// no. of reads (the request is complete right away if none of them can have it)
+uint32 diskTTRingQueueReads(DiskTTRing *ring, DiskTTRequest *request, uint32 *pTail)
+{
+    std::vector<std::shared_ptr<DiskTTSegment>> segments;
+    segments.swap(request->candidates);
+
+    request->perft = ALLSET;
+    request->reads = 0;
+    for (int s = (int) segments.size() - 1; s >= 0; s--)
+    {
+        uint64 n, offset;
+        if (!diskTTSegmentBlock(segments[s].get(), request->key, &n, &offset))
+            continue;
+
+        DiskTTRead *read = new DiskTTRead;
+        read->request = request;
+        read->segment = segments[s];
+        read->n = n;
+        read->iov.iov_base = read->records;
+        read->iov.iov_len = n * sizeof(DiskHashEntry);
+
+        uint32 index = *pTail & *ring->sqMask;
+        io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = read->segment->fd;
+        sqe->addr = (uint64) &read->iov;
+        sqe->len = 1;
+        sqe->off = offset;
+        sqe->user_data = (uint64) read;
+        ring->sqArray[index] = index;
+        (*pTail)++;
+        request->reads++;
+    }
+
+    if (request->reads == 0)
+        diskTTComplete(request, ALLSET);
+    return request->reads;
+}
+
+void diskTTRingWorker()
+{
+    DiskTTRing *ring = &diskTTRing;
+    uint32 inFlight = 0;    // submitted reads that are not complete yet
+    uint32 queued = 0;      // reads in the submission ring not submitted yet
+    uint32 tail = *ring->sqTail;
+
+    while (1)
+    {
+        // take new requests while there is room in the ring for all their reads
+        // (and wait for one when there is nothing else to do)
+        while (inFlight + queued + DISK_TT_MAX_SEGMENTS <= ring->entries)
+        {
+            DiskTTRequest *request = diskTTNextRequest(inFlight + queued == 0);
+            if (request == NULL)
+                break;
+            queued += diskTTRingQueueReads(ring, request, &tail);
+        }
+        __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+        if (inFlight + queued == 0)
+        {
+            if (diskTTIOStop)
+                break;
+            continue;
+        }
+
+        // submit, and wait for at least one read to complete
+        int submitted = (int) syscall(__NR_io_uring_enter, ring->fd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted > 0)
+        {
+            queued -= submitted;
+            inFlight += submitted;
+        }
+        else if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            printf("\nio_uring_enter failed for disk hash lookups, errno: %d\n", errno);
+            exit(0);
+        }
+
+        uint32 head = *ring->cqHead;
+        while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        {
+            io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+            DiskTTRead *read = (DiskTTRead *) cqe->user_data;
+            DiskTTRequest *request = read->request;
+
+            uint64 perft;
+            if (cqe->res == (int) (read->n * sizeof(DiskHashEntry)) && diskTTBlockFind(read->records, read->n, request->key, &perft))
+                request->perft = perft;
+            if (--request->reads == 0)
+                diskTTComplete(request, request->perft);
+
+            delete read;
+            inFlight--;
+            head++;
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+#endif
+
+// starts looking up the position, the request must stay around till the lookup is done
+void diskTTSubmitProbe(DiskTTRequest *request, HashKey128b hash, int depth)
+{
+    request->key = DiskHashEntry();
+    request->key.hash = hash;
+    request->key.depth = depth;
+    request->perft = ALLSET;
+    request->done.store(!diskTTEnabled, std::memory_order_relaxed);
+    if (!diskTTEnabled)
+        return;
+
+    // done without disk reads (found in the log, or the bloom filters say it's not in any segment)
+    // else the I/O threads read the blocks of the segments found here
+    uint64 perft;
+    request->candidates.clear();
+    if (diskTTMemoryProbe(request->key, &perft, &request->candidates))
+    {
+        diskTTComplete(request, perft);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(diskTTQueueCS);
+    diskTTQueue.push_back(request);
+    diskTTQueueCV.notify_one();
+}
+
+bool diskTTProbeDone(DiskTTRequest *request)
+{
+    return request->done.load(std::memory_order_acquire);
+}
+
+// returns ALLSET when the position isn't found
+uint64 diskTTWaitProbe(DiskTTRequest *request)
+{
+    if (!diskTTProbeDone(request))
+    {
+        std::unique_lock<std::mutex> lock(diskTTDoneCS);
+        diskTTDoneCV.wait(lock, [request] { return diskTTProbeDone(request); });
+    }
+    return request->perft;
+}
+
+void startDiskTTIO()
+{
+    diskTTIOStop = false;
+#if DISK_TT_USE_IO_URING == 1
+    if (diskTTRingSetup(&diskTTRing))
+    {
+        diskTTIOThreads.push_back(std::thread(diskTTRingWorker));
+        return;
+    }
+#endif
+    for (int i = 0; i < DISK_TT_IO_THREADS; i++)
+        diskTTIOThreads.push_back(std::thread(diskTTPoolWorker));
+}
+
+void stopDiskTTIO()
+{
+    diskTTQueueCS.lock();
+    diskTTIOStop = true;
+    diskTTQueueCV.notify_all();
+    diskTTQueueCS.unlock();
+
+    for (size_t i = 0; i < diskTTIOThreads.size(); i++)
+        diskTTIOThreads[i].join();
+    diskTTIOThreads.clear();
+#if DISK_TT_USE_IO_URING == 1
+    diskTTRingFree(&diskTTRing);
+#endif
+}
+
+
+// checks the manifest (if there is one) and starts the compactor and the threads for asynchronous lookups
+// runs without disk hash if the files can't be used
+void diskTTOpen()
+{
+    diskTTZobCheck = ZOB_KEY_128(depth);
+
+    DiskTTManifest manifest;
+    if (!diskTTReadManifest(&manifest))
+    {
+        printf("\n%s is not a disk hash manifest of this version, running without disk hash\n", DISK_TT_MANIFEST);
+        return;
+    }
+
+    diskTTEnabled = true;
+    diskTTCompactStop = false;
+    diskTTCompactThread = std::thread(diskTTCompactWorker);
+    startDiskTTIO();
+}
+
+void diskTTClose()
+{
+    if (!diskTTEnabled)
+        return;
+
+    diskTTCompactCS.lock();
+    diskTTCompactStop = true;
+    diskTTCompactCV.notify_all();
+    diskTTCompactCS.unlock();
+    diskTTCompactThread.join();
+    stopDiskTTIO();
+
+    std::lock_guard<std::mutex> lock(diskTTCS);
+    diskTTCloseSegments();
+    if (diskTTLogFd >= 0)
+        close(diskTTLogFd);
+    diskTTLogFd = -1;
+    diskTTLog.clear();
+    diskTTEnabled = false;
+}
@@ -10,7 +10,12 @@
 
 // can't make this bigger than 6/7, as the _simple kernel (breadth first search) gets called directly
 // breadth first search uses lot of memory and can can't hold bigger tree 
+#if CPU_ONLY_BUILD == 1
+// smaller trees for the host BFS (fits in the smaller per-worker buffer)
+#define GPU_LAUNCH_DEPTH 5
+#else
 #define GPU_LAUNCH_DEPTH 6
+#endif
 
 // launch all boards at last level in a single kernel launch 
 // enable this with GPU_LAUNCH_DEPTH 6
@@ -23,7 +28,12 @@
 // use multiple CPU threads to split the tree at greater depth 
 #define PARALLEL_THREAD_GPU_SPLIT 1
 // depth at which work is split among multiple GPUs
+#if CPU_ONLY_BUILD == 1
+// (CPU workers are much slower, so split as soon as possible - i.e, above the last level launch)
+#define MIN_SPLIT_DEPTH (GPU_LAUNCH_DEPTH + 2)
+#else
 #define MIN_SPLIT_DEPTH 9
+#endif
 
 // launch one level of work serially on GPU
 #define ENABLE_GPU_SERIAL_LEVEL 0
@@ -42,10 +52,22 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/file.h>
-// ~4096 entries for the main hash table part
-#define DISK_TT_BITS 12
 #endif
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+#include <condition_variable>
+#include <memory>
+
 // use complete hash for all levels
 #define USE_COMPLETE_HASH_ALL_LEVELS 1
 
@@ -53,7 +75,16 @@
 // each node broadcasts work computed by itself to all other nodes to avoid duplication
 // the work items recieved from other nodes are added to current node's complete TT
 // a new node can also request the *entire* completeTT to be sent from one of the existing nodes
+// (nothing to share without transposition tables)
+// the host only build runs standalone by default: build it with "make perft_cpu NETWORK=1" for network mode
+// (e.g, to run several nodes on one machine with -node=<address>:<port>)
+#ifndef MULTI_NODE_NETWORK_MODE
+#if USE_TRANSPOSITION_TABLE == 1 && CPU_ONLY_BUILD == 0
 #define MULTI_NODE_NETWORK_MODE 1
+#else
+#define MULTI_NODE_NETWORK_MODE 0
+#endif
+#endif
 uint64 numItemsFromPeers = 0;
 
 
@@ -70,75 +101,243 @@ uint64 numItemsFromPeers = 0;
 
 const bool  shallow[] = {true,  true,  true,   true,   true,  false,  false,  false,  false,  false,  false,  false,  false,  false,  false,  false};
 
-#if 1
-// settings for P100 (16 GB card) + 32 GB+ sysmem
-const uint32 ttBits[] = {0,       24,    25,     27,     28,     28,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0};
-const bool   sysmem[] = {true, false, false,  false,   false,  true,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true};
-const int  sharedHashBits = 25;
+// the sizes (and placement) of the tables are decided at startup by planTTMemory() based on the
+// available system memory (and video memory), or the budget given with -ttmem=<MB>
+// a table size of 0 bits means that the depth uses the shared table
+uint32 ttBits[MAX_PERFT_DEPTH];
+bool   sysmem[MAX_PERFT_DEPTH];
+int    sharedHashBits;
+const bool sharedsysmem = true;
+
+// initial and max size of the complete TT (it grows on demand)
+int completeTTStartBits;
+int completeTTMaxBits;
+
+// bounds of table sizes picked by the planner
+#define TT_PLAN_MIN_BITS            16
+#define TT_PLAN_MAX_BITS            32
+#define COMPLETE_TT_PLAN_MIN_BITS   20
+
+// shallow tables keep the perft value in the index bits of the entry, so they need enough index bits to hold
+// perft(depth) - assumes less than 64 moves per ply
+#define TT_PLAN_PERFT_BITS_PER_PLY  6
+
+// the complete TT starts at 1/4th of its planned max size
+#define COMPLETE_TT_PLAN_GROW_STEPS 2
+
+// part of available system memory used for hash tables (when no budget is given)
+#define TT_PLAN_SYSMEM_PERCENT      75
+
+// video memory left for kernel launches and the driver
+#define TT_PLAN_DEVICE_RESERVE      (256 * 1024 * 1024ull)
+
+// big host side tables (complete TT and the sysmem transposition tables) are allocated with allocHostTable()
+// 0: regular pages, 1: transparent huge pages, 2: explicit huge pages (MAP_HUGETLB, needs vm.nr_hugepages) falling back to 1
+#define HOST_TABLE_HUGE_PAGES       1
+
+// interleave the pages of host tables across all NUMA nodes
+// (otherwise the pages go to the node of the thread clearing them - and the clearing is spread over all cores)
+#define HOST_TABLE_NUMA_INTERLEAVE  1
+
+// tables smaller than this are cleared by the calling thread alone
+#define HOST_TABLE_PARALLEL_CLEAR_MIN (64 * 1024 * 1024ull)
+#define HOST_TABLE_MAX_CLEAR_THREADS  64
+
+
+// the complete TT is an open addressing hash table made of buckets of 4 entries (64 bytes - one cache line)
+// a position is looked for in its home bucket first and then in the other buckets of the same group of 4 buckets
+// (entries are never removed, so the search stops at the first empty slot - usually in the home bucket itself)
+// when a group gets full the table grows to twice the size, moving the entries to the new table incrementally:
+// every probe/store moves a few groups. After reaching completeTTMaxBits, entries of full groups get replaced.
+#define COMPLETE_TT_BUCKET_SIZE     4
+#define COMPLETE_TT_GROUP_BUCKETS   4
+#define COMPLETE_TT_GROUP_SIZE      (COMPLETE_TT_BUCKET_SIZE * COMPLETE_TT_GROUP_BUCKETS)
+#define COMPLETE_TT_GROUP_SHIFT     4
+
+// entries are 16 bytes: the high part of the hash and 64 bits of data with the perft value and 16 bits of the
+// low part of the hash - the index within the group and the bits between the table index and bit 32
+// (the other bits of the low part are implied by the group the entry is in, bits above 32 aren't checked)
+// so the table must have between 2^20 and 2^32 entries
+#define COMPLETE_TT_LOW_KEY_BITS    16
+#define COMPLETE_TT_KEY_LOW_BITS    32
+#define COMPLETE_TT_MIN_BITS        (COMPLETE_TT_KEY_LOW_BITS + COMPLETE_TT_GROUP_SHIFT - COMPLETE_TT_LOW_KEY_BITS)
+#define COMPLETE_TT_MAX_INDEX_BITS  COMPLETE_TT_KEY_LOW_BITS
+
+// perft values that don't fit in the remaining 48 bits are kept in a small overflow table
+// (they only occur close to the root of huge perfts). The entry in the main table then has this perft value.
+#define COMPLETE_TT_PERFT_OVERFLOW  (GET_TT_SIZE_FROM_BITS(64 - COMPLETE_TT_LOW_KEY_BITS) - 1)
+#define COMPLETE_TT_OVERFLOW_BITS   16
+#define COMPLETE_TT_OVERFLOW_PROBES 64
+CT_ASSERT(COMPLETE_TT_PLAN_MIN_BITS >= COMPLETE_TT_MIN_BITS && TT_PLAN_MAX_BITS <= COMPLETE_TT_MAX_INDEX_BITS);
+
+// no. of groups moved to the new table by each probe/store when the table is being resized
+#define COMPLETE_TT_MIGRATE_GROUPS  4
+
+// no. of locks protecting the complete TT - each one guards the groups with the same low index bits
+// (in both the old and new tables during a resize, as the table never has less groups than stripes)
+// (worker threads, network receiver and TT server only contend when they hit the same stripe)
+#define COMPLETE_TT_LOCK_STRIPES 4096
+
+// launcher routines
+
 
-// 1 billion entries for the main hash table part
-#define COMPLETE_TT_BITS 30
-//#define COMPLETE_TT_BITS 27
+double gpuTime = 0.0;
+std::mutex timerCS;
 
-// 128 million entries (for each chunk of chained part)
-#define COMPLETE_HASH_CHAIN_ALLOC_SIZE 128*1024*1024
 
-#elif 0
-// settings for 8 GB card (GTX 1080) + just 4 GB sysmem
-const uint32 ttBits[] = { 0,       23,    25,     26,     26,     26,     26,     27,     26,      0,      0,      0,      0,      0,      0,      0 };
-const bool   sysmem[] = { true, false, false,  false,  false,  false,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true };
-const int  sharedHashBits = 26;
+CompactHashEntry *completeTT = NULL;
+volatile uint64 completeTTSize = 0;         // in bytes
+volatile int completeTTBits = 0;            // log2 of no. of entries
 
-// 16 million entries for the main hash table part
-#define COMPLETE_TT_BITS 24
+// during a resize: the previous table, its entries are being moved to completeTT (NULL otherwise)
+CompactHashEntry *completeTTOld = NULL;
+volatile int completeTTOldBits = 0;
 
-// 128 million entries (for chained part)
-#define COMPLETE_HASH_CHAIN_ALLOC_SIZE 128*1024*1024
+int numGPUs = 0;
 
-#elif 0
-// settings for home PC (GTX 970: 4 GB card + 8 GB sysmem)
-const uint32 ttBits[] = {0,       20,    25,     26,     26,     25,     26,     25,     25,      0,      0,      0,      0,      0,      0,      0};
-const bool   sysmem[] = {true, false, false,  false,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true};
-const int  sharedHashBits = 25;
 
-// 16 million entries for the main hash table part
-#define COMPLETE_TT_BITS 24
+// allocation of big host side tables
+// the tables are probed at random, so huge pages save most of the TLB misses
+// the clearing (which also faults the pages in) is split among all cores
 
-// 128 million entries (for chained part)
-#define COMPLETE_HASH_CHAIN_ALLOC_SIZE 128*1024*1024
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024ull)
 
-#else
-// settings for laptop (2 GB card + 16 GB sysmem)
-const uint32 ttBits[] = {0,       22,     25,     27,     27,     26,     25,      0,      0,      0,      0,      0,      0,      0,      0,      0};
-const bool   sysmem[] = {true, false,  false,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true,   true};
-const int  sharedHashBits = 20;
+// the size of the allocation is kept just before the table (keeps the table 128 byte aligned)
+#define HOST_TABLE_HEADER 128
+
+void clearHostTable(void *mem, uint64 size)
+{
+    int nThreads = std::min((int) std::thread::hardware_concurrency(), HOST_TABLE_MAX_CLEAR_THREADS);
+    if (nThreads < 1 || size < HOST_TABLE_PARALLEL_CLEAR_MIN)
+    {
+        memset(mem, 0, size);
+        return;
+    }
+
+    uint64 chunk = ((size / nThreads) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    std::thread threads[HOST_TABLE_MAX_CLEAR_THREADS];
+    for (int i = 0; i < nThreads; i++)
+    {
+        uint64 start = std::min(i * chunk, size);
+        uint64 end   = std::min(start + chunk, size);
+        threads[i] = std::thread([mem, start, end]() { memset((uint8 *) mem + start, 0, end - start); });
+    }
+
+    for (int i = 0; i < nThreads; i++)
+    {
+        threads[i].join();
+    }
+}
+
+#if HOST_TABLE_NUMA_INTERLEAVE == 1 && !defined(_WIN32)
+// spreads the pages of the mapping over all the online NUMA nodes (nothing to do on single node systems)
+void interleaveHostTable(void *mem, uint64 size)
+{
+    const int maxNodes = 1024;
+    unsigned long nodeMask[maxNodes / (8 * sizeof(unsigned long))] = {};
+    int nNodes = 0;
+
+    // list of node ranges, e.g: "0-1" or "0,2-3"
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if (!fp)
+        return;
+
+    int first, last, c;
+    while (fscanf(fp, "%d", &first) == 1)
+    {
+        last = first;
+        c = fgetc(fp);
+        if (c == '-')
+        {
+            if (fscanf(fp, "%d", &last) != 1)
+                break;
+            c = fgetc(fp);
+        }
 
-// 16 million entries for the main hash table part
-#define COMPLETE_TT_BITS 24
+        for (int n = first; n <= last && n < maxNodes; n++)
+        {
+            nodeMask[n / (8 * sizeof(unsigned long))] |= 1ul << (n % (8 * sizeof(unsigned long)));
+            nNodes++;
+        }
 
-// 128 million entries (for chained part)
-#define COMPLETE_HASH_CHAIN_ALLOC_SIZE 128*1024*1024
+        if (c != ',')
+            break;
+    }
+    fclose(fp);
 
+    if (nNodes > 1)
+    {
+        syscall(SYS_mbind, mem, size, MPOL_INTERLEAVE, nodeMask, maxNodes, 0);
+    }
+}
 #endif
-const bool sharedsysmem = true;
 
+// returns zeroed memory, NULL on failure
+void *allocHostTable(uint64 size)
+{
+    uint8 *mem = NULL;
+    uint64 allocSize = size + HOST_TABLE_HEADER;
 
-#define COMPLETE_TT_INDEX_BITS GET_TT_INDEX_BITS(COMPLETE_TT_BITS)
+#ifdef _WIN32
+    mem = (uint8 *) _aligned_malloc(allocSize, HOST_TABLE_HEADER);
+    if (!mem)
+        return NULL;
+#else
+    allocSize = (allocSize + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    void *map = MAP_FAILED;
 
-// launcher routines
+#if HOST_TABLE_HUGE_PAGES == 2
+    map = mmap(NULL, allocSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
 
+    if (map == MAP_FAILED)
+    {
+        // transparent huge pages are only used for 2 MB aligned ranges:
+        // map a bit more and trim the unaligned head and tail
+        uint64 mapSize = allocSize + HUGE_PAGE_SIZE;
+        map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+            return NULL;
+
+        uint8 *aligned = (uint8 *) (((uint64) map + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+        uint64 head = aligned - (uint8 *) map;
+        if (head)
+            munmap(map, head);
+        if (mapSize - head > allocSize)
+            munmap(aligned + allocSize, mapSize - head - allocSize);
+        map = aligned;
+
+#if HOST_TABLE_HUGE_PAGES >= 1
+        madvise(map, allocSize, MADV_HUGEPAGE);
+#endif
+    }
+    mem = (uint8 *) map;
 
-double gpuTime = 0.0;
-std::mutex timerCS;
+#if HOST_TABLE_NUMA_INTERLEAVE == 1
+    interleaveHostTable(mem, allocSize);
+#endif
+#endif
 
+    // fresh mappings are zero already, but clearing them in parallel is what faults in the pages
+    clearHostTable(mem, allocSize);
+    *((uint64 *) mem) = allocSize;
 
-CompleteHashEntry *completeTT = NULL;
-CompleteHashEntry *chainMemory = NULL;
-volatile uint64 chainIndex = 0;
-volatile uint64 completeTTSize = 0;
-volatile uint64 chainMemorySize = 0;
+    return mem + HOST_TABLE_HEADER;
+}
 
-int numGPUs = 0;
+void freeHostTable(void *table)
+{
+    if (!table)
+        return;
+
+    uint8 *mem = (uint8 *) table - HOST_TABLE_HEADER;
+#ifdef _WIN32
+    _aligned_free(mem);
+#else
+    munmap(mem, *((uint64 *) mem));
+#endif
+}
 
 #if USE_TRANSPOSITION_TABLE == 1
 
@@ -177,6 +376,7 @@ void allocAndClearMem(void **devPointer, void **hostPointer, size_t size, bool s
 
     cudaError_t res;
     void *temp = NULL;
+    bool cleared = false;   // allocHostTable() returns cleared memory
     *devPointer = NULL;
 
     if (sysmem)
@@ -190,7 +390,8 @@ void allocAndClearMem(void **devPointer, void **hostPointer, size_t size, bool s
             else
             {
                 // plain system memory
-                temp = malloc(size);
+                temp = allocHostTable(size);
+                cleared = true;
                 if (!temp)
                 {
                     printf("\nFailed allocating pure sysmem for transposition table!\n");
@@ -208,7 +409,13 @@ void allocAndClearMem(void **devPointer, void **hostPointer, size_t size, bool s
             }
             else
             {
+#if CPU_ONLY_BUILD == 1
+                temp = allocHostTable(size);
+                res = temp ? cudaSuccess : cudaErrorMemoryAllocation;
+                cleared = true;
+#else
                 res = cudaHostAlloc(&temp, size, cudaHostAllocMapped | /*cudaHostAllocWriteCombined |*/ cudaHostAllocPortable);
+#endif
                 if (res != cudaSuccess)
                 {
                     printf("\nFailed to allocate sysmem transposition table for depth %d of %llu bytes, with error: %s\n", depth, size, cudaGetErrorString(res));
@@ -226,7 +433,14 @@ void allocAndClearMem(void **devPointer, void **hostPointer, size_t size, bool s
     }
     else
     {
+#if CPU_ONLY_BUILD == 1
+        // (private table of a worker thread)
+        *devPointer = allocHostTable(size);
+        res = *devPointer ? cudaSuccess : cudaErrorMemoryAllocation;
+        cleared = true;
+#else
         res = cudaMalloc(devPointer, size);
+#endif
         if (res != cudaSuccess)
         {
             printf("\nFailed to allocate GPU transposition table of %llu bytes, with error: %s\n", size, cudaGetErrorString(res));
@@ -234,9 +448,14 @@ void allocAndClearMem(void **devPointer, void **hostPointer, size_t size, bool s
         }
     }
     *hostPointer = temp;
-    if (devPointer)
+    if (cleared)
+    {
+        return;
+    }
+
+    if (*devPointer)
     {
-        hugeMemset(devPointer, size);
+        hugeMemset(*devPointer, size);
     }
     else
     {
@@ -245,51 +464,16 @@ void allocAndClearMem(void **devPointer, void **hostPointer, size_t size, bool s
     }
 }
 
-CompleteHashEntry *chainMemoryChunks[1024];
-volatile int nChunks = 0;
-void allocChainMemoryChunk()
-{
-    chainMemorySize = COMPLETE_HASH_CHAIN_ALLOC_SIZE * sizeof(CompleteHashEntry);
-    chainMemory = (CompleteHashEntry *)malloc(chainMemorySize);
-    if (!chainMemory)
-    {
-            printf("\nFailed allocating chainMemory chunk %d!\n", nChunks);
-            exit(0);
-    }
-    memset(chainMemory, 0, chainMemorySize);
-    chainMemoryChunks[nChunks++] = chainMemory;
-    chainIndex = 0;    
-}
-
-void allocCompleteTT()
+// frees a table allocated by allocAndClearMem() with cudaHostAlloc or cudaMalloc
+void freeTableMemory(void *devPointer)
 {
-#if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 1
-    if (completeTT == NULL)
-    {
-        completeTTSize = GET_TT_SIZE_FROM_BITS(COMPLETE_TT_BITS) * sizeof(CompleteHashEntry);
-        completeTT = (CompleteHashEntry *)malloc(completeTTSize);
-        if (!completeTT)
-        {
-                printf("\nFailed allocating completeTT!\n");
-                exit(0);
-        }
-        memset(completeTT, 0, completeTTSize);
-
-        memset(chainMemoryChunks, 0, sizeof(chainMemoryChunks));
-        allocChainMemoryChunk();
-    }
+#if CPU_ONLY_BUILD == 1
+    freeHostTable(devPointer);
+#else
+    cudaFree(devPointer);
 #endif
 }
 
-void freeCompleteTT()
-{
-    if (completeTT)
-        free(completeTT);
-
-    for (int i=0;i<nChunks;i++)
-        free(chainMemoryChunks[i]);
-}
-
 void setupHashTables128b(TTInfo128b &tt)
 {
     // allocate the shared hash table
@@ -333,7 +517,7 @@ void freeHashTables()
                 if (!sharedDeleted)
                 {
                     // delete the shared sysmem hash table
-                    free(TransTables128b[g].cpuTable[i]);
+                    freeHostTable(TransTables128b[g].cpuTable[i]);
                     sharedDeleted = true;
                 }
             }
@@ -344,17 +528,17 @@ void freeHashTables()
                     if (i >= GPU_LAUNCH_DEPTH)
                     {
                         if (TransTables128b[g].cpuTable[i])
-                            free(TransTables128b[g].cpuTable[i]);
+                            freeHostTable(TransTables128b[g].cpuTable[i]);
                     }
                     else
                     {
-                        cudaFree(TransTables128b[g].hashTable[i]);
+                        freeTableMemory(TransTables128b[g].hashTable[i]);
                     }
                 }
             }
             else
             {
-                cudaFree(TransTables128b[g].hashTable[i]);
+                freeTableMemory(TransTables128b[g].hashTable[i]);
             }
         }
     }
@@ -362,6 +546,321 @@ void freeHashTables()
     memset(TransTables128b, 0, sizeof(TransTables128b));
 }
 
+// transposition table memory planner
+//
+// Model: in a perft(n), the table for depth d gets probed by the ~perft(n-d) positions at ply n-d, out of which
+// only unique(n-d) are distinct. A table of s entries is assumed to catch min(1, s / unique(n-d)) of the repeated
+// probes and each hit saves the ~perft(d-1) move generator calls of the subtree. Memory is given out greedily:
+// the table that saves the most work per extra byte is doubled until the budget runs out (or bigger tables stop helping).
+// The counts are those of the start position (extrapolated beyond the known values), good enough for sizing.
+
+static const double startPosPerft[]  = { 1, 20, 400, 8902, 197281, 4865609, 119060324, 3195901860.0, 84998978956.0,
+                                         2439530234167.0, 69352859712417.0, 2097651003696806.0, 62854969236701747.0,
+                                         1981066775000396239.0 };
+
+// no. of distinct positions at each ply
+static const double startPosUnique[] = { 1, 20, 400, 5362, 72078, 822518, 9417681, 96400068, 988187354.0,
+                                         9183421888.0, 85375278064.0, 726155461002.0 };
+
+double estimatePositionCount(const double *counts, int known, int ply)
+{
+    if (ply < known)
+        return counts[ply];
+
+    // extrapolate using the growth rate of the last known ply
+    return counts[known - 1] * pow(counts[known - 1] / counts[known - 2], ply - known + 1);
+}
+
+// work saved in a perft(n) by a table of 'entries' entries holding the positions of depths minDepth...maxDepth
+double ttPlanBenefit(int n, int minDepth, int maxDepth, double entries)
+{
+    const int knownPerfts = sizeof(startPosPerft) / sizeof(startPosPerft[0]);
+    const int knownUnique = sizeof(startPosUnique) / sizeof(startPosUnique[0]);
+
+    double unique = 0, saved = 0;
+    for (int d = minDepth; d <= maxDepth && d < n; d++)
+    {
+        double u = estimatePositionCount(startPosUnique, knownUnique, n - d);
+        unique += u;
+        saved  += (estimatePositionCount(startPosPerft, knownPerfts, n - d) - u) * estimatePositionCount(startPosPerft, knownPerfts, d - 1);
+    }
+
+    if (unique == 0)
+        return 0;
+
+    return saved * std::min(1.0, entries / unique);
+}
+
+struct TTPlanTable
+{
+    int    minDepth, maxDepth;  // depths of the positions held by the table
+    int    bits;
+    uint64 entrySize;
+    int    copies;              // no. of private copies (e.g, one per CPU worker)
+    bool   inSysmem;
+    bool   canMoveToSysmem;     // video memory table that can be moved to sysmem when it doesn't fit
+    bool   growing;             // complete TT: also needs room for the older table while growing
+
+    uint64 memory(int b)
+    {
+        uint64 size = GET_TT_SIZE_FROM_BITS(b) * entrySize;
+        if (growing && b > COMPLETE_TT_PLAN_MIN_BITS)
+            size += size / 2;
+        return size * copies;
+    }
+};
+
+uint64 getAvailableSystemMemory()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    GlobalMemoryStatusEx(&status);
+    return status.ullAvailPhys;
+#else
+    // MemAvailable also counts the page cache that the kernel can drop
+    FILE *fp = fopen("/proc/meminfo", "r");
+    if (fp)
+    {
+        char line[256];
+        unsigned long long kb = 0;
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1)
+            {
+                fclose(fp);
+                return kb * 1024;
+            }
+        }
+        fclose(fp);
+    }
+    return (uint64) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// decide the sizes of the transposition tables for perfts up to maxDepth (fills ttBits[], sysmem[], sharedHashBits
+// and the complete TT sizes). budgetMB is the sysmem to use for the tables (0: most of the available memory)
+// needs to be called after initGPU() so that the video memory used by the preallocated buffers is accounted for
+void planTTMemory(int maxDepth, uint64 budgetMB)
+{
+    const uint64 MB = 1024 * 1024ull;
+
+    uint64 sysBudget;
+    if (budgetMB)
+    {
+        sysBudget = budgetMB * MB;
+    }
+    else
+    {
+        sysBudget = getAvailableSystemMemory() / 100 * TT_PLAN_SYSMEM_PERCENT;
+#if CPU_ONLY_BUILD == 1
+        // the preallocated buffers of the worker threads are in sysmem too (and mostly not touched yet)
+        uint64 buffers = numGPUs * PREALLOCATED_MEMORY_SIZE;
+        sysBudget = sysBudget > buffers ? sysBudget - buffers : 0;
+#endif
+    }
+
+    // every GPU gets its own copy of the video memory tables
+    uint64 devBudget = 0;
+#if CPU_ONLY_BUILD == 0
+    for (int g = 0; g < numGPUs; g++)
+    {
+        size_t free = 0, total = 0;
+        cudaSetDevice(g);
+        cudaMemGetInfo(&free, &total);
+        free = free > TT_PLAN_DEVICE_RESERVE ? free - TT_PLAN_DEVICE_RESERVE : 0;
+        if (g == 0 || free < devBudget)
+            devBudget = free;
+    }
+    cudaSetDevice(0);
+#endif
+
+    TTPlanTable tables[MAX_PERFT_DEPTH + 1];
+    int tableDepth[MAX_PERFT_DEPTH + 1];    // depth (index in ttBits[]) of each table, -1 for the complete TT
+    int nTables = 0;
+
+    for (int d = 1; d < MAX_PERFT_DEPTH; d++)
+    {
+        // levels above GPU_LAUNCH_DEPTH are handled by the launcher using the complete TT
+        bool ownTable = d < GPU_LAUNCH_DEPTH;
+#if USE_COMPLETE_HASH_ALL_LEVELS == 0
+        ownTable = ownTable || (d > GPU_LAUNCH_DEPTH && d < maxDepth);
+#endif
+#if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 0
+        ownTable = ownTable || (d == GPU_LAUNCH_DEPTH && d < maxDepth);
+#endif
+        if (!ownTable)
+            continue;
+
+        TTPlanTable &t = tables[nTables];
+        t.minDepth = t.maxDepth = d;
+        t.bits = TT_PLAN_MIN_BITS;
+        if (shallow[d])
+            t.bits = std::max(t.bits, d * TT_PLAN_PERFT_BITS_PER_PLY);
+        t.entrySize = shallow[d] ? sizeof(HashKey128b) : sizeof(HashEntryPerft128b);
+        t.growing = false;
+#if CPU_ONLY_BUILD == 1
+        // depth 1 table (used for finding duplicates in BFS) has to be private to each worker thread
+        t.inSysmem = true;
+        t.copies = d == 1 ? std::max(numGPUs, 1) : 1;
+        t.canMoveToSysmem = false;
+#else
+        // the levels below launch depth are searched on GPU: prefer video memory
+        t.inSysmem = d >= GPU_LAUNCH_DEPTH;
+        t.copies = 1;
+        t.canMoveToSysmem = d != 1;
+#endif
+        tableDepth[nTables++] = d;
+    }
+
+#if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 1
+    {
+        TTPlanTable &t = tables[nTables];
+        t.minDepth = GPU_LAUNCH_DEPTH;
+        t.maxDepth = USE_COMPLETE_HASH_ALL_LEVELS ? maxDepth : GPU_LAUNCH_DEPTH;
+        t.bits = COMPLETE_TT_PLAN_MIN_BITS;
+        t.entrySize = sizeof(CompactHashEntry);
+        t.copies = 1;
+        t.inSysmem = true;
+        t.canMoveToSysmem = false;
+        t.growing = true;
+        tableDepth[nTables++] = -1;
+    }
+#endif
+
+    // the minimum sizes (and the shared table) are always allocated
+    sharedHashBits = TT_PLAN_MIN_BITS;
+    uint64 sysUsed = GET_TT_SIZE_FROM_BITS(sharedHashBits) * sizeof(HashEntryPerft128b);
+    uint64 devUsed = 0;
+    for (int i = 0; i < nTables; i++)
+    {
+        if (tables[i].inSysmem)
+            sysUsed += tables[i].memory(tables[i].bits);
+        else
+            devUsed += tables[i].memory(tables[i].bits);
+    }
+
+    if (devUsed > devBudget)
+    {
+        // move everything that can go to sysmem
+        for (int i = 0; i < nTables; i++)
+        {
+            if (!tables[i].inSysmem && tables[i].canMoveToSysmem)
+            {
+                devUsed -= tables[i].memory(tables[i].bits);
+                sysUsed += tables[i].memory(tables[i].bits);
+                tables[i].inSysmem = true;
+            }
+        }
+    }
+
+    if (sysUsed > sysBudget || devUsed > devBudget)
+    {
+        printf("\nWarning: not enough memory for even the smallest transposition tables (sysmem: %llu MB, video memory: %llu MB needed)\n",
+               sysUsed / MB, devUsed / MB);
+    }
+
+    // greedily double the table with the best work saved per extra byte
+    while (true)
+    {
+        int best = -1;
+        bool bestMoves = false;
+        double bestValue = 0;
+        for (int i = 0; i < nTables; i++)
+        {
+            TTPlanTable &t = tables[i];
+            if (t.bits >= TT_PLAN_MAX_BITS)
+                continue;
+
+            double gain = ttPlanBenefit(maxDepth, t.minDepth, t.maxDepth, (double) GET_TT_SIZE_FROM_BITS(t.bits + 1)) -
+                          ttPlanBenefit(maxDepth, t.minDepth, t.maxDepth, (double) GET_TT_SIZE_FROM_BITS(t.bits));
+            if (gain <= 0)
+                continue;
+
+            uint64 extra = t.memory(t.bits + 1) - t.memory(t.bits);
+            bool moves = false;
+            bool fits = t.inSysmem ? (sysUsed + extra <= sysBudget) : (devUsed + extra <= devBudget);
+            if (!fits && !t.inSysmem && t.canMoveToSysmem)
+            {
+                // doesn't fit in video memory anymore, but the whole table may fit in sysmem
+                extra = t.memory(t.bits + 1);
+                fits = sysUsed + extra <= sysBudget;
+                moves = true;
+            }
+
+            if (fits && gain / extra > bestValue)
+            {
+                best = i;
+                bestMoves = moves;
+                bestValue = gain / extra;
+            }
+        }
+
+        if (best == -1)
+            break;
+
+        TTPlanTable &t = tables[best];
+        if (bestMoves)
+        {
+            devUsed -= t.memory(t.bits);
+            sysUsed += t.memory(t.bits + 1);
+            t.inSysmem = true;
+        }
+        else if (t.inSysmem)
+        {
+            sysUsed += t.memory(t.bits + 1) - t.memory(t.bits);
+        }
+        else
+        {
+            devUsed += t.memory(t.bits + 1) - t.memory(t.bits);
+        }
+        t.bits++;
+    }
+
+    for (int d = 0; d < MAX_PERFT_DEPTH; d++)
+    {
+        ttBits[d] = 0;
+        sysmem[d] = true;
+    }
+
+    printf("\nTransposition tables for perft(%d), sysmem budget: %llu MB", maxDepth, sysBudget / MB);
+#if CPU_ONLY_BUILD == 0
+    printf(", video memory budget: %llu MB per GPU", devBudget / MB);
+#endif
+    printf("\n");
+
+    for (int i = 0; i < nTables; i++)
+    {
+        TTPlanTable &t = tables[i];
+        if (tableDepth[i] == -1)
+        {
+            completeTTMaxBits = t.bits;
+            completeTTStartBits = std::max(COMPLETE_TT_PLAN_MIN_BITS, t.bits - COMPLETE_TT_PLAN_GROW_STEPS);
+            printf("  complete TT: %2d bits (%llu MB), growing up to %d bits (%llu MB)\n",
+                   completeTTStartBits, GET_TT_SIZE_FROM_BITS(completeTTStartBits) * t.entrySize / MB,
+                   completeTTMaxBits, GET_TT_SIZE_FROM_BITS(completeTTMaxBits) * t.entrySize / MB);
+        }
+        else
+        {
+            int d = tableDepth[i];
+            ttBits[d] = t.bits;
+            sysmem[d] = t.inSysmem;
+#if CPU_ONLY_BUILD == 1
+            // private tables are allocated separately for each worker thread
+            sysmem[d] = t.copies == 1;
+#endif
+            printf("  depth %2d: %2d bits (%llu MB) in %s%s\n", d, t.bits, GET_TT_SIZE_FROM_BITS(t.bits) * t.entrySize / MB,
+                   t.inSysmem ? "sysmem" : "video memory", t.copies > 1 ? ", one per worker thread" : "");
+        }
+    }
+    printf("  shared table: %d bits (%llu MB) in sysmem\n", sharedHashBits, GET_TT_SIZE_FROM_BITS(sharedHashBits) * sizeof(HashEntryPerft128b) / MB);
+    printf("  total: %llu MB sysmem", sysUsed / MB);
+#if CPU_ONLY_BUILD == 0
+    printf(", %llu MB video memory per GPU", devUsed / MB);
+#endif
+    printf("\n");
+}
+
 // quick and dirty move-list sorting routine
 // only purpose is to get all quiet moves at the start and hope for better hash table usage
 void sortMoves(CMove *moves, int nMoves)
@@ -404,7 +903,53 @@ void randomizeMoves(CMove *moves, int nMoves)
     }
 }
 
-InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *dispPrefix);
+// same as sortMoves() and randomizeMoves() - for a MoveSet
+// the moves aren't moved around, order gets the indices of the moves in the order they should be explored
+void sortMoveSet(MoveSet *moveSet, uint8 *order)
+{
+    int nq = 0;
+    CMove move;
+
+    MoveSet::Iterator it(moveSet);
+    while (it.next(&move))
+    {
+        if (move.getFlags() == CM_FLAG_QUIET_MOVE)
+            nq++;
+    }
+
+    int i = 0, s = 0, u = 0;
+    MoveSet::Iterator it2(moveSet);
+    while (it2.next(&move))
+    {
+        if (move.getFlags() == CM_FLAG_QUIET_MOVE)
+        {
+            order[s++] = i;
+        }
+        else
+        {
+            order[nq + (u++)] = i;
+        }
+        i++;
+    }
+}
+
+void randomizeMoveSet(MoveSet *moveSet, uint8 *order)
+{
+    int nMoves = moveSet->count();
+    for (int i = 0; i < nMoves; i++)
+        order[i] = i;
+
+    for (int i = 0; i < nMoves; i++)
+    {
+        int j = std::rand() % nMoves;
+        uint8 other = order[j];
+        order[j] = order[i];
+        order[i] = other;
+    }
+}
+
+// probedKeys: keys of the position (see computeHostKeys()), when the caller already looked it up in the hash table (and disk hash) and missed
+InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *dispPrefix, const SymmetricKeys128b *probedKeys = NULL);
 
 thread_local int activeGpu = 0;
 
@@ -418,7 +963,24 @@ enum eThreadStatus
 };
 
 // 2 way communication between main thread and worker threads
+// (changed with setThreadStatus(), both sides block on threadStatusCV instead of spinning: on the host only build
+// there is a worker for every core, a spinning main thread would take one of them)
 volatile eThreadStatus threadStatus[MAX_GPUs];
+std::mutex threadStatusCS;
+std::condition_variable threadStatusCV;
+
+void setThreadStatus(int t, eThreadStatus status)
+{
+    std::lock_guard<std::mutex> lock(threadStatusCS);
+    threadStatus[t] = status;
+    threadStatusCV.notify_all();
+}
+
+void waitForThreadStatus(int t, eThreadStatus status)
+{
+    std::unique_lock<std::mutex> lock(threadStatusCS);
+    threadStatusCV.wait(lock, [t, status] { return threadStatus[t] == status; });
+}
 
 // main thread -> worker threads
 volatile HexaBitBoardPosition *posForThread[MAX_GPUs];
@@ -429,27 +991,42 @@ volatile char *dispStringForThread[MAX_GPUs];
 volatile InfInt *perftForThread[MAX_GPUs];
 
 std::mutex criticalSection;
-std::mutex diskCS;
+
+// locks for the complete TT (see COMPLETE_TT_LOCK_STRIPES)
+// on separate cache lines so that threads working on different stripes don't slow each other down
+struct alignas(64) CompleteTTLock
+{
+    std::mutex cs;
+};
+CompleteTTLock completeTTLocks[COMPLETE_TT_LOCK_STRIPES];
+
+std::mutex &completeTTLock(HashKey128b hash)
+{
+    return completeTTLocks[(hash.lowPart / COMPLETE_TT_GROUP_SIZE) & (COMPLETE_TT_LOCK_STRIPES - 1)].cs;
+}
 
 void worker_thread_start(uint32 depth, uint32 gpuId)
 {
     cudaSetDevice(gpuId);
     activeGpu = gpuId;
 
-    threadStatus[gpuId] = THREAD_IDLE;
+    setThreadStatus(gpuId, THREAD_IDLE);
 
     // wait for work
     while (1)
     {
-        if (threadStatus[gpuId] == THREAD_TERMINATE_REQUEST)
+        eThreadStatus status;
         {
-            break;
+            std::unique_lock<std::mutex> lock(threadStatusCS);
+            threadStatusCV.wait(lock, [gpuId] { return threadStatus[gpuId] != THREAD_IDLE; });
+            status = threadStatus[gpuId];
         }
-        else if (threadStatus[gpuId] == THREAD_IDLE)
+
+        if (status == THREAD_TERMINATE_REQUEST)
         {
-            continue;
+            break;
         }
-        else if (threadStatus[gpuId] == WORK_SUBMITTED)
+        else if (status == WORK_SUBMITTED)
         {
             InfInt perftVal = perft_bb_cpu_launcher((HexaBitBoardPosition *)posForThread[gpuId], depth, (char*)dispStringForThread[gpuId]);
 
@@ -464,30 +1041,31 @@ void worker_thread_start(uint32 depth, uint32 gpuId)
             }
 
             *((InfInt *)perftForThread[gpuId]) = perftVal;
-            threadStatus[gpuId] = THREAD_IDLE;
+            setThreadStatus(gpuId, THREAD_IDLE);
         }
     }
 
-    threadStatus[gpuId] = THREAD_TERMINATED;
+    setThreadStatus(gpuId, THREAD_TERMINATED);
 }
 
 // launch work on multiple threads (each associated with a single GPU), 
 // wait for enough parallel work is done, and only then wait for the threads to finish
 InfInt perft_multi_threaded_gpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *dispPrefix)
 {
-    CMove genMoves[MAX_MOVES];
-    HexaBitBoardPosition childPos;
+    MoveSet moveSet;
+    uint8 order[MAX_MOVES];
     HexaBitBoardPosition childBoards[MAX_MOVES];
     char childStrings[MAX_MOVES][128];
     InfInt perftResults[MAX_MOVES];
 
-    int nMoves = generateMoves(pos, pos->chance, genMoves);
+    generateMoveSet(pos, &moveSet);
+    int nMoves = moveSet.count();
 
 // doesn't help :-/
 //#if ENABLE_DISK_HASH == 1
-//    randomizeMoves(genMoves, nMoves);
+//    randomizeMoveSet(&moveSet, order);
 //#else    
-    sortMoves(genMoves, nMoves);
+    sortMoveSet(&moveSet, order);
 //#endif    
 
     std::thread threads[MAX_GPUs];
@@ -499,44 +1077,40 @@ InfInt perft_multi_threaded_gpu_launcher(HexaBitBoardPosition *pos, uint32 depth
         threads[i] = std::thread(worker_thread_start, depth - 1, i);
 
         // wait for the thread to get initialized
-        while (threadStatus[i] != THREAD_IDLE);
+        waitForThreadStatus(i, THREAD_IDLE);
     }
 
     for (int i = 0; i < nMoves; i++)
     {
 
+        CMove move = moveSet.getMove(order[i]);
+
         char moveString[10];
-        Utils::getCompactMoveString(genMoves[i], moveString);
+        Utils::getCompactMoveString(move, moveString);
         strcpy(childStrings[i], dispPrefix);
         strcat(childStrings[i], moveString);
 
-        childPos = *pos;
-        uint64 fakeHash = 0;
-
-        if (pos->chance == WHITE)
-            MoveGeneratorBitboard::makeMove<WHITE, false>(&childPos, fakeHash, genMoves[i]);
-        else
-            MoveGeneratorBitboard::makeMove<BLACK, false>(&childPos, fakeHash, genMoves[i]);
-
-        childBoards[i] = childPos;
+        makeChildBoard(&childBoards[i], pos, move);
 
         // find an idle worker thread to submit work
         int chosenThread = -1;
-        while (chosenThread == -1)
-        {
+        std::unique_lock<std::mutex> lock(threadStatusCS);
+        threadStatusCV.wait(lock, [&chosenThread] {
             for (int t = 0; t < numGPUs; t++)
                 if (threadStatus[t] == THREAD_IDLE)
                 {
                     chosenThread = t;
-                    break;
+                    return true;
                 }
-        }
+            return false;
+        });
 
         // submit work on the worker thread
         posForThread[chosenThread] = &childBoards[i];
         dispStringForThread[chosenThread] = childStrings[i];
         perftForThread[chosenThread] = &perftResults[i];
         threadStatus[chosenThread] = WORK_SUBMITTED;
+        threadStatusCV.notify_all();
     }
 
     // Ankan - TODO: if there is any thread idle, give it same position as some other active thread
@@ -544,6 +1118,7 @@ InfInt perft_multi_threaded_gpu_launcher(HexaBitBoardPosition *pos, uint32 depth
     while(1)
     {
         bool allIdle = true;
+        std::lock_guard<std::mutex> lock(threadStatusCS);
         for (int t = 0; t < numGPUs; t++)
         {
             if (threadStatus[t] == THREAD_IDLE)
@@ -560,6 +1135,7 @@ InfInt perft_multi_threaded_gpu_launcher(HexaBitBoardPosition *pos, uint32 depth
                 }
             }
         }
+        threadStatusCV.notify_all();
         if(allIdle)
         break;
     }
@@ -567,228 +1143,982 @@ InfInt perft_multi_threaded_gpu_launcher(HexaBitBoardPosition *pos, uint32 depth
     // wait for all threads to terminate
     for (int t = 0; t < numGPUs; t++)
     {
-        while (threadStatus[t] != THREAD_IDLE);
-        threadStatus[t] = THREAD_TERMINATE_REQUEST;
-        while (threadStatus[t] != THREAD_TERMINATED);
+        waitForThreadStatus(t, THREAD_IDLE);
+        setThreadStatus(t, THREAD_TERMINATE_REQUEST);
+        waitForThreadStatus(t, THREAD_TERMINATED);
         threads[t].join();
     }
-    
+    
+
+    InfInt count = 0;
+    for (int i = 0; i < nMoves; i++)
+    {
+        count += perftResults[i];
+    }
+    return count;
+}
+
+// resize state of the complete TT
+// the counter of groups to move has the resize no. in the top bits - so that a thread that is late
+// in picking up a group of a resize that already finished doesn't touch the next one
+#define COMPLETE_TT_RESIZE_SHIFT 40
+std::atomic<uint64> completeTTMigrateNext(0);   // next group to move
+std::atomic<uint64> completeTTMigrateDone(0);   // no. of groups moved
+volatile uint64 completeTTResizeCount = 0;
+std::mutex completeTTGrowCS;
+volatile bool completeTTGrowFailed = false;
+
+// snapshots of the complete TT (see completeTTWriteSnapshot())
+// the table is split in this many regions, a region is marked dirty when an entry in it changes
+#define COMPLETE_TT_SNAPSHOT_REGIONS  (1024 * 1024)
+volatile bool completeTTSnapshotsEnabled = false;
+volatile uint8 completeTTDirty[COMPLETE_TT_SNAPSHOT_REGIONS];
+
+uint64 completeTTGroupsPerRegion(int bits)
+{
+    uint64 numGroups = GET_TT_SIZE_FROM_BITS(bits) / COMPLETE_TT_GROUP_SIZE;
+    return std::max(numGroups / COMPLETE_TT_SNAPSHOT_REGIONS, 1ull);
+}
+
+// (caller holds the lock of the group)
+void completeTTMarkDirty(CompactHashEntry *table, int bits, CompactHashEntry *entry)
+{
+    if (completeTTSnapshotsEnabled && table == completeTT)
+    {
+        uint64 group = (entry - table) / COMPLETE_TT_GROUP_SIZE;
+        completeTTDirty[group / completeTTGroupsPerRegion(bits)] = 1;
+    }
+}
+
+// for when the whole table got overwritten (e.g, received over network)
+void completeTTMarkAllDirty()
+{
+    if (completeTTSnapshotsEnabled)
+        memset((void *) completeTTDirty, 1, sizeof(completeTTDirty));
+}
+
+// table memory (buckets aligned to their size)
+CompactHashEntry *allocCompleteTTMemory(uint64 size)
+{
+    return (CompactHashEntry *) allocHostTable(size);
+}
+
+void freeCompleteTTMemory(CompactHashEntry *table)
+{
+    freeHostTable(table);
+}
+
+void allocCompleteTT()
+{
+#if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 1
+    if (completeTT == NULL)
+    {
+        completeTTBits = completeTTStartBits;
+        completeTTSize = GET_TT_SIZE_FROM_BITS(completeTTStartBits) * sizeof(CompactHashEntry);
+        completeTT = allocCompleteTTMemory(completeTTSize);
+        if (!completeTT)
+        {
+                printf("\nFailed allocating completeTT!\n");
+                exit(0);
+        }
+    }
+#endif
+}
+
+void freeCompleteTT()
+{
+    if (completeTT)
+        freeCompleteTTMemory(completeTT);
+    if (completeTTOld)
+        freeCompleteTTMemory(completeTTOld);
+    completeTT = completeTTOld = NULL;
+}
+
+void lockCompleteTTStripes()
+{
+    for (int i = 0; i < COMPLETE_TT_LOCK_STRIPES; i++)
+        completeTTLocks[i].cs.lock();
+}
+
+void unlockCompleteTTStripes()
+{
+    for (int i = COMPLETE_TT_LOCK_STRIPES - 1; i >= 0; i--)
+        completeTTLocks[i].cs.unlock();
+}
+
+// first entry of the group in which the given hash belongs
+CompactHashEntry *completeTTGroup(CompactHashEntry *table, int bits, HashKey128b hash)
+{
+    return &table[hash.lowPart & GET_TT_INDEX_BITS(bits) & ~((uint64) COMPLETE_TT_GROUP_SIZE - 1)];
+}
+
+// the bits of the low part of the hash kept in the entry for a table of the given size
+uint64 completeTTLowKey(HashKey128b hash, int bits)
+{
+    uint64 low = hash.lowPart & GET_TT_INDEX_BITS(COMPLETE_TT_KEY_LOW_BITS);
+    return (low & (COMPLETE_TT_GROUP_SIZE - 1)) | ((low >> bits) << COMPLETE_TT_GROUP_SHIFT);
+}
+
+// rebuilds the hash of an entry from the entry and its group (the bits above COMPLETE_TT_KEY_LOW_BITS are lost)
+HashKey128b completeTTEntryHash(CompactHashEntry *entry, uint64 groupIndex, int bits)
+{
+    uint64 data   = entry->data;
+    uint64 lowKey = data & GET_TT_INDEX_BITS(COMPLETE_TT_LOW_KEY_BITS);
+    uint64 low    = (lowKey & (COMPLETE_TT_GROUP_SIZE - 1)) | (groupIndex << COMPLETE_TT_GROUP_SHIFT) |
+                    ((lowKey >> COMPLETE_TT_GROUP_SHIFT) << bits);
+
+    return HashKey128b(low, entry->key ^ data);
+}
+
+uint64 completeTTEntryPerft(CompactHashEntry *entry)
+{
+    return entry->data >> COMPLETE_TT_LOW_KEY_BITS;
+}
+
+// finds the entry of the given hash in the table (caller holds the lock of the group)
+// returns the entry (*found set) or the empty slot where it should go, NULL if not present and the group is full
+// (*pSlots: no. of entries looked at)
+CompactHashEntry *completeTTFindSlot(CompactHashEntry *table, int bits, HashKey128b hash, bool *found, int *pSlots = NULL)
+{
+    CompactHashEntry *group = completeTTGroup(table, bits, hash);
+    int homeBucket = (hash.lowPart / COMPLETE_TT_BUCKET_SIZE) & (COMPLETE_TT_GROUP_BUCKETS - 1);
+    uint64 lowKey = completeTTLowKey(hash, bits);
+
+    *found = false;
+    for (int b = 0; b < COMPLETE_TT_GROUP_BUCKETS; b++)
+    {
+        CompactHashEntry *bucket = &group[((homeBucket + b) & (COMPLETE_TT_GROUP_BUCKETS - 1)) * COMPLETE_TT_BUCKET_SIZE];
+        for (int i = 0; i < COMPLETE_TT_BUCKET_SIZE; i++)
+        {
+            CompactHashEntry *entry = &bucket[i];
+            uint64 data = entry->data;
+            uint64 key  = entry->key;
+            if (pSlots)
+                (*pSlots)++;
+
+            if (key == 0 && data == 0)
+            {
+                // blank record
+                return entry;
+            }
+
+            // XOR with data to extract hash part
+            if ((key ^ data) == hash.highPart && (data & GET_TT_INDEX_BITS(COMPLETE_TT_LOW_KEY_BITS)) == lowKey)
+            {
+                *found = true;
+                return entry;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// perft: the value to keep in the entry (COMPLETE_TT_PERFT_OVERFLOW for values in the overflow table)
+void completeTTWriteEntry(CompactHashEntry *entry, int bits, HashKey128b hash, uint64 perft)
+{
+    uint64 data = (perft << COMPLETE_TT_LOW_KEY_BITS) | completeTTLowKey(hash, bits);
+
+    // XOR trick to prevent random bit flip errors (and also half written entries)
+    entry->key  = hash.highPart ^ data;
+    entry->data = data;
+}
+
+// adds an entry (caller holds the lock of the group)
+// returns false if the group is full
+bool completeTTInsert(CompactHashEntry *table, int bits, HashKey128b hash, uint64 perft)
+{
+    bool found;
+    CompactHashEntry *entry = completeTTFindSlot(table, bits, hash, &found);
+    if (entry == NULL)
+        return false;
+
+    if (!found)
+    {
+        completeTTWriteEntry(entry, bits, hash, perft);
+        completeTTMarkDirty(table, bits, entry);
+    }
+
+    return true;
+}
+
+// replaces an entry of the home bucket (when the group is full and the table can't grow)
+void completeTTReplace(CompactHashEntry *table, int bits, HashKey128b hash, uint64 perft)
+{
+    CompactHashEntry *group = completeTTGroup(table, bits, hash);
+    int homeBucket = (hash.lowPart / COMPLETE_TT_BUCKET_SIZE) & (COMPLETE_TT_GROUP_BUCKETS - 1);
+    CompactHashEntry *entry = &group[homeBucket * COMPLETE_TT_BUCKET_SIZE + (hash.highPart & (COMPLETE_TT_BUCKET_SIZE - 1))];
+
+    completeTTWriteEntry(entry, bits, hash, perft);
+    completeTTMarkDirty(table, bits, entry);
+}
+
+// moves all entries of a group of the old table to the new table (caller holds the lock of the group)
+void completeTTMigrateGroup(uint64 groupIndex)
+{
+    CompactHashEntry *group = &completeTTOld[groupIndex * COMPLETE_TT_GROUP_SIZE];
+    for (int i = 0; i < COMPLETE_TT_GROUP_SIZE; i++)
+    {
+        CompactHashEntry *entry = &group[i];
+        if (entry->key == 0 && entry->data == 0)
+            continue;
+
+        HashKey128b hash = completeTTEntryHash(entry, groupIndex, completeTTOldBits);
+        uint64 perft = completeTTEntryPerft(entry);
+
+        if (!completeTTInsert(completeTT, completeTTBits, hash, perft))
+            completeTTReplace(completeTT, completeTTBits, hash, perft);
+    }
+    memset(group, 0, COMPLETE_TT_GROUP_SIZE * sizeof(CompactHashEntry));
+}
+
+// the overflow table: full hash and perft value, linear probing, one lock
+CompleteHashEntry completeTTOverflow[GET_TT_SIZE_FROM_BITS(COMPLETE_TT_OVERFLOW_BITS)];
+uint64 completeTTOverflowSize = sizeof(completeTTOverflow);     // in bytes
+std::mutex completeTTOverflowCS;
+
+// returns the slot of the hash or the empty one where it should go, NULL when there is no space nearby
+CompleteHashEntry *completeTTOverflowFindSlot(HashKey128b hash)
+{
+    for (int i = 0; i < COMPLETE_TT_OVERFLOW_PROBES; i++)
+    {
+        CompleteHashEntry *entry = &completeTTOverflow[(hash.lowPart + i) & GET_TT_INDEX_BITS(COMPLETE_TT_OVERFLOW_BITS)];
+        if (entry->hash == hash || entry->hash == HashKey128b(0, 0))
+            return entry;
+    }
+
+    return NULL;
+}
+
+bool completeTTOverflowProbe(HashKey128b hash, uint64 *pPerft)
+{
+    completeTTOverflowCS.lock();
+    CompleteHashEntry *entry = completeTTOverflowFindSlot(hash);
+    bool found = entry && entry->hash == hash;
+    if (found)
+        *pPerft = entry->perft;
+    completeTTOverflowCS.unlock();
+
+    return found;
+}
+
+// returns false if the overflow table has no space for it (the value is then just not stored)
+bool completeTTOverflowStore(HashKey128b hash, uint64 perft)
+{
+    completeTTOverflowCS.lock();
+    CompleteHashEntry *entry = completeTTOverflowFindSlot(hash);
+    if (entry)
+    {
+        entry->hash  = hash;
+        entry->perft = perft;
+    }
+    completeTTOverflowCS.unlock();
+
+    return entry != NULL;
+}
+
+// moves a few groups to the new table if a resize is in progress (called without holding any lock)
+void completeTTMigrateSome()
+{
+    if (completeTTOld == NULL)
+        return;
+
+    for (int i = 0; i < COMPLETE_TT_MIGRATE_GROUPS; i++)
+    {
+        uint64 next = completeTTMigrateNext++;
+        uint64 resizeCount = next >> COMPLETE_TT_RESIZE_SHIFT;
+        uint64 groupIndex  = next & GET_TT_INDEX_BITS(COMPLETE_TT_RESIZE_SHIFT);
+
+        std::mutex &cs = completeTTLocks[groupIndex & (COMPLETE_TT_LOCK_STRIPES - 1)].cs;
+        cs.lock();
+        uint64 numGroups = GET_TT_SIZE_FROM_BITS(completeTTOldBits) / COMPLETE_TT_GROUP_SIZE;
+        bool valid = completeTTOld && resizeCount == completeTTResizeCount && groupIndex < numGroups;
+        bool lastGroup = false;
+        if (valid)
+        {
+            completeTTMigrateGroup(groupIndex);
+            lastGroup = (++completeTTMigrateDone == numGroups);
+        }
+        cs.unlock();
+
+        if (lastGroup)
+        {
+            // all entries moved: nobody can be looking at the old table once we hold all the locks
+            lockCompleteTTStripes();
+            freeCompleteTTMemory(completeTTOld);
+            completeTTOld = NULL;
+            unlockCompleteTTStripes();
+        }
+
+        if (!valid)
+            break;
+    }
+}
+
+// doubles the size of the table after a group of a table of the given size was found full
+// (called without holding any lock). The entries are moved later by completeTTMigrateSome()
+void completeTTGrow(int bits)
+{
+    if (bits >= completeTTMaxBits || completeTTOld || completeTTGrowFailed)
+        return;
+
+    // some other thread is already allocating the new table
+    if (!completeTTGrowCS.try_lock())
+        return;
+
+    CompactHashEntry *newTable = NULL;
+    uint64 newSize = GET_TT_SIZE_FROM_BITS(bits + 1) * sizeof(CompactHashEntry);
+    if (completeTTBits == bits && completeTTOld == NULL)
+    {
+        newTable = allocCompleteTTMemory(newSize);
+        if (!newTable)
+        {
+            printf("\nFailed growing completeTT to %llu bytes, entries will get replaced\n", newSize);
+            completeTTGrowFailed = true;
+        }
+    }
+
+    if (newTable)
+    {
+        lockCompleteTTStripes();
+        completeTTOld     = completeTT;
+        completeTTOldBits = completeTTBits;
+        completeTT        = newTable;
+        completeTTBits    = bits + 1;
+        completeTTSize    = newSize;
+
+        completeTTResizeCount++;
+        completeTTMigrateNext = completeTTResizeCount << COMPLETE_TT_RESIZE_SHIFT;
+        completeTTMigrateDone = 0;
+        unlockCompleteTTStripes();
+    }
+
+    completeTTGrowCS.unlock();
+}
+
+// locks the entire complete TT (for sending/receiving all of it over network)
+// also makes sure that no resize is in progress (i.e, all of it is in completeTT)
+// (stores hold the lock of their stripe, so there are no writes in flight once all the stripes are locked)
+void lockCompleteTT()
+{
+    while (1)
+    {
+        lockCompleteTTStripes();
+        if (completeTTOld == NULL)
+            break;
+
+        unlockCompleteTTStripes();
+        completeTTMigrateSome();
+    }
+}
+
+void unlockCompleteTT()
+{
+    unlockCompleteTTStripes();
+}
+
+// replaces the table with an empty one of the given size (for receiving a complete TT of different size over network)
+// caller holds lockCompleteTT()
+void resizeCompleteTT(int bits)
+{
+    if (bits == completeTTBits)
+        return;
+
+    freeCompleteTTMemory(completeTT);
+    completeTTBits = bits;
+    completeTTSize = GET_TT_SIZE_FROM_BITS(bits) * sizeof(CompactHashEntry);
+    completeTT = allocCompleteTTMemory(completeTTSize);
+    if (!completeTT)
+    {
+        printf("\nFailed allocating completeTT of %llu bytes!\n", completeTTSize);
+        exit(0);
+    }
+}
+
+// returns true on hash hit (with the perft value in *pPerft)
+bool completeTTProbe(HashKey128b hash, int depth, uint64 *pPerft, bool finalHash = false)
+{
+    if (!finalHash)
+    {
+        hash ^= (ZOB_KEY_128(depth) * depth);
+    }
+
+    completeTTMigrateSome();
+
+    bool found = false;
+    int slots = 0;
+    *pPerft = 0;
+
+    std::mutex &cs = completeTTLock(hash);
+    cs.lock();
+    CompactHashEntry *entry = completeTTFindSlot(completeTT, completeTTBits, hash, &found, &slots);
+
+    // during a resize, groups not moved yet are still in the old table
+    if (!found && completeTTOld)
+        entry = completeTTFindSlot(completeTTOld, completeTTOldBits, hash, &found, &slots);
+
+    if (found)
+        *pPerft = completeTTEntryPerft(entry);
+    cs.unlock();
+
+    if (found && *pPerft == COMPLETE_TT_PERFT_OVERFLOW)
+        found = completeTTOverflowProbe(hash, pPerft);
+
+    TT_STATS_PROBE(TT_STATS_COMPLETE, depth, found, slots);
+    return found;
+}
+
+// brings the home bucket and the lock of the hash into cache (see deepTTPrefetch())
+// (reads the table pointer without any lock: during a resize it may prefetch the wrong line, which is harmless)
+void completeTTPrefetch(HashKey128b hash, int depth)
+{
+    hash ^= (ZOB_KEY_128(depth) * depth);
+
+    CompactHashEntry *group = completeTTGroup(completeTT, completeTTBits, hash);
+    int homeBucket = (hash.lowPart / COMPLETE_TT_BUCKET_SIZE) & (COMPLETE_TT_GROUP_BUCKETS - 1);
+    _mm_prefetch((const char *) &group[homeBucket * COMPLETE_TT_BUCKET_SIZE], _MM_HINT_T0);
+    _mm_prefetch((const char *) &completeTTLock(hash), _MM_HINT_T0);
+}
+
+
+void enqueueWorkItem(CompleteHashEntry *item);
+
+// finalHash: the hash already includes depth (see completeTTUpdateFromNetwork())
+void completeTTStore(HashKey128b hash, int depth, uint64 perft, bool finalHash = false)
+{
+    if (!finalHash)
+    {
+        hash ^= (ZOB_KEY_128(depth) * depth);
+    }
+
+    completeTTMigrateSome();
+
+    uint64 entryPerft = perft;
+    if (perft >= COMPLETE_TT_PERFT_OVERFLOW)
+    {
+        if (!completeTTOverflowStore(hash, perft))
+            return;
+        entryPerft = COMPLETE_TT_PERFT_OVERFLOW;
+    }
+
+    std::mutex &cs = completeTTLock(hash);
+    cs.lock();
+    int bits = completeTTBits;
+    bool inserted = completeTTInsert(completeTT, bits, hash, entryPerft);
+    bool replaced = false;
+    if (!inserted && (bits >= completeTTMaxBits || completeTTGrowFailed))
+    {
+        completeTTReplace(completeTT, bits, hash, entryPerft);
+        inserted = replaced = true;
+    }
+    cs.unlock();
+
+    if (!inserted)
+    {
+        // group full: grow the table and try again (the group in the new table has space)
+        completeTTGrow(bits);
+
+        cs.lock();
+        if (!completeTTInsert(completeTT, completeTTBits, hash, entryPerft))
+        {
+            completeTTReplace(completeTT, completeTTBits, hash, entryPerft);
+            replaced = true;
+        }
+        cs.unlock();
+    }
+    TT_STATS_STORE(TT_STATS_COMPLETE, depth, replaced);
+
+#if MULTI_NODE_NETWORK_MODE == 1
+    if (!finalHash)
+    {
+        // network work items keep the full hash and perft value (XOR trick against half received entries)
+        CompleteHashEntry item = {};
+        item.hash  = HashKey128b(hash.lowPart ^ perft, hash.highPart ^ perft);
+        item.perft = perft;
+        enqueueWorkItem(&item);
+    }
+#endif
+}
+
+void completeTTUpdateFromNetwork(HashKey128b hash, uint64 perft)
+{
+    HashKey128b actualHash = hash;
+    actualHash.highPart ^= perft;
+    actualHash.lowPart  ^= perft;
+
+    completeTTStore(actualHash, 0, perft, true);
+    numItemsFromPeers++;
+}
+
+// snapshots of the complete TT in a memory mapped file, to resume long runs after a crash or restart
+//
+// The file is a header followed by the overflow table and an image of the table. A background thread copies the
+// overflow table and the dirty regions of the table to the mapping every COMPLETE_TT_SNAPSHOT_INTERVAL seconds and syncs it to disk. Each group is copied
+// holding its lock, so the file always has whole entries (and entries carry their own check with the XOR trick).
+// When the size of the table changes, the next snapshot writes a complete image to a new file that replaces the
+// old one only once it's fully written.
+
+#define COMPLETE_TT_SNAPSHOT_INTERVAL   600     // seconds
+#define COMPLETE_TT_SNAPSHOT_MAGIC      0x5454455450534E53ull
+#define COMPLETE_TT_SNAPSHOT_VERSION    2
+#define COMPLETE_TT_SNAPSHOT_HEADER     4096    // keeps the tables page aligned in the file
+#define COMPLETE_TT_SNAPSHOT_TABLE      (COMPLETE_TT_SNAPSHOT_HEADER + sizeof(completeTTOverflow))
+
+struct CompleteTTSnapshotHeader
+{
+    uint64 magic;
+    uint32 version;
+    uint32 entrySize;
+    int    bits;
+    uint32 complete;        // set once the first full image is written
+    HashKey128b zobCheck;   // entries are only valid with the same zobrist keys
+    uint64 numSnapshots;
+    uint64 time;            // of the last snapshot
+};
+
+#ifndef _WIN32
+char   completeTTSnapshotPath[1024];
+uint8 *completeTTSnapshotMap = NULL;     // mapping of the whole file
+uint64 completeTTSnapshotMapSize = 0;
+int    completeTTSnapshotBits = 0;       // size of the table in the mapped file (0: no file yet)
+
+std::thread             completeTTSnapshotThread;
+std::mutex              completeTTSnapshotCS;
+std::condition_variable completeTTSnapshotCV;
+bool                    completeTTSnapshotStop = false;
+
+void completeTTUnmapSnapshot()
+{
+    if (completeTTSnapshotMap)
+        munmap(completeTTSnapshotMap, completeTTSnapshotMapSize);
+    completeTTSnapshotMap = NULL;
+    completeTTSnapshotMapSize = 0;
+    completeTTSnapshotBits = 0;
+}
+
+// maps the given file (with the given size if it's created), returns false on failure
+bool completeTTMapSnapshot(const char *path, uint64 size, bool create)
+{
+    int fd = open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+    if (fd < 0)
+    {
+        // no snapshot yet is the normal case for a fresh run (the first snapshot creates it)
+        if (!create && errno == ENOENT)
+            return false;
+
+        printf("\nFailed to open complete TT snapshot file %s\n", path);
+        return false;
+    }
+
+    if (create && ftruncate(fd, size))
+    {
+        printf("\nFailed to create complete TT snapshot file %s of %llu bytes\n", path, size);
+        close(fd);
+        return false;
+    }
+
+    // (an existing file that's too short - e.g, of a smaller table or truncated - isn't reusable: touching the
+    // pages past its end would crash. The next snapshot writes a complete new file)
+    struct stat st;
+    if (!create && (fstat(fd, &st) || (uint64) st.st_size < size))
+    {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("\nFailed to map complete TT snapshot file %s\n", path);
+        return false;
+    }
+
+    completeTTSnapshotMap = (uint8 *) map;
+    completeTTSnapshotMapSize = size;
+    return true;
+}
+
+// copies the dirty regions of the table to the snapshot file (or all of it when the table size changed)
+// returns false if the table got resized meanwhile (it's tried again next time)
+bool completeTTWriteSnapshot()
+{
+    // entries are moving to a bigger table: wait till it's done
+    if (completeTTOld)
+        return false;
+
+    lockCompleteTTStripes();
+    CompactHashEntry *table = completeTT;
+    int bits = completeTTBits;
+    unlockCompleteTTStripes();
+
+    char tempPath[1100];
+    bool full = (bits != completeTTSnapshotBits);
+    if (full)
+    {
+        // new image goes to a temp file first (the old snapshot stays valid till it's complete)
+        completeTTUnmapSnapshot();
+        sprintf(tempPath, "%s.tmp", completeTTSnapshotPath);
+        uint64 size = COMPLETE_TT_SNAPSHOT_TABLE + GET_TT_SIZE_FROM_BITS(bits) * sizeof(CompactHashEntry);
+        if (!completeTTMapSnapshot(tempPath, size, true))
+            return false;
+    }
+
+    completeTTOverflowCS.lock();
+    memcpy(completeTTSnapshotMap + COMPLETE_TT_SNAPSHOT_HEADER, completeTTOverflow, sizeof(completeTTOverflow));
+    completeTTOverflowCS.unlock();
+
+    CompactHashEntry *image = (CompactHashEntry *) (completeTTSnapshotMap + COMPLETE_TT_SNAPSHOT_TABLE);
+    uint64 groupsPerRegion = completeTTGroupsPerRegion(bits);
+    uint64 numRegions = GET_TT_SIZE_FROM_BITS(bits) / COMPLETE_TT_GROUP_SIZE / groupsPerRegion;
+    uint64 groupBytes = COMPLETE_TT_GROUP_SIZE * sizeof(CompactHashEntry);
+
+    for (uint64 r = 0; r < numRegions; r++)
+    {
+        if (!full && !completeTTDirty[r])
+            continue;
+
+        completeTTDirty[r] = 0;
+        for (uint64 g = r * groupsPerRegion; g < (r + 1) * groupsPerRegion; g++)
+        {
+            std::mutex &cs = completeTTLocks[g & (COMPLETE_TT_LOCK_STRIPES - 1)].cs;
+            cs.lock();
+            bool resized = (completeTT != table);
+            if (!resized)
+                memcpy(&image[g * COMPLETE_TT_GROUP_SIZE], &table[g * COMPLETE_TT_GROUP_SIZE], groupBytes);
+            cs.unlock();
+
+            if (resized)
+            {
+                // the new table gets a full image next time
+                if (full)
+                    unlink(tempPath);
+                completeTTUnmapSnapshot();
+                return false;
+            }
+        }
+    }
+
+    CompleteTTSnapshotHeader *header = (CompleteTTSnapshotHeader *) completeTTSnapshotMap;
+    if (full)
+    {
+        *header = CompleteTTSnapshotHeader();
+        header->magic = COMPLETE_TT_SNAPSHOT_MAGIC;
+        header->version = COMPLETE_TT_SNAPSHOT_VERSION;
+        header->entrySize = sizeof(CompactHashEntry);
+        header->bits = bits;
+        header->zobCheck = ZOB_KEY_128(depth);
+    }
+    header->numSnapshots++;
+    header->time = (uint64) time(NULL);
 
-    InfInt count = 0;
-    for (int i = 0; i < nMoves; i++)
+    // the image has to be on disk before it's marked complete (and replaces the older snapshot)
+    msync(completeTTSnapshotMap, completeTTSnapshotMapSize, MS_SYNC);
+    if (full)
     {
-        count += perftResults[i];
+        header->complete = 1;
+        msync(completeTTSnapshotMap, COMPLETE_TT_SNAPSHOT_HEADER, MS_SYNC);
+        rename(tempPath, completeTTSnapshotPath);
+        completeTTSnapshotBits = bits;
     }
-    return count;
-}
 
-// TODO: what happens to pending writes? No CS protection there!
-//   - lockless XOR trick should give (some?) protection
-void lockCompleteTT()
-{
-    criticalSection.lock();
+    return true;
 }
 
-void unlockCompleteTT()
+void completeTTSnapshotWorker()
 {
-    criticalSection.unlock();    
+    std::unique_lock<std::mutex> lock(completeTTSnapshotCS);
+    while (!completeTTSnapshotStop)
+    {
+        completeTTSnapshotCV.wait_for(lock, std::chrono::seconds(COMPLETE_TT_SNAPSHOT_INTERVAL));
+        if (completeTTSnapshotStop)
+            break;
+
+        EventTimer t;
+        t.start();
+        bool done = completeTTWriteSnapshot();
+        t.stop();
+        if (done)
+        {
+            printf("\nSnapshot of complete TT written to %s in %g seconds\n", completeTTSnapshotPath, t.elapsed() / 1000.0);
+        }
+    }
 }
 
-// returns non-null entryPtr if not found
-uint64 completeTTProbe(HashKey128b hash, int depth, CompleteHashEntry **pEntryPtr, bool finalHash = false)
+// loads the complete TT from a snapshot written by an earlier run
+// (called at startup before any other thread is using the table)
+bool completeTTResumeSnapshot(const char *path)
 {
-    if (!finalHash)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
     {
-        hash ^= (ZOB_KEY_128(depth) * depth);
+        printf("\nNo complete TT snapshot to resume from at %s\n", path);
+        return false;
     }
 
-    uint64 ttVal = 0;   // value from transposition table in case of hash hit
-    *pEntryPtr = NULL;    // new entry to update in case of hash miss
-
-    CompleteHashEntry *entry;
-
-    criticalSection.lock();
-    entry = &completeTT[hash.lowPart & COMPLETE_TT_INDEX_BITS];
-    while (1)
+    CompleteTTSnapshotHeader header;
+    struct stat st;
+    bool valid = (read(fd, &header, sizeof(header)) == sizeof(header)) && (fstat(fd, &st) == 0);
+    valid = valid && header.magic == COMPLETE_TT_SNAPSHOT_MAGIC && header.version == COMPLETE_TT_SNAPSHOT_VERSION &&
+            header.entrySize == sizeof(CompactHashEntry) && header.complete && header.zobCheck == ZOB_KEY_128(depth) &&
+            (uint64) st.st_size == COMPLETE_TT_SNAPSHOT_TABLE + GET_TT_SIZE_FROM_BITS(header.bits) * sizeof(CompactHashEntry);
+    if (!valid)
     {
-        if (entry->hash == HashKey128b(0,0))
-        {
-            // blank record
-
-            // mark in-use (so that other parallel thread doesn't overwrite it)
-            // with this approach there is a (very!) small chance that duplicate entries might get added for the same position.
-            //  ... but it should always be correct.
-            entry->hash = HashKey128b(ALLSET,ALLSET);
-            entry->nextIndex = ~0;
-            entry->nextTT = ~0;
+        printf("\nIgnoring invalid (or incomplete) complete TT snapshot %s\n", path);
+        close(fd);
+        return false;
+    }
 
-            *pEntryPtr = entry;
+    EventTimer t;
+    t.start();
+    uint64 size = GET_TT_SIZE_FROM_BITS(header.bits) * sizeof(CompactHashEntry);
+    void *map = mmap(NULL, COMPLETE_TT_SNAPSHOT_TABLE + size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("\nFailed to map complete TT snapshot %s\n", path);
+        return false;
+    }
+    madvise(map, COMPLETE_TT_SNAPSHOT_TABLE + size, MADV_SEQUENTIAL);
+
+    completeTTMaxBits = std::max(completeTTMaxBits, (int) header.bits);
+    resizeCompleteTT(header.bits);
+    memcpy(completeTTOverflow, (uint8 *) map + COMPLETE_TT_SNAPSHOT_HEADER, sizeof(completeTTOverflow));
+    memcpy(completeTT, (uint8 *) map + COMPLETE_TT_SNAPSHOT_TABLE, size);
+    munmap(map, COMPLETE_TT_SNAPSHOT_TABLE + size);
+    t.stop();
+
+    time_t snapshotTime = (time_t) header.time;
+    printf("\nResumed complete TT (%llu MB) in %g seconds from snapshot %s taken at %s", size / (1024 * 1024),
+           t.elapsed() / 1000.0, path, ctime(&snapshotTime));
+    return true;
+}
 
-            //printf("g  %d: %llu ", depth, hash.lowPart);  // Ankan - for testing   
+// starts writing snapshots of the complete TT to the given file periodically
+// (if resuming, the snapshot file is reused as it is)
+void startCompleteTTSnapshots(const char *path)
+{
+    strncpy(completeTTSnapshotPath, path, sizeof(completeTTSnapshotPath) - 1);
 
-            break;
-        }
-        
-        // XOR with perft value to extract hash part
-        HashKey128b entryHash = entry->hash;
-        entryHash.highPart ^= entry->perft;
-        entryHash.lowPart  ^= entry->perft;
-        
-        if (entryHash == hash)
+    CompleteTTSnapshotHeader *header = NULL;
+    if (completeTTMapSnapshot(path, COMPLETE_TT_SNAPSHOT_TABLE + completeTTSize, false))
+    {
+        header = (CompleteTTSnapshotHeader *) completeTTSnapshotMap;
+        if (header->magic == COMPLETE_TT_SNAPSHOT_MAGIC && header->version == COMPLETE_TT_SNAPSHOT_VERSION &&
+            header->complete && header->bits == completeTTBits &&
+            header->zobCheck == ZOB_KEY_128(depth))
         {
-            // hash hit
-            ttVal = entry->perft;
-            break;
+            completeTTSnapshotBits = completeTTBits;
         }
-
-        if (entry->nextIndex == ~0)
+        else
         {
-            chainIndex++;
-            if (chainIndex > COMPLETE_HASH_CHAIN_ALLOC_SIZE)
-            {
-                allocChainMemoryChunk();
-            }
-            entry->nextIndex = chainIndex;
-            entry->nextTT = (nChunks - 1);
+            completeTTUnmapSnapshot();
         }
-        entry = &(chainMemoryChunks[entry->nextTT][entry->nextIndex]);
     }
-    criticalSection.unlock();
 
-    return ttVal;
+    completeTTSnapshotsEnabled = true;
+    completeTTSnapshotStop = false;
+    completeTTSnapshotThread = std::thread(completeTTSnapshotWorker);
 }
 
+// writes a final snapshot
+void stopCompleteTTSnapshots()
+{
+    if (!completeTTSnapshotsEnabled)
+        return;
 
-void enqueueWorkItem(CompleteHashEntry *item);
+    completeTTSnapshotCS.lock();
+    completeTTSnapshotStop = true;
+    completeTTSnapshotCV.notify_all();
+    completeTTSnapshotCS.unlock();
+    completeTTSnapshotThread.join();
+
+    // (finish a pending resize first)
+    while (completeTTOld)
+        completeTTMigrateSome();
+    completeTTWriteSnapshot();
+    completeTTUnmapSnapshot();
+    completeTTSnapshotsEnabled = false;
+}
+#else
+bool completeTTResumeSnapshot(const char *path)
+{
+    printf("\nComplete TT snapshots are not supported on this platform\n");
+    return false;
+}
 
-void completeTTStore(CompleteHashEntry *entryPtr, HashKey128b hash, int depth, uint64 perft)
+void startCompleteTTSnapshots(const char *path)
 {
-    hash ^= (ZOB_KEY_128(depth) * depth);
+    printf("\nComplete TT snapshots are not supported on this platform\n");
+}
 
-    // XOR trick to prevent random bit flip errors (and also half read network entries)
-    hash.highPart ^= perft;
-    hash.lowPart  ^= perft;    
+void stopCompleteTTSnapshots()
+{
+}
+#endif
 
-    criticalSection.lock(); // Ankan - remove this likely not needed (very low probablity)
-    entryPtr->hash = hash;
-    entryPtr->perft = perft;
-    criticalSection.unlock();
+#if HOST_TT_STATS == 1
+// machine readable (JSON) dump of the host hash table statistics, written every HOST_TT_STATS_INTERVAL seconds
+// and at exit: one record per table and depth that was used, with the counters of all threads added up and
+// the occupancy of the table (estimated from a sample of its entries)
 
-#if MULTI_NODE_NETWORK_MODE == 1
-    enqueueWorkItem(entryPtr);
-#endif
-}
+#define HOST_TT_STATS_INTERVAL          60      // seconds
+#define HOST_TT_STATS_OCCUPANCY_SAMPLES 65536
 
-void completeTTUpdateFromNetwork(HashKey128b hash, uint64 perft)
-{
-    CompleteHashEntry *pEntry;
+char ttStatsPath[1024];
+bool ttStatsEnabled = false;
+std::chrono::steady_clock::time_point ttStatsStartTime;
 
-    HashKey128b actualHash = hash;
-    actualHash.highPart ^= perft;
-    actualHash.lowPart  ^= perft;
+std::thread             ttStatsThread;
+std::mutex              ttStatsCS;
+std::condition_variable ttStatsCV;
+bool                    ttStatsStop = false;
+
+// fraction of non empty entries of a host side table (all entry types are at least 16 bytes and zero when empty)
+double ttStatsOccupancy(void *table, uint64 numEntries, uint64 entrySize)
+{
+    if (table == NULL)
+        return -1;
 
-    completeTTProbe(actualHash, 0, &pEntry, true);
-    if (pEntry)
+    uint64 samples = std::min(numEntries, (uint64) HOST_TT_STATS_OCCUPANCY_SAMPLES);
+    uint64 used = 0;
+    for (uint64 i = 0; i < samples; i++)
     {
-        pEntry->hash = hash;
-        pEntry->perft = perft;
-        numItemsFromPeers++;
+        uint64 index = (i * 0x9E3779B97F4A7C15ull) & (numEntries - 1);
+        volatile uint64 *entry = (volatile uint64 *) ((uint8 *) table + index * entrySize);
+        used += (entry[0] | entry[1]) != 0;
     }
+
+    return (double) used / samples;
 }
 
-#if ENABLE_DISK_HASH == 1
-uint64 diskTTProbe(HashKey128b posHash128b, int depth, DiskHashEntry* pDiskEntry, uint64 *pDiskHashIndex)
+void writeTTStats()
 {
-    DiskHashEntry diskEntry = {};
-    uint64 diskEntryIndex = 0;
-
-    // check disk hash
-    uint64 ttVal = ALLSET;
-    int fd = open("perfthash.dat", O_RDWR);
-
-    uint64 index = posHash128b.lowPart & GET_TT_INDEX_BITS(DISK_TT_BITS);
-
-
-    diskCS.lock(); // protect against parallel access in same process!
+    char tempPath[1100];
+    sprintf(tempPath, "%s.tmp", ttStatsPath);
+    FILE *fp = fopen(tempPath, "w");
+    if (!fp)
+    {
+        printf("\nFailed to write hash table stats to %s\n", tempPath);
+        return;
+    }
 
-    // protect against parallel access across nodes of cluster
-    // this doesn't seem to work (causes cluster to hang!)
-    // flock(fd, LOCK_EX);
-    // use a lockfile instead
-    int lfd;
-    while((lfd = open(".lock", O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) ;
-    close(lfd);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - ttStatsStartTime).count();
+    int nThreads = std::min((int) ttStatsNumThreads, TT_STATS_MAX_THREADS);
+    fprintf(fp, "{\n  \"time\": %.1f,\n  \"threads\": %d,\n  \"tables\": [", elapsed, nThreads);
 
-    lseek(fd, index*sizeof(DiskHashEntry), SEEK_SET);
-    read(fd, &diskEntry, sizeof(DiskHashEntry));
-    while(1)
+    static const char *tableNames[TT_STATS_NUM_TABLES] = { "shallow", "deep", "complete" };
+    bool first = true;
+    for (int t = 0; t < TT_STATS_NUM_TABLES; t++)
     {
-        if(diskEntry.hash == HashKey128b(0,0))
+        for (int d = 0; d < MAX_PERFT_DEPTH; d++)
         {
-            // blank record
+            TTStatsCounters sum = {};
+            for (int i = 0; i < nThreads; i++)
+            {
+                volatile TTStatsCounters *c = &ttStatsBlocks[i].counters[t][d];
+                sum.probes       += c->probes;
+                sum.hits         += c->hits;
+                sum.stores       += c->stores;
+                sum.replacements += c->replacements;
+                for (int l = 0; l < TT_STATS_PROBE_LENGTHS; l++)
+                    sum.probeLength[l] += c->probeLength[l];
+            }
 
-            // mark in-use (so that other parallel thread doesn't overwrite it)
-            diskEntry.hash = HashKey128b(ALLSET,ALLSET);
-            diskEntry.next = ~0;
-            diskEntry.depth = depth;
+            if (sum.probes == 0 && sum.stores == 0)
+                continue;
 
-            diskEntryIndex = index;
-            lseek(fd, index*sizeof(DiskHashEntry), SEEK_SET);
-            write(fd, &diskEntry, sizeof(DiskHashEntry));                
-            break;                
-        }
-        if (diskEntry.hash == posHash128b && diskEntry.depth == depth)
-        {
-            // hash hit
-            ttVal = diskEntry.perft;
-            break;
-        }
-        if (diskEntry.next == ~0)
-        {
-            // add new entry to chain
-            uint64 nextIndex = lseek(fd, 0, SEEK_END) / sizeof(DiskHashEntry);
-            diskEntry.next = nextIndex;
-            lseek(fd, index*sizeof(DiskHashEntry), SEEK_SET);
-            write(fd, &diskEntry, sizeof(DiskHashEntry));
+            // size and occupancy of the table
+            int bits;
+            bool shared = false;
+            double occupancy = -1;
+            if (t == TT_STATS_COMPLETE)
+            {
+                // (the table can get replaced - grown, received over network, resumed - and freed meanwhile)
+                completeTTGrowCS.lock();
+                lockCompleteTTStripes();
+                bits = completeTTBits;
+                occupancy = ttStatsOccupancy(completeTT, GET_TT_SIZE_FROM_BITS(bits), sizeof(CompactHashEntry));
+                unlockCompleteTTStripes();
+                completeTTGrowCS.unlock();
+            }
+            else
+            {
+                bits = ttBits[d];
+                shared = (bits == 0);
+                if (shared)
+                    bits = sharedHashBits;
+#if CPU_ONLY_BUILD == 1
+                void *table = TransTables128b[0].hashTable[d];
+#else
+                void *table = TransTables128b[0].cpuTable[d];   // (NULL for tables in video memory)
+#endif
+                occupancy = ttStatsOccupancy(table, GET_TT_SIZE_FROM_BITS(bits),
+                                             t == TT_STATS_SHALLOW ? sizeof(HashKey128b) : sizeof(HashEntryPerft128b));
+            }
 
-            DiskHashEntry blankRecord = {};
-            lseek(fd, nextIndex * sizeof(DiskHashEntry), SEEK_SET);
-            write(fd, &blankRecord, sizeof(DiskHashEntry));
+            fprintf(fp, "%s\n    { \"table\": \"%s\", \"depth\": %d, \"bits\": %d, \"shared\": %s, \"occupancy\": %.4f, "
+                        "\"probes\": %llu, \"hits\": %llu, \"hitRate\": %.4f, \"stores\": %llu, \"replacements\": %llu, "
+                        "\"probeLength\": [",
+                    first ? "" : ",", tableNames[t], d, bits, shared ? "true" : "false", occupancy,
+                    sum.probes, sum.hits, sum.probes ? (double) sum.hits / sum.probes : 0.0, sum.stores, sum.replacements);
+            for (int l = 0; l < TT_STATS_PROBE_LENGTHS; l++)
+                fprintf(fp, "%s%llu", l ? ", " : "", sum.probeLength[l]);
+            fprintf(fp, "] }");
+            first = false;
         }
-
-        // go to the next entry in chain
-        index = diskEntry.next;
-        lseek(fd, index*sizeof(DiskHashEntry), SEEK_SET);
-        read(fd, &diskEntry, sizeof(DiskHashEntry));
     }
-    
-    //flock(fd, LOCK_UN);
-    close(fd);
-    remove(".lock");
-    diskCS.unlock();
 
-    *pDiskEntry = diskEntry;
-    *pDiskHashIndex = diskEntryIndex;
-    return ttVal;
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+
+#ifdef _WIN32
+    remove(ttStatsPath);
+#endif
+    rename(tempPath, ttStatsPath);
+}
+
+void ttStatsWorker()
+{
+    std::unique_lock<std::mutex> lock(ttStatsCS);
+    while (!ttStatsStop)
+    {
+        ttStatsCV.wait_for(lock, std::chrono::seconds(HOST_TT_STATS_INTERVAL));
+        if (!ttStatsStop)
+            writeTTStats();
+    }
 }
 
+void startTTStats(const char *path)
+{
+    strncpy(ttStatsPath, path, sizeof(ttStatsPath) - 1);
+    ttStatsStartTime = std::chrono::steady_clock::now();
+    ttStatsEnabled = true;
+    ttStatsStop = false;
+    ttStatsThread = std::thread(ttStatsWorker);
+}
 
-void diskTTStore(DiskHashEntry *diskEntry, uint64 diskEntryIndex, HashKey128b posHash128b, int depth, uint64 perft)
+// writes the final stats (call before the tables are freed)
+void stopTTStats()
 {
-    diskEntry->hash = posHash128b;
-    diskEntry->perft = perft;
-    diskEntry->depth = depth;
-    diskEntry->next = ~0;    // possible bug here! should read from the disk and check
+    if (!ttStatsEnabled)
+        return;
 
-    diskCS.lock();        // avoid parallel file access from same process
-    int fd = open("perfthash.dat", O_RDWR);
-    lseek(fd, diskEntryIndex * sizeof(DiskHashEntry), SEEK_SET);
-    write(fd, diskEntry, sizeof(DiskHashEntry));
-    close(fd);
-    diskCS.unlock();        
+    ttStatsCS.lock();
+    ttStatsStop = true;
+    ttStatsCV.notify_all();
+    ttStatsCS.unlock();
+    ttStatsThread.join();
+
+    writeTTStats();
+    ttStatsEnabled = false;
 }
 #endif
 
+#if ENABLE_DISK_HASH == 1
+#include "diskhash.h"
+#endif
+
 int diskHashDepth = 0;  // set to search depth - 4
 
 int splitDepth = MIN_SPLIT_DEPTH;
@@ -797,6 +2127,58 @@ uint32 maxMemoryUsage = 0;
 int numRegularLaunches = 0;
 int numRetryLaunches = 0;
 
+#if CANONICAL_TT_KEYS == 1
+// host hash table probes with a key of a symmetric variant of the position (instead of its own), and hits among them
+std::atomic<uint64> numSymmetricProbes(0);
+std::atomic<uint64> numSymmetricHits(0);
+#endif
+
+// keys of a position carried through the launchers: key[0] is its zobrist key (the one passed on to the GPU/BFS
+// levels), with CANONICAL_TT_KEYS the other ones are the keys of its symmetric variants - all of them updated move by move
+void computeHostKeys(HexaBitBoardPosition *pos, SymmetricKeys128b *keys)
+{
+#if CANONICAL_TT_KEYS == 1
+    MoveGeneratorBitboard::computeSymmetricZobristKeys128b(pos, keys);
+#else
+    keys->key[0] = MoveGeneratorBitboard::computeZobristKey128b(pos);
+#endif
+}
+
+// makes the move on a copy of pos (in child), keys: keys of pos - replaced by the keys of the child
+CPU_FORCE_INLINE void makeMoveAndUpdateHostKeys(HexaBitBoardPosition *child, HexaBitBoardPosition *pos, SymmetricKeys128b *keys, CMove move)
+{
+#if CANONICAL_TT_KEYS == 1
+    makeChildBoard(child, pos, move);
+    MoveGeneratorBitboard::updateSymmetricZobristKeys128b(pos, child, keys);
+#else
+    *child = *pos;
+    keys->key[0] = makeMoveAndUpdateHash(child, keys->key[0], move, pos->chance);
+#endif
+}
+
+// key used for looking up a position in the host side hash tables
+HashKey128b hostTTKey(HexaBitBoardPosition *pos, const SymmetricKeys128b *keys)
+{
+#if CANONICAL_TT_KEYS == 1
+    return MoveGeneratorBitboard::canonicalZobristKey128b(pos, keys);
+#else
+    return keys->key[0];
+#endif
+}
+
+// update the counters of symmetric probes (see numSymmetricProbes)
+void countHostTTProbe(HashKey128b hash, HashKey128b ttKey, bool hit)
+{
+#if CANONICAL_TT_KEYS == 1
+    if (!(ttKey == hash))
+    {
+        numSymmetricProbes.fetch_add(1, std::memory_order_relaxed);
+        if (hit)
+            numSymmetricHits.fetch_add(1, std::memory_order_relaxed);
+    }
+#endif
+}
+
 // launch last two levels
 // attemps to overlap CPU and GPU time
 // - cpu time to check hash table
@@ -810,7 +2192,6 @@ uint64 perft_bb_second_last_level_launcher(HexaBitBoardPosition *pos, uint32 dep
     CMove firstLevelMoves[MAX_MOVES];
     uint64 firstLevelPerfts[MAX_MOVES];
     int firstLevelNewBoards = 0;
-    CompleteHashEntry *firstLevelHashEntries[MAX_MOVES];
 
     uint8 color = pos->chance;
     int nMoves = generateMoves(pos, color, firstLevelMoves);
@@ -824,15 +2205,13 @@ uint64 perft_bb_second_last_level_launcher(HexaBitBoardPosition *pos, uint32 dep
         HashKey128b curHash = makeMoveAndUpdateHash(&curPos, hash, firstLevelMoves[j], color);
 
         // check in hash table
-        CompleteHashEntry *entryPtr;
-
-        uint64 ttVal = completeTTProbe(newHash, depth+1, &entryPtr);
-        if (entryPtr == NULL)
+        uint64 ttVal;
+        if (completeTTProbe(newHash, depth+1, &ttVal))
         {
             perft += ttVal;
             continue;
         }
-        firstLevelHashEntries[firstLevelNewBoards++] = entryPtr;
+        firstLevelNewBoards++;
         
         uint64 count = 0;
 
@@ -847,21 +2226,18 @@ uint64 perft_bb_second_last_level_launcher(HexaBitBoardPosition *pos, uint32 dep
         sortMoves(moves, nChildMoves);
 
         int nNewBoards = 0;
-        CompleteHashEntry *newEntryPointer[MAX_MOVES];        
 
         for (int i = 0; i < nMoves; i++)
         {
             childBoards[nNewBoards] = *curPos;
             HashKey128b newHash = makeMoveAndUpdateHash(&childBoards[nNewBoards], curHash, moves[i], color);
 
-            CompleteHashEntry *entryPtr;
-            uint64 ttVal = completeTTProbe(newHash, depth + 2, &entryPtr);
-            if (entryPtr == NULL)
+            uint64 ttVal;
+            if (completeTTProbe(newHash, depth + 2, &ttVal))
             {
                 count += ttVal;
                 continue;
             }
-            newEntryPointer[nNewBoards] = entryPtr;
             hashes[nNewBoards] = newHash;
             nNewBoards++;
         }
@@ -896,7 +2272,7 @@ uint64 perft_bb_second_last_level_launcher(HexaBitBoardPosition *pos, uint32 dep
                     if (batchSize != nNewBoards)
                         numRetryLaunches++;
 
-                    perft_bb_gpu_simple_hash << <1, 1 >> > (count, &gpuBoard[activeGpu][i], &gpuHashes[activeGpu][i], &gpu_perft[activeGpu][i], depth - 1, preAllocatedBufferHost[activeGpu],
+                    perft_bb_gpu_simple_hash SINGLE_THREAD_LAUNCH (count, &gpuBoard[activeGpu][i], &gpuHashes[activeGpu][i], &gpu_perft[activeGpu][i], depth - 1, preAllocatedBufferHost[activeGpu],
                                                             TransTables128b[activeGpu], true);
 
                     cudaError_t err = cudaMemcpy(&perfts[i], &gpu_perft[activeGpu][i], sizeof(uint64) * count, cudaMemcpyDeviceToHost);
@@ -950,7 +2326,7 @@ uint64 perft_bb_second_last_level_launcher(HexaBitBoardPosition *pos, uint32 dep
 
             HashKey128b posHash128b = hashes[i];
 
-                completeTTStore(newEntryPointer[i], hashes[i], depth+2, perfts[i]);
+                completeTTStore(hashes[i], depth+2, perfts[i]);
         }
 
         return count;
@@ -963,13 +2339,19 @@ uint64 perft_bb_second_last_level_launcher(HexaBitBoardPosition *pos, uint32 dep
 
 // launch all boards of the last level without waiting for previous work to finish
 // tiny bit improvement in GPU utilization
-uint64 perft_bb_last_level_launcher(HexaBitBoardPosition *pos, uint32 depth)
+// posKeys: keys of pos if already known (see computeHostKeys())
+uint64 perft_bb_last_level_launcher(HexaBitBoardPosition *pos, uint32 depth, const SymmetricKeys128b *posKeys = NULL)
 {
-    HashKey128b hash = MoveGeneratorBitboard::computeZobristKey128b(pos);
+    SymmetricKeys128b keys;
+    if (posKeys)
+        keys = *posKeys;
+    else
+        computeHostKeys(pos, &keys);
 
     HexaBitBoardPosition childBoards[MAX_MOVES];
     CMove moves[MAX_MOVES];
     HashKey128b hashes[MAX_MOVES];
+    HashKey128b ttKeys[MAX_MOVES];
     uint64 perfts[MAX_MOVES];
 
     // generate moves for the current board and call the breadth first routine for all child boards
@@ -980,49 +2362,50 @@ uint64 perft_bb_last_level_launcher(HexaBitBoardPosition *pos, uint32 depth)
     HashEntryPerft128b *hashTable = (HashEntryPerft128b *)TransTables128b[0].cpuTable[depth - 1];
     uint64 indexBits = TransTables128b[0].indexBits[depth - 1];
     uint64 hashBits = TransTables128b[0].hashBits[depth - 1];
+
+    // make all the child boards and prefetch their hash table entries before probing any of them
+    // (so that the cache misses of all the probes overlap instead of happening one after another)
+    for (int i = 0; i < nMoves; i++)
+    {
+        SymmetricKeys128b childKeys = keys;
+        makeMoveAndUpdateHostKeys(&childBoards[i], pos, &childKeys, moves[i]);
+        hashes[i] = childKeys.key[0];
+        ttKeys[i] = hostTTKey(&childBoards[i], &childKeys);
 #if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 1
-    CompleteHashEntry *newEntryPointer[MAX_MOVES];
+        if (depth == GPU_LAUNCH_DEPTH + 1)
+            completeTTPrefetch(ttKeys[i], GPU_LAUNCH_DEPTH);
+        else
 #endif
+            deepTTPrefetch(hashTable, indexBits, ttKeys[i]);
+    }
 
     int nNewBoards = 0;
     uint64 count = 0;
     for (int i = 0; i < nMoves; i++)
     {
-        childBoards[nNewBoards] = *pos;
-        HashKey128b newHash = makeMoveAndUpdateHash(&childBoards[nNewBoards], hash, moves[i], color);
+        HashKey128b newHash = hashes[i];
+        HashKey128b ttKey = ttKeys[i];
 
         // check in hash table
+        uint64 ttVal;
+        bool hit;
 #if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 1
         if (depth == GPU_LAUNCH_DEPTH + 1)
-        {
-            CompleteHashEntry *entryPtr;
-
-            uint64 ttVal = completeTTProbe(newHash, GPU_LAUNCH_DEPTH, &entryPtr);
-            if (entryPtr == NULL)
-            {
-                count += ttVal;
-                continue;
-            }
-            newEntryPointer[nNewBoards] = entryPtr;
-        }
+            hit = completeTTProbe(ttKey, GPU_LAUNCH_DEPTH, &ttVal);
         else
 #endif
+            hit = deepTTProbe(hashTable, hashBits, indexBits, ttKey, depth - 1, &ttVal);
+
+        countHostTTProbe(newHash, ttKey, hit);
+        if (hit)
         {
-            HashEntryPerft128b entry;
-            entry = hashTable[newHash.lowPart & indexBits];
-            // extract data from the entry using XORs (hash part is stored XOR'ed with data for lockless hashing scheme)
-            entry.hashKey.highPart ^= entry.perftVal;
-            entry.hashKey.lowPart ^= entry.perftVal;
-
-            if ((entry.hashKey.highPart == newHash.highPart) && ((entry.hashKey.lowPart & hashBits) == (newHash.lowPart & hashBits))
-                && (entry.depth == (depth - 1)))
-            {
-                // hash hit
-                count += entry.perftVal;
-                continue;
-            }
+            // hash hit
+            count += ttVal;
+            continue;
         }
+        childBoards[nNewBoards] = childBoards[i];
         hashes[nNewBoards] = newHash;
+        ttKeys[nNewBoards] = ttKey;
         nNewBoards++;
     }
 
@@ -1065,7 +2448,7 @@ uint64 perft_bb_last_level_launcher(HexaBitBoardPosition *pos, uint32 depth)
                 if (batchSize != nNewBoards)
                     numRetryLaunches++;
 
-                perft_bb_gpu_simple_hash << <1, 1 >> > (count, &gpuBoard[activeGpu][i], &gpuHashes[activeGpu][i], &gpu_perft[activeGpu][i], depth - 1, preAllocatedBufferHost[activeGpu],
+                perft_bb_gpu_simple_hash SINGLE_THREAD_LAUNCH (count, &gpuBoard[activeGpu][i], &gpuHashes[activeGpu][i], &gpu_perft[activeGpu][i], depth - 1, preAllocatedBufferHost[activeGpu],
                                                         TransTables128b[activeGpu], true);
 
                 cudaError_t err = cudaMemcpy(&perfts[i], &gpu_perft[activeGpu][i], sizeof(uint64) * count, cudaMemcpyDeviceToHost);
@@ -1100,7 +2483,7 @@ uint64 perft_bb_last_level_launcher(HexaBitBoardPosition *pos, uint32 depth)
     // hope that these will get scheduled on GPU in tightly packed manner without much overhead
     for (int i = 0; i < nNewBoards; i++)
     {
-        perft_bb_gpu_simple_hash <<<1, 1 >>> (1, &gpuBoard[activeGpu][i], &gpuHashes[activeGpu][i], &gpu_perft[activeGpu][i], depth - 1, preAllocatedBufferHost[activeGpu],
+        perft_bb_gpu_simple_hash SINGLE_THREAD_LAUNCH (1, &gpuBoard[activeGpu][i], &gpuHashes[activeGpu][i], &gpu_perft[activeGpu][i], depth - 1, preAllocatedBufferHost[activeGpu],
                                               TransTables128b[activeGpu], true);
     }
 
@@ -1144,110 +2527,128 @@ uint64 perft_bb_last_level_launcher(HexaBitBoardPosition *pos, uint32 depth)
 
         count += perfts[i];
 
-        HashKey128b posHash128b = hashes[i];
-
 #if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 1
         if (depth == GPU_LAUNCH_DEPTH + 1)
         {
-            completeTTStore(newEntryPointer[i], hashes[i], GPU_LAUNCH_DEPTH, perfts[i]);
+            completeTTStore(ttKeys[i], GPU_LAUNCH_DEPTH, perfts[i]);
         }
         else
 #endif
         {
-            HashEntryPerft128b oldEntry;
-            oldEntry = hashTable[posHash128b.lowPart & indexBits];
-
-            // replace only if old entry was shallower (or of same depth)
-            if (hashTable && oldEntry.depth <= (depth - 1))
-            {
-                HashEntryPerft128b newEntry;
-                newEntry.perftVal = perfts[i];
-                newEntry.hashKey.highPart = posHash128b.highPart;
-                newEntry.hashKey.lowPart = (posHash128b.lowPart & hashBits);
-                newEntry.depth = (depth - 1);
-
-                // XOR hash part with data part for lockless hashing
-                newEntry.hashKey.lowPart ^= newEntry.perftVal;
-                newEntry.hashKey.highPart ^= newEntry.perftVal;
-
-                hashTable[posHash128b.lowPart & indexBits] = newEntry;
-            }
+            if (hashTable)
+                deepTTStore(hashTable, hashBits, indexBits, ttKeys[i], depth - 1, perfts[i]);
         }
     }
 
     return count;
 }
 
-InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *dispPrefix)
+// the hash table used by perft_bb_cpu_launcher() for positions of the given depth
+bool cpuLauncherTTProbe(HashKey128b hash, uint32 depth, uint64 *pPerft)
 {
-    HexaBitBoardPosition newPositions[MAX_MOVES];
-    CMove genMoves[MAX_MOVES];
-    char  dispString[128];
+#if USE_COMPLETE_HASH_ALL_LEVELS == 1
+    return completeTTProbe(hash, depth, pPerft);
+#else
+    HashEntryPerft128b *hashTable = (HashEntryPerft128b *) TransTables128b[0].cpuTable[depth];
+    return hashTable && deepTTProbe(hashTable, TransTables128b[0].hashBits[depth], TransTables128b[0].indexBits[depth],
+                                    hash, depth, pPerft);
+#endif
+}
 
-    HashKey128b posHash128b;
-    posHash128b = MoveGeneratorBitboard::computeZobristKey128b(pos);
+void cpuLauncherTTPrefetch(HashKey128b hash, uint32 depth)
+{
+#if USE_COMPLETE_HASH_ALL_LEVELS == 1
+    completeTTPrefetch(hash, depth);
+#else
+    deepTTPrefetch((HashEntryPerft128b *) TransTables128b[0].cpuTable[depth], TransTables128b[0].indexBits[depth], hash);
+#endif
+}
 
-    // check hash table
+void cpuLauncherTTStore(HashKey128b hash, uint32 depth, uint64 perft)
+{
 #if USE_COMPLETE_HASH_ALL_LEVELS == 1
-    CompleteHashEntry *completeTTEntryPtr = NULL;
-    uint64 ttVal = completeTTProbe(posHash128b, depth, &completeTTEntryPtr);
-    if (completeTTEntryPtr == NULL)
-    {
-        return ttVal;
-    }
-#else    
+    completeTTStore(hash, depth, perft);
+#else
     HashEntryPerft128b *hashTable = (HashEntryPerft128b *) TransTables128b[0].cpuTable[depth];
-    uint64 indexBits = TransTables128b[0].indexBits[depth];
-    uint64 hashBits = TransTables128b[0].hashBits[depth];
-    HashEntryPerft128b entry;
-
     if (hashTable)
+        deepTTStore(hashTable, TransTables128b[0].hashBits[depth], TransTables128b[0].indexBits[depth], hash, depth, perft);
+#endif
+}
+
+// batch arrays of perft_bb_cpu_launcher(): one set per depth, kept per thread
+// (instead of ~21 KB of them on the stack of every recursion level)
+struct CpuLauncherScratch
+{
+    SymmetricKeys128b childKeys[MAX_MOVES];
+    HashKey128b       childTTKeys[MAX_MOVES];
+    uint32            misses[MAX_MOVES];        // children not in the hash table
+};
+
+thread_local std::unique_ptr<CpuLauncherScratch[]> cpuLauncherScratch;
+
+CpuLauncherScratch *getCpuLauncherScratch(uint32 depth)
+{
+    if (!cpuLauncherScratch)
+        cpuLauncherScratch.reset(new CpuLauncherScratch[MAX_PERFT_DEPTH]);
+    return &cpuLauncherScratch[depth];
+}
+
+// moves leading to a child position (for display)
+void childDispString(char *dispString, char *dispPrefix, CMove move)
+{
+    char moveString[10];
+    Utils::getCompactMoveString(move, moveString);
+    strcpy(dispString, dispPrefix);
+    strcat(dispString, moveString);
+}
+
+// shows the perft of every child for bigger perfts
+void printChildPerft(char *dispString, uint32 depth, const InfInt &childPerft)
+{
+    if (depth > DIVIDED_PERFT_DEPTH)
     {
-        entry = hashTable[posHash128b.lowPart & indexBits];
-        // extract data from the entry using XORs (hash part is stored XOR'ed with data for lockless hashing scheme)
-        entry.hashKey.highPart ^= entry.perftVal;
-        entry.hashKey.lowPart ^= entry.perftVal;
+        criticalSection.lock();
+        printf("%s   %20s\n", dispString, childPerft.toString().c_str());
+        fflush(stdout);
+        criticalSection.unlock();
+    }
+}
 
-        if ((entry.hashKey.highPart == posHash128b.highPart) && ((entry.hashKey.lowPart & hashBits) == (posHash128b.lowPart & hashBits))
-            && (entry.depth == depth))
+InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *dispPrefix, const SymmetricKeys128b *probedKeys)
+{
+    MoveSet moveSet;
+    uint8 order[MAX_MOVES];
+    char  dispString[128];
+
+    SymmetricKeys128b posKeys;
+    if (probedKeys)
+        posKeys = *probedKeys;
+    else
+        computeHostKeys(pos, &posKeys);
+    HashKey128b posHash128b = posKeys.key[0];
+    HashKey128b ttKey = hostTTKey(pos, &posKeys);
+
+    // check hash table
+    uint64 ttVal;
+    if (!probedKeys)
+    {
+        bool hit = cpuLauncherTTProbe(ttKey, depth, &ttVal);
+        countHostTTProbe(posHash128b, ttKey, hit);
+        if (hit)
         {
             // hash hit
-            return entry.perftVal;
+            return ttVal;
         }
     }
-#endif
-
-#if ENABLE_DISK_HASH == 7
 
-    // new entry to update in case of hash miss
-    uint64 diskEntryIndex = 0; 
-    DiskHashEntry diskEntry = {};
-
-    if (depth == diskHashDepth)
+#if ENABLE_DISK_HASH == 1
+    if (depth == diskHashDepth && !probedKeys)
     {
-        uint64 ttVal = diskTTProbe(posHash128b, depth, &diskEntry, &diskEntryIndex);
+        uint64 ttVal = diskTTProbe(ttKey, depth);
         if (ttVal != ALLSET)
         {
-#if USE_COMPLETE_HASH_ALL_LEVELS == 1
-            completeTTStore(completeTTEntryPtr, posHash128b, depth, ttVal);
-#else     
             // store in local in-memory hash table for faster access next time
-            // replace only if old entry was shallower (or of same depth)
-            if (hashTable && (entry.depth <= depth))
-            {
-                HashEntryPerft128b newEntry;
-                newEntry.perftVal = ttVal;
-                newEntry.hashKey.highPart = posHash128b.highPart;
-                newEntry.hashKey.lowPart = (posHash128b.lowPart & hashBits);
-                newEntry.depth = depth;
-
-                // XOR hash part with data part for lockless hashing
-                newEntry.hashKey.lowPart ^= newEntry.perftVal;
-                newEntry.hashKey.highPart ^= newEntry.perftVal;
-
-                hashTable[posHash128b.lowPart & indexBits] = newEntry;
-            }
-#endif            
+            cpuLauncherTTStore(ttKey, depth, ttVal);
             return ttVal;
         }
     }
@@ -1258,7 +2659,7 @@ InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *disp
 
     if (depth == GPU_LAUNCH_DEPTH+1)
     {
-        count = perft_bb_last_level_launcher(pos, depth);
+        count = perft_bb_last_level_launcher(pos, depth, &posKeys);
     }
     else if (depth <= GPU_LAUNCH_DEPTH)
     {
@@ -1270,7 +2671,7 @@ InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *disp
             cudaMemcpy(gpuHashes[activeGpu], &posHash128b, sizeof(HashKey128b), cudaMemcpyHostToDevice);
             // gpu_perft is a single 64 bit integer which is updated using atomic adds by leave nodes
 
-#if ENABLE_GPU_SERIAL_LEVEL == 1
+#if ENABLE_GPU_SERIAL_LEVEL == 1 && CPU_ONLY_BUILD == 0
             if (depth >= 6)
             {
                 perft_bb_gpu_launcher_hash<<<1, 1 >>> (gpuBoard[activeGpu], posHash128b, gpu_perft[activeGpu], depth, preAllocatedBufferHost[activeGpu],
@@ -1279,7 +2680,7 @@ InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *disp
             else
 #endif
             {
-                perft_bb_gpu_simple_hash << <1, 1 >> > (1, gpuBoard[activeGpu], gpuHashes[activeGpu], gpu_perft[activeGpu], depth, preAllocatedBufferHost[activeGpu],
+                perft_bb_gpu_simple_hash SINGLE_THREAD_LAUNCH (1, gpuBoard[activeGpu], gpuHashes[activeGpu], gpu_perft[activeGpu], depth, preAllocatedBufferHost[activeGpu],
                     TransTables128b[activeGpu], true);
 
                 // update memory usage estimation
@@ -1297,7 +2698,7 @@ InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *disp
             {
                 //printf("\nOOM occured. BAD! Exiting\n");
                 //exit(0);
-                res = perft_bb_last_level_launcher(pos, depth);
+                res = perft_bb_last_level_launcher(pos, depth, &posKeys);
 
             }
         }
@@ -1313,75 +2714,134 @@ InfInt perft_bb_cpu_launcher(HexaBitBoardPosition *pos, uint32 depth, char *disp
     else
 #endif
     {
-        nMoves = generateMoves(pos, pos->chance, genMoves);
+        generateMoveSet(pos, &moveSet);
+        nMoves = moveSet.count();
 #if ENABLE_DISK_HASH == 1
         if (depth > diskHashDepth)
         {
-            randomizeMoves(genMoves, nMoves);
+            randomizeMoveSet(&moveSet, order);
         }
         else
 #endif   
         {     
-            sortMoves(genMoves, nMoves);
+            sortMoveSet(&moveSet, order);
         }
 
+        // look up all the children in the hash table first, with all their entries prefetched before the first probe
+        CpuLauncherScratch *scratch = getCpuLauncherScratch(depth);
+        SymmetricKeys128b *childKeys = scratch->childKeys;
+        HashKey128b *childTTKeys = scratch->childTTKeys;
         for (uint32 i = 0; i < nMoves; i++)
         {
-            newPositions[i] = *pos;
-            uint64 fakeHash = 0;
+            HexaBitBoardPosition child;
+            childKeys[i] = posKeys;
+            makeMoveAndUpdateHostKeys(&child, pos, &childKeys[i], moveSet.getMove(order[i]));
+            childTTKeys[i] = hostTTKey(&child, &childKeys[i]);
+            cpuLauncherTTPrefetch(childTTKeys[i], depth - 1);
+        }
 
-            if (pos->chance == WHITE)
-                MoveGeneratorBitboard::makeMove<WHITE, false>(&newPositions[i], fakeHash, genMoves[i]);
+        // children not in the hash table
+        uint32 *misses = scratch->misses;
+        uint32 nMisses = 0;
+        for (uint32 i = 0; i < nMoves; i++)
+        {
+            bool hit = cpuLauncherTTProbe(childTTKeys[i], depth - 1, &ttVal);
+            countHostTTProbe(childKeys[i].key[0], childTTKeys[i], hit);
+            if (hit)
+            {
+                childDispString(dispString, dispPrefix, moveSet.getMove(order[i]));
+                printChildPerft(dispString, depth, ttVal);
+                count += ttVal;
+            }
             else
-                MoveGeneratorBitboard::makeMove<BLACK, false>(&newPositions[i], fakeHash, genMoves[i]);
+            {
+                misses[nMisses++] = i;
+            }
+        }
+
+#if ENABLE_DISK_HASH == 1
+        // children at the disk hash level are looked up on disk in the background, and the ones that
+        // aren't found there are searched (in the order their lookups complete) while the others are looked up
+        bool diskLevel = (depth - 1 == diskHashDepth);
+        std::unique_ptr<DiskTTRequest[]> diskRequests;
+        std::unique_ptr<bool[]> searched;
+        if (diskLevel)
+        {
+            diskRequests.reset(new DiskTTRequest[nMisses]);
+            searched.reset(new bool[nMisses]());
+            for (uint32 m = 0; m < nMisses; m++)
+                diskTTSubmitProbe(&diskRequests[m], childTTKeys[misses[m]], depth - 1);
+        }
+#endif
 
-            char moveString[10];
-            Utils::getCompactMoveString(genMoves[i], moveString);
-            strcpy(dispString, dispPrefix);
-            strcat(dispString, moveString);
-            InfInt childPerft = perft_bb_cpu_launcher(&newPositions[i], depth - 1, dispString);
+        for (uint32 next = 0; next < nMisses; next++)
+        {
+            uint32 m = next;
+#if ENABLE_DISK_HASH == 1
+            bool lookupDone = false;
+            if (diskLevel)
+            {
+                // a child with its lookup done, or when there is none the last one left (its lookup is
+                // queued last) is searched without waiting while the others are looked up
+                uint32 last = MAX_MOVES;
+                m = MAX_MOVES;
+                for (uint32 k = 0; k < nMisses && m == MAX_MOVES; k++)
+                {
+                    if (searched[k])
+                        continue;
+                    last = k;
+                    if (diskTTProbeDone(&diskRequests[k]))
+                        m = k;
+                }
+                lookupDone = (m != MAX_MOVES);
+                if (!lookupDone)
+                    m = last;
+                searched[m] = true;
+            }
+#endif
+            uint32 i = misses[m];
+            CMove move = moveSet.getMove(order[i]);
+            childDispString(dispString, dispPrefix, move);
 
-            if (depth > DIVIDED_PERFT_DEPTH)
+            InfInt childPerft;
+#if ENABLE_DISK_HASH == 1
+            uint64 diskVal = lookupDone ? diskTTWaitProbe(&diskRequests[m]) : ALLSET;
+            if (diskVal != ALLSET)
             {
-                criticalSection.lock();
-                //printf("%s   %20llu\n", dispString, childPerft);
-                printf("%s   %20s\n", dispString, childPerft.toString().c_str());
-                fflush(stdout);
-                criticalSection.unlock();
+                // store in local in-memory hash table for faster access next time
+                cpuLauncherTTStore(childTTKeys[i], depth - 1, diskVal);
+                childPerft = diskVal;
+            }
+            else
+#endif
+            {
+                // child boards are made one at a time (instead of keeping all of them on the stack)
+                HexaBitBoardPosition newPosition;
+                makeChildBoard(&newPosition, pos, move);
+                childPerft = perft_bb_cpu_launcher(&newPosition, depth - 1, dispString, &childKeys[i]);
             }
+
+            printChildPerft(dispString, depth, childPerft);
             count += childPerft;
         }
 
+#if ENABLE_DISK_HASH == 1
+        // the lookups of children that were searched without waiting may still be in flight
+        for (uint32 m = 0; diskLevel && m < nMisses; m++)
+            diskTTWaitProbe(&diskRequests[m]);
+#endif
     }
 
     // store in hash table
-#if USE_COMPLETE_HASH_ALL_LEVELS == 1
     if (count < InfInt(ALLSET))
     {
-        completeTTStore(completeTTEntryPtr, posHash128b, depth, count.toUnsignedLongLong());
-    }
-#else        
-    // replace only if old entry was shallower (or of same depth)
-    if (hashTable && (entry.depth <= depth) && (count < InfInt(ALLSET)))
-    {
-        HashEntryPerft128b newEntry;
-        newEntry.perftVal = count.toUnsignedLongLong();
-        newEntry.hashKey.highPart = posHash128b.highPart;
-        newEntry.hashKey.lowPart = (posHash128b.lowPart & hashBits);
-        newEntry.depth = depth;
-
-        // XOR hash part with data part for lockless hashing
-        newEntry.hashKey.lowPart ^= newEntry.perftVal;
-        newEntry.hashKey.highPart ^= newEntry.perftVal;
-
-        hashTable[posHash128b.lowPart & indexBits] = newEntry;
+        cpuLauncherTTStore(ttKey, depth, count.toUnsignedLongLong());
     }
-#endif
     // update disk hash table too!
-#if ENABLE_DISK_HASH == 7
+#if ENABLE_DISK_HASH == 1
     if ((depth == diskHashDepth) && (count < InfInt(ALLSET)))
     {
-        diskTTStore(&diskEntry, diskEntryIndex, posHash128b, depth, count.toUnsignedLongLong());
+        diskTTStore(ttKey, depth, count.toUnsignedLongLong());
     }    
 #endif
 
@@ -1394,11 +2854,8 @@ void dividedPerft(HexaBitBoardPosition *pos, uint32 depth)
 #if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 1
     // (need to clear this as it would otherwise contain perfts of other depths)
     // no need to clear this if we include depth when computing position hashes
-    //memset(completeTT, 0, GET_TT_SIZE_FROM_BITS(COMPLETE_TT_BITS) * sizeof(CompleteHashEntry));
+    //memset(completeTT, 0, completeTTSize);
 
-    // no need to clear this if we don't reuse old entries
-    //memset(chainMemory, 0, COMPLETE_HASH_CHAIN_ALLOC_SIZE * sizeof(CompleteHashEntry));
-    //chainIndex = 0;
 #endif
     cudaError_t cudaStatus;
 
@@ -1487,7 +2944,12 @@ void perftLauncher(HexaBitBoardPosition *pos, uint32 depth, int launchDepth)
     gputime.start();
 
     // gpu_perft is a single 64 bit integer which is updated using atomic adds by leaf nodes
+#if CPU_ONLY_BUILD == 1
+    // no driver kernel on host, use the multi-threaded CPU perft (one thread per worker)
+    *gpu_perft = perft_bb_mt(pos, depth, numGPUs);
+#else
     perft_bb_driver_gpu <<<1, 1 >>> (gpuBoard, gpu_perft, depth, serial_perft_stack, preAllocatedBufferHost[0], launchDepth);
+#endif
 
     cudaError_t err = cudaMemcpy(&res, gpu_perft, sizeof(uint64), cudaMemcpyDeviceToHost);
     gputime.stop();
@@ -1591,6 +3053,7 @@ void processPerftRecords(int argc, char *argv[])
     }
     int g = atoi(argv[2]);
     initGPU(g);
+    planTTMemory(depth, 0);
     setupHashTables128b(TransTables128b[g]);
     MoveGeneratorBitboard::init();
 
@@ -1645,7 +3108,7 @@ void processPerftRecords(int argc, char *argv[])
         cudaMemset(gpu_perft[g], 0, sizeof(uint64));
         cudaMemcpy(gpuHashes[g], &posHash128b, sizeof(HashKey128b), cudaMemcpyHostToDevice);
 
-        perft_bb_gpu_simple_hash <<<1, 1 >>> (1, gpuBoard[g], gpuHashes[g], gpu_perft[g], depth, preAllocatedBufferHost[g], TransTables128b[g], true);
+        perft_bb_gpu_simple_hash SINGLE_THREAD_LAUNCH (1, gpuBoard[g], gpuHashes[g], gpu_perft[g], depth, preAllocatedBufferHost[g], TransTables128b[g], true);
 
 
         uint64 res;
@@ -1699,24 +3162,7 @@ void checkAndCreateDiskHash()
 {
 #if USE_TRANSPOSITION_TABLE == 1
 #if ENABLE_DISK_HASH == 1
-    // check if disk hash table is present, if not create one
-
-    // the first 2^20 entries is the table part containing indexes to the chained part
-    // the chained part immediately follow.
-    // Every entry is a DiskHashEntry structure which is of 32 bytes
-    //
-    // size of chained part (and so the next pointer to free space) isn't 
-    // stored anywhere - it's computed from file size
-
-    int fd = open("perfthash.dat", O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fd != -1)
-    {
-        DiskHashEntry emptyEntry = {};
-        for(int i = 0; i < GET_TT_SIZE_FROM_BITS(DISK_TT_BITS); i++)
-            write(fd, &emptyEntry, sizeof(DiskHashEntry));
-        close(fd);
-    }
-    
+    diskTTOpen();
 #endif
 #endif
 }
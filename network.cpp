@@ -2,6 +2,9 @@
 
 #include "chess.h"
 
+// the network mode only shares transposition table entries
+#if USE_TRANSPOSITION_TABLE == 1
+
 #include <stdlib.h>
 #include <thread>
 #include <mutex>
@@ -31,6 +34,13 @@
 #include <unistd.h>
 #include <sys/file.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <vector>
+#include <algorithm>
+
 
 void printIpAddress(char *addrString)
 {
@@ -183,16 +193,17 @@ void lockCompleteTT();
 void unlockCompleteTT();
 
 // accessors for  transferring entire completeTT
-extern CompleteHashEntry *completeTT;
-
-extern CompleteHashEntry *chainMemoryChunks[1024];
-extern int nChunks;
-extern uint64 chainIndex;
+extern CompactHashEntry *completeTT;
 extern uint64 completeTTSize;
-extern uint64 chainMemorySize;
+extern int completeTTBits;
 
+// the overflow table (entries that didn't fit in their group) goes along with it
+extern CompleteHashEntry completeTTOverflow[];
+extern uint64 completeTTOverflowSize;
+extern std::mutex completeTTOverflowCS;
 
-void allocChainMemoryChunk();
+void resizeCompleteTT(int bits);
+void completeTTMarkAllDirty();
 
 
 // read write 1MB chunks
@@ -252,123 +263,223 @@ int readDataNetwork(int sockfd, void *data, uint64 size)
 
 
 // network communication protocol
-// client connects to server and sends:
-// COMMAND <params> <data>
+// every node keeps one connection open to each of the other nodes, and sends frames over it:
+// NetworkFrameHeader (command, numItems) followed by the items
 // two types of commands are supported
 //  1    numWorkItems item0 item1 item2 ...             // For sending work items to server
-//  2                                                   // for full TT copy request
-//   - upon recieving TT copy request (2), server will send a uint64 which is no of ChainEntries, 
-//     followed by main hash table part, followed by data in chain part
+//  4    0                                              // ip address request (a node asking how others see it)
+//   - upon recieving ip request (4), server replies with 32 bytes (the address as a string)
+// the entire complete TT is sent by another server (on completeTTPort()): upon connecting, it sends an int which is
+// log2 of no. of entries in the table, followed by the table and then the overflow table
+
+struct NetworkFrameHeader
+{
+    uint32 command;
+    uint32 numItems;
+};
+
+// the port of the complete TT server of the node listening for work items on the given port
+// (so that several nodes can run on one machine, each with its own ports)
+uint32 completeTTPort(uint32 nodePort)
+{
+    return (nodePort + COMPLETE_TT_PORT - BROADCAST_PORT) & 0xFFFF;
+}
+
+bool isOwnNode(int i)
+{
+    return nodePorts[i] == myPort && strcmp(nodeIPs[i], myAddress) == 0;
+}
+
+int connectToNode(const char *ip, uint32 port)
+{
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(sockfd >= 0);
+    struct sockaddr_in serv_addr = {};
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &serv_addr.sin_addr);
+
+    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    {
+        int err = errno;
+        close(sockfd);
+        errno = err;
+        return -1;
+    }
+    return sockfd;
+}
+
+// writes all the buffers, returns -1 on error
+// (on a non-blocking socket it waits for the socket to become writable when the send buffer is full)
+int writeFrameNetwork(int sockfd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt)
+    {
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t n = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            struct pollfd pfd = {};
+            pfd.fd = sockfd;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                return -1;
+            continue;
+        }
+        if (n <= 0)
+            return -1;
+
+        while (iovcnt && (size_t) n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt)
+        {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+
+// connections of the broadcaster thread to the other nodes (kept open across batches)
+struct PeerConnection
+{
+    char ip[16];
+    uint32 port;
+    int fd;
+};
+PeerConnection peers[MAX_NODES];
+int numPeers = 0;
+
+void closePeerConnection(int p)
+{
+    close(peers[p].fd);
+    peers[p] = peers[--numPeers];
+}
+
+// the connection to node i (connects if there isn't one), -1 if the node can't be reached
+int peerConnection(int i)
+{
+    for (int p = 0; p < numPeers; p++)
+        if (peers[p].port == nodePorts[i] && strcmp(peers[p].ip, nodeIPs[i]) == 0)
+            return peers[p].fd;
+
+    int sockfd = connectToNode(nodeIPs[i], nodePorts[i]);
+    if (sockfd < 0)
+    {
+        if (reachable[i])
+        {
+            FILE *fplog = fopen(myUID, "ab+");
+            fprintf(fplog, "broadcaster thread had issues connecting to %s:%u, connect returned: %s\n", nodeIPs[i], nodePorts[i], strerror(errno));
+            fclose(fplog);
+        }
+        return -1;
+    }
+
+    strcpy(peers[numPeers].ip, nodeIPs[i]);
+    peers[numPeers].port = nodePorts[i];
+    peers[numPeers].fd = sockfd;
+    numPeers++;
+    return sockfd;
+}
+
+// closes the connections to nodes that are no longer in the list
+void dropStalePeerConnections()
+{
+    for (int p = numPeers - 1; p >= 0; p--)
+    {
+        bool found = false;
+        for (int i = 0; i < numNodes && !found; i++)
+            found = peers[p].port == nodePorts[i] && strcmp(peers[p].ip, nodeIPs[i]) == 0;
+        if (!found)
+            closePeerConnection(p);
+    }
+}
+
+// sends a frame to node i (reconnecting once if the connection broke, e.g, the node restarted)
+bool sendFrameToNode(int i, NetworkFrameHeader *header, struct iovec *items, int numBuffers)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int sockfd = peerConnection(i);
+        if (sockfd < 0)
+            return false;
+
+        struct iovec iov[3];
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(NetworkFrameHeader);
+        memcpy(&iov[1], items, numBuffers * sizeof(struct iovec));
+        if (writeFrameNetwork(sockfd, iov, numBuffers + 1) == 0)
+            return true;
+
+        FILE *fplog = fopen(myUID, "ab+");
+        fprintf(fplog, "error writing work items when broadcasting work items, node: %s:%u, error: %s\n", nodeIPs[i], nodePorts[i], strerror(errno));
+        fclose(fplog);
+        for (int p = 0; p < numPeers; p++)
+            if (peers[p].fd == sockfd)
+                closePeerConnection(p);
+    }
+    return false;
+}
 
 void broadcaster_thread_body()
 {
     int counter = 0;
-    //printf("broadcaster thread begins\n");    
+    //printf("broadcaster thread begins\n");
 
-    while(!broadcasterThreadKillRequest)
+    while(1)
     {
         // send queued up work items to other nodes
-        int firstItem = (get+1) % MAX_QUEUE_LENGTH;
-        while(firstItem == put) 
+        // (the items queued before the kill request are still sent)
+        bool exitRequested = broadcasterThreadKillRequest;
+        uint32 firstItem = (get+1) % MAX_QUEUE_LENGTH;
+        uint32 endItem = put;
+        if (firstItem == endItem)
         {
-            usleep(1000);
-            if(broadcasterThreadKillRequest)
+            if (exitRequested)
                 break;
+            usleep(1000);
+            continue;
         }
+        uint32 lastItem = (endItem + MAX_QUEUE_LENGTH - 1) % MAX_QUEUE_LENGTH;
 
-        if(broadcasterThreadKillRequest)
-            break;
-        
-        int lastItem = (put-1);
-        if (lastItem == -1) lastItem = MAX_QUEUE_LENGTH - 1;
-
-        int numItems = 1;
-        for (int item = firstItem; item != lastItem; item = (item +1) % MAX_QUEUE_LENGTH)
-            numItems++;
+        // all the items in one frame (in two pieces when they wrap around the end of the queue)
+        NetworkFrameHeader header = {};
+        header.command = 1;
+        header.numItems = (endItem + MAX_QUEUE_LENGTH - firstItem) % MAX_QUEUE_LENGTH;
 
+        struct iovec items[2];
+        int numBuffers = 1;
+        items[0].iov_base = &WorkQueue[firstItem];
+        if (endItem > firstItem)
+        {
+            items[0].iov_len = header.numItems * sizeof(NetworkWorkItem);
+        }
+        else
+        {
+            items[0].iov_len = (MAX_QUEUE_LENGTH - firstItem) * sizeof(NetworkWorkItem);
+            items[1].iov_base = &WorkQueue[0];
+            items[1].iov_len = endItem * sizeof(NetworkWorkItem);
+            numBuffers = (endItem > 0) ? 2 : 1;
+        }
 
         bool unreachableDetected = false;
         for (int i = 0; i < numNodes; i++)
         {
-            if(strcmp(myAddress, nodeIPs[i]))
+            if (!isOwnNode(i))
             {
-                int sockfd = 0;
-                struct sockaddr_in serv_addr = {}; 
-                sockfd = socket(AF_INET, SOCK_STREAM, 0);
-                assert(sockfd >= 0);
-                serv_addr.sin_family = AF_INET;
-                serv_addr.sin_port = htons(nodePorts[i]); 
-                inet_pton(AF_INET, nodeIPs[i], &serv_addr.sin_addr);
-
-                //clientCS.lock();
-                int result = connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-                if (result < 0)
-                {
-                    if (reachable[i])
-                    {
-                        FILE *fplog = fopen(myUID, "ab+");
-                        fprintf(fplog, "broadcaster thread had issues connecting to %s:%u, connect returned: %s\n", nodeIPs[i], nodePorts[i], strerror(errno));        
-                        fclose(fplog);
-                    }
-                    
-                    // some error in connecting, mark un-reachable
-                    reachable[i] = false;
+                // some error in connecting or sending, mark un-reachable
+                reachable[i] = sendFrameToNode(i, &header, items, numBuffers);
+                if (!reachable[i])
                     unreachableDetected = true;
-                }
-                else
-                {
-                    reachable[i] = true;
-                    uint32 command = 1;
-
-                    int n = write(sockfd, &command, sizeof(uint32));
-                    if (n<=0)
-                    {
-                        printf("\nerror writing command for broadcasting work items\n");
-                        fflush(stdout);
-                        //exit(0);
-                        close(sockfd);
-                        continue;
-                    }
-                    
-                    n = write(sockfd, &numItems, sizeof(uint32));
-                    if (n<=0)
-                    {
-                        printf("\nerror writing numItems for broadcasting work items\n");
-                        fflush(stdout);
-                        //exit(0);
-                        close(sockfd);
-                        continue;
-                    }
-                    bool caughtError = false;
-                    for (int item = firstItem; item != lastItem; item = (item +1) % MAX_QUEUE_LENGTH)
-                    {
-                        n = write(sockfd, &WorkQueue[item], sizeof(NetworkWorkItem));
-                        if (n<=0)
-                        {
-                            printf("\nerror writing work items when broadcasting work items, node: %s, error: %s\n", nodeIPs[i], strerror(errno));
-                            fflush(stdout);
-                            //exit(0);
-                            close(sockfd);
-                            caughtError = true;
-                            break;
-                        }
-                    }
-                    if (caughtError)
-                        continue;
-
-                    n = write(sockfd, &WorkQueue[lastItem], sizeof(NetworkWorkItem));       
-                    if (n<=0)
-                    {
-                        printf("\nerror writing last work item when broadcasting work items, node: %s, error: %s\n", nodeIPs[i], strerror(errno));
-                        fflush(stdout);
-                        //exit(0);
-                        close(sockfd);
-                        continue;
-                    }
-                    
-                    close(sockfd);
-                }
-                //clientCS.unlock();                
             }
         }
 
@@ -380,7 +491,7 @@ void broadcaster_thread_body()
             int lfd;
             while((lfd = open("net.lock", O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) ;
             close(lfd);
-            
+
             // remove unreachable nodes from list
             char oldIPs[MAX_NODES][16];
             uint32 oldPorts[MAX_NODES];
@@ -394,7 +505,7 @@ void broadcaster_thread_body()
                     strcpy(nodeIPs[newCount], oldIPs[i]);
                     nodePorts[newCount++] = oldPorts[i];
                 }
-            numNodes = newCount;            
+            numNodes = newCount;
 
             // write updated list to file
             FILE *fp = fopen("nodes.txt", "wb+");
@@ -406,17 +517,23 @@ void broadcaster_thread_body()
         }
 #endif
         get = lastItem;
+        if (exitRequested)
+            continue;
+
         usleep(10000);  // wait for 10 ms
         counter++;
         if (counter % 100 == 0)
         {
             // update list of active nodes every second
             updateNodesList();
+            dropStalePeerConnections();
         }
     }
 
+    while (numPeers)
+        closePeerConnection(numPeers - 1);
+
     //printf("broadcaster thread ends\n");
-    broadcasterThreadKillRequest = false;    
 }
 
 #if 0
@@ -479,30 +596,41 @@ void completeTTServer(struct sockaddr_in client_addr)
 }
 #endif
 
-#if 1
-void completeTTServer()
+
+int openListenSocket(uint32 port)
 {
-    // open a socket and start listening for clients
-    int listenfd = 0, connfd = 0;
-    struct sockaddr_in serv_addr = {}; 
-    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt));
+
+    struct sockaddr_in serv_addr = {};
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(COMPLETE_TT_PORT);
+    serv_addr.sin_port = htons(port);
 
-    int result = bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)); 
+    int result = bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
     if (result < 0)
     {
-        printf("some error at bind() call in completeTTServer: %d\n", result);
+        printf("some error at bind() call for port %u: %s\n", port, strerror(errno));
         exit(-1);
     }
-    
-    result = listen(listenfd, 32); 
+
+    result = listen(listenfd, 32);
     if (result < 0)
     {
-        printf("some error at listen() call in completeTTServer: %d\n", result);
+        printf("some error at listen() call for port %u: %s\n", port, strerror(errno));
         exit(-1);
     }
+    return listenfd;
+}
+
+int completeTTListenFd = -1;
+
+#if 1
+void completeTTServer()
+{
+    // start listening for clients (endNetworkThread() shuts the socket down to end the thread)
+    int listenfd = completeTTListenFd, connfd = 0;
 
     while(1)
     {
@@ -517,6 +645,8 @@ void completeTTServer()
 
         if (connfd < 0)
         {
+            if (networkThreadKillRequest)
+                break;
             printf("some error after accept() call\n");
             exit(-1);
         }
@@ -532,12 +662,12 @@ void completeTTServer()
         sendingCompleteTT = true;
         lockCompleteTT();
 
-        // 2. write first the hash table part of the complete TT and then the chain part
+        // 2. write the size of the complete TT and then the table
         auto t_start = std::chrono::high_resolution_clock::now();
-        int n = write(connfd, &nChunks, sizeof(int));
+        int n = write(connfd, &completeTTBits, sizeof(int));
         if (n<=0)
         {
-            printf("\nerror writing value of nChunks when sending complete TT\n");
+            printf("\nerror writing size of complete TT when sending complete TT\n");
             fflush(stdout);
             //exit(0);
             unlockCompleteTT();
@@ -546,19 +676,13 @@ void completeTTServer()
             continue;
         }
 
-        n = write(connfd, &chainIndex, sizeof(uint64));
-        if (n<=0)
+        n = writeDataNetwork(connfd, completeTT, completeTTSize);
+        if (n >= 0)
         {
-            printf("\nerror writing value of chainIndex when sending complete TT\n");
-            fflush(stdout);
-            //exit(0);
-            unlockCompleteTT();
-            sendingCompleteTT = false;
-            close(connfd);
-            continue;
+            completeTTOverflowCS.lock();
+            n = writeDataNetwork(connfd, completeTTOverflow, completeTTOverflowSize);
+            completeTTOverflowCS.unlock();
         }
-
-        n = writeDataNetwork(connfd, completeTT, completeTTSize);
         if (n<0)
         {
             unlockCompleteTT();
@@ -566,21 +690,6 @@ void completeTTServer()
             close(connfd);
             continue;
         }
-        bool gotError = false;
-        for (int i=0;i<nChunks;i++)
-        {
-            n = writeDataNetwork(connfd, chainMemoryChunks[i], chainMemorySize);
-            if (n < 0)
-            {
-                unlockCompleteTT();
-                sendingCompleteTT = false;
-                close(connfd);
-                gotError = true;
-                break;
-            }
-        }
-        if (gotError)
-            continue;
 
         auto t_end = std::chrono::high_resolution_clock::now();
         double transferTime = std::chrono::duration<double>(t_end-t_start).count();
@@ -590,7 +699,7 @@ void completeTTServer()
 
         fplog = fopen(myUID, "ab+");
         fprintf(fplog, "Complete TT send complete, time taken: %g seconds observed network bandwidth: %g MBps\n", 
-                        transferTime, (completeTTSize + nChunks * chainMemorySize)/(1024*1024*transferTime));
+                        transferTime, completeTTSize/(1024*1024*transferTime));
         fclose(fplog);
 
         close(connfd);
@@ -600,6 +709,100 @@ void completeTTServer()
 }
 #endif
 
+
+// receiving side: the network thread waits for data on all the connections from other nodes with epoll, and reads
+// whatever is available into the staging buffer of the connection (non-blocking). Complete items are added to the
+// complete TT right away, a partly received item or header stays in the buffer till the rest of it comes
+#define NETWORK_STAGING_SIZE    (64 * 1024)
+#define NETWORK_MAX_EVENTS      64
+
+struct IncomingConnection
+{
+    int fd;
+    char ip[32];
+    uint32 itemsLeft;       // items of the current frame not yet received
+    uint32 bytes;           // in the staging buffer
+    uint64 buffer[NETWORK_STAGING_SIZE / sizeof(uint64)];
+};
+
+int networkWakeFd = -1;     // eventfd to wake up the network thread (when exiting)
+
+// handles the complete items/frames in the staging buffer, returns false if the connection should be closed
+bool processStagedData(IncomingConnection *conn)
+{
+    char *data = (char *) conn->buffer;
+    uint32 pos = 0;
+    while (1)
+    {
+        if (conn->itemsLeft == 0)
+        {
+            if (conn->bytes - pos < sizeof(NetworkFrameHeader))
+                break;
+
+            NetworkFrameHeader header;
+            memcpy(&header, data + pos, sizeof(header));
+            pos += sizeof(header);
+
+            if (header.command == 1)
+            {
+                // update work items in local TT from client node
+                conn->itemsLeft = header.numItems;
+            }
+            else if (header.command == 4)
+            {
+                // get my IP address!
+                struct iovec iov;
+                iov.iov_base = conn->ip;
+                iov.iov_len = sizeof(conn->ip);
+                if (writeFrameNetwork(conn->fd, &iov, 1) != 0)
+                {
+                    printf("\nerror writing client IP\n");
+                    fflush(stdout);
+                }
+
+                FILE *fplog = fopen(myUID, "ab+");
+                fprintf(fplog, "Got ip request from: %s\n", conn->ip);
+                fclose(fplog);
+            }
+            else
+            {
+                FILE *fplog = fopen(myUID, "ab+");
+                fprintf(fplog, "Unknown command %u from %s, closing the connection\n", header.command, conn->ip);
+                fclose(fplog);
+                return false;
+            }
+        }
+        else
+        {
+            uint32 n = min(conn->itemsLeft, (uint32) ((conn->bytes - pos) / sizeof(NetworkWorkItem)));
+            if (n == 0)
+                break;
+
+            NetworkWorkItem *items = (NetworkWorkItem *) (data + pos);
+            if (!sendingCompleteTT)
+            {
+                // avoid blocking the network
+                for (uint32 i = 0; i < n; i++)
+                    completeTTUpdateFromNetwork(items[i].hash, items[i].perft);
+            }
+            pos += n * sizeof(NetworkWorkItem);
+            conn->itemsLeft -= n;
+        }
+    }
+
+    // keep the incomplete part for the next read
+    conn->bytes -= pos;
+    memmove(data, data + pos, conn->bytes);
+    return true;
+}
+
+void closeIncomingConnection(int epfd, IncomingConnection *conn)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    delete conn;
+}
+
 // main network thread responsible for sharing work items across multiple nodes on network
 // 1. adds own ip address to the file containing list of nodes
 // 2. wait for clients to connect
@@ -611,21 +814,22 @@ void network_thread_body()
 
 
     // open a socket and start listening for clients
-    int listenfd = 0, connfd = 0;
-    struct sockaddr_in serv_addr = {}; 
-    listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(myPort);
+    int listenfd = openListenSocket(myPort);
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
 
     FILE *fplog = fopen(myUID, "ab+");
-    int result = bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)); 
-    fprintf(fplog, "bind returned: %d\n", result);
-    result = listen(listenfd, 32); 
-    fprintf(fplog, "listen returned: %d\n", result);
+    fprintf(fplog, "listening on port: %u\n", myPort);
     fprintf(fplog, "num of nodes found: %d\n", numNodes);    
     fclose(fplog);
 
+    // the listening socket and the wake up eventfd are told apart from connections by the data pointer (NULL / self)
+    int epfd = epoll_create1(0);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+    ev.data.ptr = &networkWakeFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, networkWakeFd, &ev);
 
     // start broadcster thread
     broadcasterThread       = std::thread(broadcaster_thread_body);
@@ -641,66 +845,69 @@ void network_thread_body()
     fclose(fp);            
     remove("net.lock");
 
+    std::vector<IncomingConnection *> connections;
     while(!networkThreadKillRequest)
     {
-        struct sockaddr_in clientAddr = {};
-        socklen_t addrLen = sizeof(clientAddr);
-        connfd = accept(listenfd, (sockaddr*) &clientAddr, &addrLen); 
-        uint32 command = 0;
-        read(connfd, &command, sizeof(uint32));
-
-        if (command == 1)
+        struct epoll_event events[NETWORK_MAX_EVENTS];
+        int nEvents = epoll_wait(epfd, events, NETWORK_MAX_EVENTS, -1);
+        for (int e = 0; e < nEvents; e++)
         {
-            // update work items in local TT from client node
-            uint32 items = 0;
-            read(connfd, &items, sizeof(uint32));
-            for (int i=0;i<items;i++)
+            if (events[e].data.ptr == &networkWakeFd)
+                continue;
+
+            if (events[e].data.ptr == NULL)
             {
-                NetworkWorkItem workItem = {};
-                read(connfd, &workItem, sizeof(NetworkWorkItem));
-                if (!sendingCompleteTT)
+                // new connections from other nodes
+                struct sockaddr_in clientAddr = {};
+                socklen_t addrLen = sizeof(clientAddr);
+                int connfd;
+                while ((connfd = accept4(listenfd, (sockaddr*) &clientAddr, &addrLen, SOCK_NONBLOCK)) >= 0)
                 {
-                    // avoid blocking the network
-                    completeTTUpdateFromNetwork(workItem.hash, workItem.perft);
+                    IncomingConnection *conn = new IncomingConnection;
+                    conn->fd = connfd;
+                    conn->ip[0] = 0;
+                    inet_ntop(AF_INET, &clientAddr.sin_addr, conn->ip, sizeof(conn->ip));
+                    conn->itemsLeft = 0;
+                    conn->bytes = 0;
+
+                    struct epoll_event connEv = {};
+                    connEv.events = EPOLLIN;
+                    connEv.data.ptr = conn;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &connEv);
+                    connections.push_back(conn);
+                    addrLen = sizeof(clientAddr);
                 }
+                continue;
             }
-        }
-        else if (command == 2)
-        {
-            // start complete TT server thread (that sends the entire TT piece by piece to the client who requested it)
-            //completeTTServerThread  = std::thread(completeTTServer, clientAddr);
-            
-        }
-        else if (command == 3)
-        {
-            // exit request
-        }
-        else if (command == 4)
-        {
-            // get my IP address!
-            char clientip[32]; clientip[0] = 0;
-            inet_ntop(AF_INET, &clientAddr.sin_addr, clientip, sizeof(clientip));
-            int n = write(connfd, clientip, sizeof(clientip));
-            if (n <= 0)
+
+            // one read of whatever is there (level triggered: epoll reports it again if there is more)
+            IncomingConnection *conn = (IncomingConnection *) events[e].data.ptr;
+            ssize_t n = read(conn->fd, (char *) conn->buffer + conn->bytes, NETWORK_STAGING_SIZE - conn->bytes);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                continue;
+
+            bool keep = n > 0;
+            if (keep)
             {
-                printf("\nerror writing client IP\n");
-                fflush(stdout);
-                //exit(0);
+                conn->bytes += (uint32) n;
+                keep = processStagedData(conn);
+            }
+            if (!keep)
+            {
+                // the other node closed the connection (or exited)
+                connections.erase(std::find(connections.begin(), connections.end(), conn));
+                closeIncomingConnection(epfd, conn);
             }
-
-            FILE *fplog = fopen(myUID, "ab+");
-            fprintf(fplog, "Got ip request from: %s\n", clientip);
-            fclose(fplog);
         }
-        close(connfd);                    
     }
+
+    for (size_t i = 0; i < connections.size(); i++)
+        closeIncomingConnection(epfd, connections[i]);
+    close(epfd);
     close (listenfd);
 
     //printf("waiting for broadcaster thread to die\n");
-    while(broadcasterThreadKillRequest) ;    
     broadcasterThread.join();
-
-    networkThreadKillRequest = false;
 }
 
 #include <signal.h>
@@ -712,6 +919,28 @@ void signal_callback_handler(int signum)
 }
 
 
+bool myAddressGiven = false;
+
+// sets the address and port of this node from the command line ("<address>[:<port>]")
+// (otherwise createNetworkThread() finds out the address from other nodes - or ip.txt for the first node - and uses
+// the default port). Called at startup, before any threads are started
+void setNetworkNode(const char *node)
+{
+    char address[64] = {};
+    unsigned int port = BROADCAST_PORT;
+    struct in_addr addr;
+    int fields = sscanf(node, "%63[^:]:%u", address, &port);
+    if (fields < 1 || strlen(address) >= sizeof(myAddress) || inet_pton(AF_INET, address, &addr) != 1 ||
+        port == 0 || port > 0xFFFF)
+    {
+        printf("\nInvalid -node=%s: expected <address>[:<port>] with an IPv4 address\n", node);
+        exit(0);
+    }
+    snprintf(myAddress, sizeof(myAddress), "%s", address);
+    myPort = port;
+    myAddressGiven = true;
+}
+
 void createNetworkThread()
 {
     signal(SIGPIPE, signal_callback_handler);
@@ -721,32 +950,28 @@ void createNetworkThread()
     numNodes = 0;
     updateNodesList();
 
-    if (numNodes > 0)
+    // own address and port: given on command line (see setNetworkNode()), or find out the address
+    if (!myAddressGiven)
+        myPort = BROADCAST_PORT;
+
+    if (!myAddressGiven && numNodes > 0)
     {
         // get own IP address from an existing node
-        int sockfd = 0;
-        struct sockaddr_in serv_addr = {}; 
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        assert(sockfd >= 0);
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(nodePorts[0]); 
-        inet_pton(AF_INET, nodeIPs[0], &serv_addr.sin_addr);
-
-        int result = connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-        uint32 command = 4;
-        int n = write(sockfd, &command, sizeof(uint32));
-        if (n<=0)
+        int sockfd = connectToNode(nodeIPs[0], nodePorts[0]);
+        NetworkFrameHeader request = {};
+        request.command = 4;
+        if (sockfd < 0 || write(sockfd, &request, sizeof(request)) <= 0)
         {
             printf("\nerror writing command for getting ip address\n");
             fflush(stdout);
             exit(0);
         }
-        char buf[32];
-        read(sockfd, buf, sizeof(buf));
+        char buf[32] = {};
+        readDataNetwork(sockfd, buf, sizeof(buf));
         strcpy(myAddress, buf);
         close(sockfd);
     }
-    else
+    else if (!myAddressGiven)
     {
         // hack! get ip address from a file where it's manually entered!
         FILE *fp;
@@ -761,88 +986,71 @@ void createNetworkThread()
     }
 
     // add current node to the list
+    for (int i = 0; i < numNodes; i++)
+    {
+        if (isOwnNode(i))
+        {
+            // (left in the list by an earlier run that didn't exit cleanly)
+            numNodes--;
+            strcpy(nodeIPs[i], nodeIPs[numNodes]);
+            nodePorts[i] = nodePorts[numNodes];
+            break;
+        }
+    }
     reachable[numNodes] = true;
     strcpy(nodeIPs[numNodes], myAddress);
-    myPort = BROADCAST_PORT;
     nodePorts[numNodes] = myPort;
     numNodes++;
     sprintf(myUID, "%s_%u", myAddress, myPort);
 
+    networkWakeFd = eventfd(0, 0);
+    completeTTListenFd = openListenSocket(completeTTPort(myPort));
     
     if (numNodes > 1)
     {
         // ask server (first already running node) to send complete TT
-        int sockfd = 0;
-        struct sockaddr_in serv_addr = {}; 
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        assert(sockfd >= 0);
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(COMPLETE_TT_PORT); 
-        inet_pton(AF_INET, nodeIPs[0], &serv_addr.sin_addr);
-
-        int result = connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-        //uint32 command = 2;
-        //write(sockfd, &command, sizeof(uint32));
+        int sockfd = connectToNode(nodeIPs[0], completeTTPort(nodePorts[0]));
 
-        if (result < 0)
+        if (sockfd < 0)
         {
             FILE *fplog = fopen(myUID, "ab+");
-            fprintf(fplog, "newly started node had issues getting complete TT from %s:%u, connect returned: %s\n", nodeIPs[0], COMPLETE_TT_PORT, strerror(errno));        
+            fprintf(fplog, "newly started node had issues getting complete TT from %s:%u, connect returned: %s\n", nodeIPs[0], completeTTPort(nodePorts[0]), strerror(errno));        
             fclose(fplog);
         }
         else
         {
-            // read first the hash table part of the complete TT and then the chain part
+            // read the size of the complete TT and then the table
             auto t_start = std::chrono::high_resolution_clock::now();
 
-            int incomingChunks = 0;
-            read(sockfd, &incomingChunks, sizeof(int));
+            int incomingBits = 0;
+            read(sockfd, &incomingBits, sizeof(int));
 
-            uint64 incomingChainIndex = 0;
-            read(sockfd, &incomingChainIndex, sizeof(uint64));
-            
             FILE *fplog = fopen(myUID, "ab+");
-            fprintf(fplog, "no of incoming chunks: %d, chainIndex: %llu\n", incomingChunks, incomingChainIndex);
+            fprintf(fplog, "incoming complete TT bits: %d\n", incomingBits);
             fclose(fplog);
-            
-            int n = readDataNetwork(sockfd, completeTT, completeTTSize);
-            if (n < 0)
-            {
-                exit(0);
-            }
 
-
-            for (int i=nChunks;i<incomingChunks;i++)
+            lockCompleteTT();
+            resizeCompleteTT(incomingBits);
+            int n = readDataNetwork(sockfd, completeTT, completeTTSize);
+            if (n >= 0)
             {
-                allocChainMemoryChunk();
+                completeTTOverflowCS.lock();
+                n = readDataNetwork(sockfd, completeTTOverflow, completeTTOverflowSize);
+                completeTTOverflowCS.unlock();
             }
-
-            for (int i=0;i<incomingChunks;i++)
+            completeTTMarkAllDirty();
+            unlockCompleteTT();
+            if (n < 0)
             {
-                n = readDataNetwork(sockfd, chainMemoryChunks[i], chainMemorySize);
-                if (n == -2)
-                {
-                    // HACK! server not willing to give any more chunks. Stop anyway :-/
-                    incomingChunks = i;
-                    incomingChainIndex = 0;
-                    printf("\nServer didn't give me all chunks :-/\n");
-                    break;
-                }
-                if (n < 0)
-                {
-                    exit(0);
-                }
+                exit(0);
             }
 
-            nChunks = incomingChunks;
-            chainIndex = incomingChainIndex;            
-
             auto t_end = std::chrono::high_resolution_clock::now();
             double transferTime = std::chrono::duration<double>(t_end-t_start).count();
 
             fplog = fopen(myUID, "ab+");
             fprintf(fplog, "Complete TT recieve complete, time taken: %g seconds observed network bandwidth: %g MBps\n", 
-                            transferTime, (completeTTSize + nChunks * chainMemorySize)/(1024*1024*transferTime));
+                            transferTime, completeTTSize/(1024*1024*transferTime));
             fclose(fplog);
 
             close(sockfd);
@@ -857,29 +1065,22 @@ void createNetworkThread()
 
 void endNetworkThread()
 {
-    // kill broadcaster thread
+    // kill broadcaster thread (after it has sent the queued up items)
     broadcasterThreadKillRequest = true;
     networkThreadKillRequest = true;
 
-    // request own network server thread to exit
-    {
-        int sockfd = 0;
-        struct sockaddr_in serv_addr = {}; 
-        sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        assert(sockfd >= 0);
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(myPort); 
-        inet_pton(AF_INET, myAddress, &serv_addr.sin_addr);
-
-        int result = connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-        uint32 command = 3;
-        write(sockfd, &command, sizeof(uint32));
-        close(sockfd);
-    }
+    // wake up own network server thread (and the complete TT server)
+    uint64 one = 1;
+    write(networkWakeFd, &one, sizeof(one));
+    shutdown(completeTTListenFd, SHUT_RDWR);
 
     //printf("waiting for main network thread to die\n");
-    while(networkThreadKillRequest) ;
     networkThread.join();
+    completeTTServerThread.join();
+    close(networkWakeFd);
+
+    broadcasterThreadKillRequest = false;
+    networkThreadKillRequest = false;
 }
 
 
@@ -940,28 +1141,19 @@ void endNetworkThread()
             // 1. take a lock on completeTT to make sure nobody updates it
             lockCompleteTT();
 
-            // 2. read first the hash table part of the complete TT and then the chain part
+            // 2. read the size of the complete TT and then the table
             auto t_start = std::chrono::high_resolution_clock::now();
 
-            int incomingChunks = 0;
-            read(sockfd, &incomingChunks, sizeof(int));
+            int incomingBits = 0;
+            read(sockfd, &incomingBits, sizeof(int));
 
             fplog = fopen(myUID, "ab+");
-            fprintf(fplog, "no of incoming chunks: %d\n", incomingChunks);
+            fprintf(fplog, "incoming complete TT bits: %d\n", incomingBits);
             fclose(fplog);
-            
-            readDataNetwork(sockfd, completeTT, completeTTSize);
-
 
-            for (int i=nChunks;i<incomingChunks;i++)
-            {
-                allocChainMemoryChunk();
-            }
-
-            for (int i=0;i<incomingChunks;i++)
-            {
-                readDataNetwork(sockfd, chainMemoryChunks[i], chainMemorySize);
-            }
+            resizeCompleteTT(incomingBits);
+            readDataNetwork(sockfd, completeTT, completeTTSize);
+            completeTTMarkAllDirty();
             unlockCompleteTT();
 
             auto t_end = std::chrono::high_resolution_clock::now();
@@ -969,10 +1161,12 @@ void endNetworkThread()
 
             fplog = fopen(myUID, "ab+");
             fprintf(fplog, "Complete TT recieve complete, time taken: %g seconds observed network bandwidth: %g MBps\n", 
-                            transferTime, (completeTTSize + nChunks * chainMemorySize)/(1024*1024*transferTime));
+                            transferTime, completeTTSize/(1024*1024*transferTime));
             fclose(fplog);
 
             close(sockfd);
         }
     }
 #endif
+
+#endif // #if USE_TRANSPOSITION_TABLE == 1
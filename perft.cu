@@ -1,13 +1,17 @@
-#include "device_launch_parameters.h"
 #include "perft_bb.h"
+#if CPU_ONLY_BUILD == 0
+#include "device_launch_parameters.h"
+#endif
 #include <math.h>
 #include <stdlib.h>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include "InfInt.h"
 
 #include "launcher.h"
 
+void setNetworkNode(const char *node);
 void createNetworkThread();
 void endNetworkThread();
 
@@ -19,12 +23,58 @@ int main(int argc, char *argv[])
     return 0;
 #endif
 
+    // optional switches (anywhere on the command line), taken out before the other arguments are parsed
+    // -sliding=<auto|kogge|magics|fancy|bytefancy|pext>: sliding attack lookup for CPU code (default: auto)
+    // -ttmem=<MB>: system memory to use for transposition tables (default: most of the available memory)
+    // -snapshot=<file>: periodically save the complete TT to the file, -resume: load it from there at startup
+    // -ttstats=<file>: write hash table statistics to the file (periodically and at exit)
+    // -node=<address>[:<port>]: address and port of this node in network mode (several nodes can run on one machine)
+    const char *slidingArg = NULL;
+    uint64 ttMemBudget = 0;
+    const char *snapshotFile = NULL;
+    const char *ttStatsFile = NULL;
+    const char *nodeArg = NULL;
+    bool resume = false;
+    int nArgs = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-sliding=", 9) == 0)
+            slidingArg = argv[i] + 9;
+        else if (strncmp(argv[i], "-ttmem=", 7) == 0)
+            ttMemBudget = atoll(argv[i] + 7);
+        else if (strncmp(argv[i], "-snapshot=", 10) == 0)
+            snapshotFile = argv[i] + 10;
+        else if (strcmp(argv[i], "-resume") == 0)
+            resume = true;
+        else if (strncmp(argv[i], "-ttstats=", 9) == 0)
+            ttStatsFile = argv[i] + 9;
+        else if (strncmp(argv[i], "-node=", 6) == 0)
+            nodeArg = argv[i] + 6;
+        else
+            argv[nArgs++] = argv[i];
+    }
+    argc = nArgs;
+
+#if MULTI_NODE_NETWORK_MODE == 1
+    if (nodeArg)
+        setNetworkNode(nodeArg);
+#else
+    if (nodeArg)
+        printf("\n-node is ignored: this build doesn't have network mode (see MULTI_NODE_NETWORK_MODE)\n");
+#endif
+
     BoardPosition testBoard;
 
     int totalGPUs;
     cudaGetDeviceCount(&totalGPUs);
 
+#if CPU_ONLY_BUILD == 1
+    printf("Host only build, no of CPU worker threads: %d", totalGPUs);
+#else
     printf("No of GPUs detected: %d", totalGPUs);
+#endif
+    if (totalGPUs > MAX_GPUs)
+        totalGPUs = MAX_GPUs;
 
     if (argc >= 4)
     {
@@ -40,25 +90,64 @@ int main(int argc, char *argv[])
         numGPUs = totalGPUs;
     }
 
-    checkAndCreateDiskHash();
+    int minDepth = 3;
+    int maxDepth = 3;
+    if (argc >= 3)
+    {
+        maxDepth = atoi(argv[2]);
+    }
 
-    allocCompleteTT();
+    for (int g = 0; g < numGPUs; g++)
+    {
+        initGPU(g);
+    }
 
-#if MULTI_NODE_NETWORK_MODE == 1
-    createNetworkThread();
-#endif    
+#if USE_TRANSPOSITION_TABLE == 1
+    // size the hash tables for the biggest perft of the run
+    planTTMemory(maxDepth, ttMemBudget);
+#endif
 
     for (int g = 0; g < numGPUs; g++)
     {
-        initGPU(g);
+        cudaSetDevice(g);
 #if USE_TRANSPOSITION_TABLE == 1
         setupHashTables128b(TransTables128b[g]);
 #endif
         MoveGeneratorBitboard::init();
     }
+
+#if USE_TRANSPOSITION_TABLE == 1
+    checkAndCreateDiskHash();
+
+    allocCompleteTT();
+
+#if USE_COMPLETE_TT_AT_LAST_CPU_LEVEL == 1
+    // (needs the zobrist keys from MoveGeneratorBitboard::init() to check the snapshot)
+    if (snapshotFile)
+    {
+        if (resume)
+            completeTTResumeSnapshot(snapshotFile);
+        startCompleteTTSnapshots(snapshotFile);
+    }
+#endif
+
+#if HOST_TT_STATS == 1
+    if (ttStatsFile)
+        startTTStats(ttStatsFile);
+#endif
+#endif
+
+#if MULTI_NODE_NETWORK_MODE == 1
+    createNetworkThread();
+#endif    
+
     // set default device to device 0
     cudaSetDevice(0);
 
+#if RUNTIME_SLIDING_BACKEND == 1
+    MoveGeneratorBitboard::selectSlidingBackend(slidingArg);
+#endif
+
     // some test board positions from http://chessprogramming.wikispaces.com/Perft+Results
     //Utils::readFENString("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", &testBoard); // start.. 20 positions
     Utils::readFENString("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -", &testBoard); // position 2 (caught max bugs for me)
@@ -69,17 +158,19 @@ int main(int argc, char *argv[])
     //Utils::readFENString("3Q4/1Q4Q1/4Q3/2Q4R/Q4Q2/3Q4/1Q4Rp/1K1BBNNk w - - 0 1", &testBoard); // - 218 positions.. correct!
     //Utils::readFENString("r1b1kbnr/pppp1ppp/2n1p3/6q1/6Q1/2N1P3/PPPP1PPP/R1B1KBNR w KQkq - 4 4", &testBoard); // temp test
 
-    int minDepth = 3;
-    int maxDepth = 3;
     char fen[1024];
     if (argc >= 3)
     {
         strcpy(fen, argv[1]);
-        maxDepth = atoi(argv[2]);
     }
     else
     {
         printf("\nUsage perft_gpu <fen> <depth> [<launchdepth>]\n");
+        printf("  -sliding=<auto|kogge|magics|fancy|bytefancy|pext> to pick the sliding attack lookup used on CPU\n");
+        printf("  -ttmem=<MB> to set the system memory used for transposition tables\n");
+        printf("  -snapshot=<file> to save the complete TT periodically, with -resume to continue from the saved one\n");
+        printf("  -ttstats=<file> to write hash table statistics (JSON) periodically and at exit\n");
+        printf("  -node=<address>[:<port>] to set the address (and port) of this node in network mode\n");
         printf("\nAs no paramaters were provided... running default test\n");
     }
 
@@ -112,7 +203,8 @@ int main(int argc, char *argv[])
     // and 1 GB is not sufficient for computing perft 11!
     
     uint32 launchDepth = estimateLaunchDepth(&testBB);
-    launchDepth = min(launchDepth, 11); // don't go too high
+    if (launchDepth > 11)
+        launchDepth = 11; // don't go too high
 
 #if USE_TRANSPOSITION_TABLE == 0
     // for best performance without GPU hash (also set PREALLOCATED_MEMORY_SIZE to 3 x 768MB)
@@ -141,10 +233,19 @@ int main(int argc, char *argv[])
 #endif        
 
 #if USE_TRANSPOSITION_TABLE == 1
+#if HOST_TT_STATS == 1
+    stopTTStats();
+#endif
+#if ENABLE_DISK_HASH == 1
+    diskTTClose();
+#endif
     freeHashTables();
 #endif
 
+#if USE_TRANSPOSITION_TABLE == 1
+    stopCompleteTTSnapshots();
     freeCompleteTT();
+#endif
 
     for (int g = 0; g < numGPUs; g++)
     {
@@ -153,11 +254,14 @@ int main(int argc, char *argv[])
     }
 
 #if USE_TRANSPOSITION_TABLE == 1    
-    printf("\nComplete hash sysmem memory usage: %llu bytes\n", ((uint64) chainIndex) * sizeof(CompleteHashEntry));
+    printf("\nComplete hash sysmem memory usage: %llu bytes\n", (uint64) completeTTSize);
     printf("\nMax tree storage GPU memory usage: %llu bytes\n", maxMemoryUsage);
     printf("Regular depth %d Launches: %d\n", GPU_LAUNCH_DEPTH, numRegularLaunches);
     printf("Retry launches: %d\n", numRetryLaunches);
     printf("No of work items recieved from peers: %llu\n", numItemsFromPeers);
+#if CANONICAL_TT_KEYS == 1
+    printf("Host hash probes with a symmetric variant's key: %llu, hits: %llu\n", (uint64) numSymmetricProbes, (uint64) numSymmetricHits);
+#endif
 #endif
 
     return 0;
@@ -3,10 +3,18 @@
 // the routines that actually generate the moves
 #include "MoveGeneratorBitboard.h"
 
+#if CPU_ONLY_BUILD == 1
+// each CPU worker thread acts as a 'GPU'
+#define MAX_GPUs 64
+             void   *preAllocatedBufferHost[MAX_GPUs];
+thread_local void   *preAllocatedBuffer;
+thread_local uint32  preAllocatedMemoryUsed;
+#else
 #define MAX_GPUs 8
            void   *preAllocatedBufferHost[MAX_GPUs];
 __device__ void   *preAllocatedBuffer;
 __device__ uint32  preAllocatedMemoryUsed;
+#endif
 
 // use parallel scan and interval expand algorithms (from modern gpu lib) for 
 // performing the move list scan and 'expand' operation to set correct board pointers (of parent boards) for second level child moves
@@ -14,8 +22,10 @@ __device__ uint32  preAllocatedMemoryUsed;
 // Another possible idea to avoid this operation is to have GenerateMoves() generate another array containing the indices 
 // of the parent boards that generated the move (i.e, the global thread index for generateMoves kernel)
 // A scan will still be needed to figure out starting address to write, but we won't need the interval expand
+#if CPU_ONLY_BUILD == 0
 #include "moderngpu-master/include/kernels/scan.cuh"
 #include "moderngpu-master/include/kernels/intervalmove.cuh"
+#endif
 
 #if COUNT_NUM_COUNT_MOVES == 1
 __device__ uint64 numCountMoves;
@@ -72,34 +82,91 @@ uint32 generateBoards(HexaBitBoardPosition *pos, HexaBitBoardPosition *newPositi
     return nMoves;
 }
 
+void generateMoveSet(HexaBitBoardPosition *pos, MoveSet *moveSet)
+{
+#if USE_TEMPLATE_CHANCE_OPT == 1
+    if (pos->chance == BLACK)
+    {
+        MoveGeneratorBitboard::generateMoveSet<BLACK>(pos, moveSet);
+    }
+    else
+    {
+        MoveGeneratorBitboard::generateMoveSet<WHITE>(pos, moveSet);
+    }
+#else
+    MoveGeneratorBitboard::generateMoveSet(pos, moveSet, pos->chance);
+#endif
+}
+
+// the position after making the given move (without hash update)
+CPU_FORCE_INLINE void makeChildBoard(HexaBitBoardPosition *child, HexaBitBoardPosition *pos, CMove move)
+{
+    *child = *pos;
+    uint64 fakeHash = 0;
+#if USE_TEMPLATE_CHANCE_OPT == 1
+    if (pos->chance == BLACK)
+    {
+        MoveGeneratorBitboard::makeMove<BLACK, false>(child, fakeHash, move);
+    }
+    else
+    {
+        MoveGeneratorBitboard::makeMove<WHITE, false>(child, fakeHash, move);
+    }
+#else
+    MoveGeneratorBitboard::makeMove(child, fakeHash, move, pos->chance, false);
+#endif
+}
 
+#if USE_SIMD_COUNT_MOVES == 1 && !defined(__CUDACC__)
+#include "MoveGeneratorSIMD.h"
+#endif
 
-// A very simple CPU routine - only for estimating launch depth
-// this version doesn't use incremental hash
-uint64 perft_bb(HexaBitBoardPosition *pos, uint32 depth)
+#if USE_SIMD_COUNT_MOVES == 1 && !defined(__CUDACC__)
+// perft(2): the child boards are needed all at once by countMovesSimd()
+// (kept out of perft_bb() so that the recursion doesn't carry the big array)
+uint64 perft_bb_2(HexaBitBoardPosition *pos)
 {
     HexaBitBoardPosition newPositions[MAX_MOVES];
+    uint32 nMoves = generateBoards(pos, newPositions);
+    return countMovesSimd(newPositions, nMoves);
+}
+#endif
 
-    uint32 nMoves = 0;
-
+// A very simple CPU routine - for estimating launch depth
+// (and as the serial part of the multi-threaded CPU perft in perft_bb_mt.h)
+// this version doesn't use incremental hash
+uint64 perft_bb(HexaBitBoardPosition *pos, uint32 depth)
+{
     if (depth == 1)
     {
-        nMoves = countMoves(pos);
-        return nMoves;
+        return countMoves(pos);
     }
 
-    nMoves = generateBoards(pos, newPositions);
+#if USE_SIMD_COUNT_MOVES == 1 && !defined(__CUDACC__)
+    if (depth == 2)
+        return perft_bb_2(pos);
+#endif
+
+    // child boards are made one at a time from the move set
+    MoveSet moveSet;
+    generateMoveSet(pos, &moveSet);
 
     uint64 count = 0;
 
-    for (uint32 i=0; i < nMoves; i++)
+    MoveSet::Iterator it(&moveSet);
+    CMove move;
+    while (it.next(&move))
     {
-        uint64 childPerft = perft_bb(&newPositions[i], depth - 1);
-        count += childPerft;
+        HexaBitBoardPosition newPosition;
+        makeChildBoard(&newPosition, pos, move);
+        count += perft_bb(&newPosition, depth - 1);
     }
     return count;
 }
 
+// work stealing multi-threaded version of the above
+#include "perft_bb_mt.h"
+
 
 // fixed
 #define WARP_SIZE 32
@@ -108,7 +175,12 @@ uint64 perft_bb(HexaBitBoardPosition *pos, uint32 depth)
 #define MEM_ALIGNMENT 16
 
 // set this to true if devicMalloc can be called from multiple threads
+// (on CPU every worker thread has it's own buffer)
+#if CPU_ONLY_BUILD == 1
+#define MULTI_THREADED_MALLOC 0
+#else
 #define MULTI_THREADED_MALLOC 1
+#endif
 
 template<typename T>
 __device__ __forceinline__ int deviceMalloc(T **ptr, uint32 size)
@@ -224,6 +296,15 @@ __host__ __device__ __forceinline__ uint32 generateMoves(HexaBitBoardPosition *p
 #endif
 }
 
+// launch configuration for the 'driver' kernels that are launched with a single thread from CPU side
+// host only build calls them as regular functions
+#if CPU_ONLY_BUILD == 1
+#define SINGLE_THREAD_LAUNCH
+#else
+#define SINGLE_THREAD_LAUNCH <<<1, 1>>>
+#endif
+
+#if CPU_ONLY_BUILD == 0
 // shared memory scan for entire thread block
 __device__ __forceinline__ void scan(uint32 *sharedArray)
 {
@@ -267,6 +348,8 @@ __device__ __forceinline__ void warpScan(int &x, int landId)
     }
 }
 
+#endif // #if CPU_ONLY_BUILD == 0
+
 #define MAX_PERFT_DEPTH 16
 
 struct TTInfo128b
@@ -283,6 +366,182 @@ struct TTInfo128b
     bool   shallowHash[MAX_PERFT_DEPTH];
 };
 
+#if HOST_TT_STATS == 1
+// statistics of the host side hash tables, per table kind and depth
+// every thread counts in its own block (cache line aligned), the blocks are added up only when the stats are written
+enum TTStatsTable
+{
+    TT_STATS_SHALLOW = 0,   // per-depth tables with the perft value in the index bits
+    TT_STATS_DEEP,          // per-depth tables with HashEntryPerft128b entries
+    TT_STATS_COMPLETE,      // the complete TT
+    TT_STATS_NUM_TABLES
+};
+
+// histogram of the no. of slots looked at by a probe (the last one also counts longer searches)
+#define TT_STATS_PROBE_LENGTHS 17
+#define TT_STATS_MAX_THREADS   256
+
+struct TTStatsCounters
+{
+    uint64 probes;
+    uint64 hits;
+    uint64 stores;
+    uint64 replacements;    // stores that overwrote the entry of another position
+    uint64 probeLength[TT_STATS_PROBE_LENGTHS];
+};
+
+struct alignas(64) TTStatsBlock
+{
+    TTStatsCounters counters[TT_STATS_NUM_TABLES][MAX_PERFT_DEPTH];
+};
+
+TTStatsBlock ttStatsBlocks[TT_STATS_MAX_THREADS];
+std::atomic<int> ttStatsNumThreads(0);
+thread_local TTStatsBlock *ttStatsBlock = NULL;
+
+// threads beyond the limit share the last block (and may lose a few counts)
+TTStatsBlock *ttStatsRegisterThread()
+{
+    int t = ttStatsNumThreads++;
+    ttStatsBlock = &ttStatsBlocks[std::min(t, TT_STATS_MAX_THREADS - 1)];
+    return ttStatsBlock;
+}
+
+CPU_FORCE_INLINE TTStatsCounters *ttStats(int table, int depth)
+{
+    TTStatsBlock *block = ttStatsBlock ? ttStatsBlock : ttStatsRegisterThread();
+    return &block->counters[table][std::min(std::max(depth, 0), MAX_PERFT_DEPTH - 1)];
+}
+
+// for a batch of probes that all look at the same no. of slots
+CPU_FORCE_INLINE void ttStatsProbes(int table, int depth, uint64 probes, uint64 hits, int length)
+{
+    TTStatsCounters *c = ttStats(table, depth);
+    c->probes += probes;
+    c->hits += hits;
+    c->probeLength[std::min(length, TT_STATS_PROBE_LENGTHS - 1)] += probes;
+}
+
+CPU_FORCE_INLINE void ttStatsStores(int table, int depth, uint64 stores, uint64 replacements)
+{
+    TTStatsCounters *c = ttStats(table, depth);
+    c->stores += stores;
+    c->replacements += replacements;
+}
+#endif
+
+// (no counting in device code)
+#if HOST_TT_STATS == 1 && !defined(__CUDA_ARCH__)
+#define TT_STATS_PROBE(table, depth, hit, length) ttStatsProbes(table, depth, 1, hit, length)
+#define TT_STATS_STORE(table, depth, replaced)    ttStatsStores(table, depth, 1, replaced)
+#else
+#define TT_STATS_PROBE(table, depth, hit, length)
+#define TT_STATS_STORE(table, depth, replaced)
+#endif
+
+// the deep (non shallow) hash tables are made of buckets of two entries (DualHashEntry)
+// the first one is depth-preferred: it keeps the entry that saves the most work (greater depth, then bigger perft)
+// the second one always gets replaced, so that new entries find a place even when the first slot holds an old one
+#define DEEP_TT_BUCKET_SIZE 2
+
+// extract data from the entry using XORs (hash part is stored XOR'ed with data for lockless hashing scheme)
+CUDA_CALLABLE_MEMBER __forceinline__ HashEntryPerft128b deepTTDecode(HashEntryPerft128b entry)
+{
+    entry.hashKey.highPart ^= entry.perftVal;
+    entry.hashKey.lowPart  ^= entry.perftVal;
+    return entry;
+}
+
+CUDA_CALLABLE_MEMBER __forceinline__ DualHashEntry *deepTTBucket(HashEntryPerft128b *hashTable, uint64 indexBits, HashKey128b hash)
+{
+    return (DualHashEntry *) &hashTable[hash.lowPart & indexBits & ~((uint64) DEEP_TT_BUCKET_SIZE - 1)];
+}
+
+// true if the (encoded) entry is of the given hash and depth (with the perft value in *pPerft)
+CUDA_CALLABLE_MEMBER __forceinline__ bool deepTTMatch(HashEntryPerft128b encoded, uint64 hashBits, HashKey128b hash, int depth, uint64 *pPerft)
+{
+    HashEntryPerft128b entry = deepTTDecode(encoded);
+    if ((entry.hashKey.highPart == hash.highPart) && ((entry.hashKey.lowPart & hashBits) == (hash.lowPart & hashBits))
+        && (entry.depth == depth))
+    {
+        *pPerft = entry.perftVal;
+        return true;
+    }
+    return false;
+}
+
+// returns true on hash hit (with the perft value in *pPerft)
+CUDA_CALLABLE_MEMBER __forceinline__ bool deepTTProbe(HashEntryPerft128b *hashTable, uint64 hashBits, uint64 indexBits,
+                                                      HashKey128b hash, int depth, uint64 *pPerft)
+{
+    DualHashEntry *bucket = deepTTBucket(hashTable, indexBits, hash);
+    if (deepTTMatch(bucket->deepest, hashBits, hash, depth, pPerft))
+    {
+        TT_STATS_PROBE(TT_STATS_DEEP, depth, true, 1);
+        return true;
+    }
+    if (deepTTMatch(bucket->mostRecent, hashBits, hash, depth, pPerft))
+    {
+        TT_STATS_PROBE(TT_STATS_DEEP, depth, true, 2);
+        return true;
+    }
+
+    TT_STATS_PROBE(TT_STATS_DEEP, depth, false, DEEP_TT_BUCKET_SIZE);
+    return false;
+}
+
+CUDA_CALLABLE_MEMBER __forceinline__ void deepTTStore(HashEntryPerft128b *hashTable, uint64 hashBits, uint64 indexBits,
+                                                      HashKey128b hash, int depth, uint64 perft)
+{
+    DualHashEntry *bucket = deepTTBucket(hashTable, indexBits, hash);
+
+    HashEntryPerft128b newEntry;
+    newEntry.perftVal = perft;
+    newEntry.hashKey.highPart = hash.highPart;
+    newEntry.hashKey.lowPart = (hash.lowPart & hashBits);
+    newEntry.depth = depth;
+
+    // XOR hash part with data part for lockless hashing
+    newEntry.hashKey.lowPart ^= newEntry.perftVal;
+    newEntry.hashKey.highPart ^= newEntry.perftVal;
+
+    HashEntryPerft128b deepest = bucket->deepest;
+    HashEntryPerft128b oldEntry = deepTTDecode(deepest);
+    bool toDeepest = depth > oldEntry.depth || (depth == oldEntry.depth && perft >= oldEntry.perftVal);
+
+    // the replaced entry gets another chance in the always-replace slot
+    bool demote = toDeepest && (oldEntry.hashKey.highPart != hash.highPart);
+
+#if HOST_TT_STATS == 1 && !defined(__CUDA_ARCH__)
+    uint64 lostKey = deepTTDecode(bucket->mostRecent).hashKey.highPart;
+    TT_STATS_STORE(TT_STATS_DEEP, depth, (demote || !toDeepest) && lostKey != 0 && lostKey != hash.highPart);
+#endif
+
+    if (demote)
+        bucket->mostRecent = deepest;
+
+    if (toDeepest)
+        bucket->deepest = newEntry;
+    else
+        bucket->mostRecent = newEntry;
+}
+
+// host side: brings the bucket of the hash into cache, so that the probes of a batch of positions overlap
+// their memory accesses when all of them are prefetched before the first probe
+CPU_FORCE_INLINE void deepTTPrefetch(HashEntryPerft128b *hashTable, uint64 indexBits, HashKey128b hash)
+{
+    DualHashEntry *bucket = deepTTBucket(hashTable, indexBits, hash);
+
+    // (a bucket can straddle two cache lines)
+    _mm_prefetch((const char *) bucket, _MM_HINT_T0);
+    _mm_prefetch((const char *) (bucket + 1) - 1, _MM_HINT_T0);
+}
+
+#if CPU_ONLY_BUILD == 1
+// host versions of the breadth first search routines
+#include "perft_bb_cpu.h"
+#else
+
 union sharedMemAllocs
 {
     struct
@@ -756,18 +1015,14 @@ __global__ void makemove_and_count_moves_single_level_hash128b_deep(HexaBitBoard
         atomicAdd(&numProbes[depth], 1);
 #endif
         // check in transposition table
-        HashEntryPerft128b entry = hashTable[hash.lowPart & indexBits];
-        // extract data from the entry using XORs (hash part is stored XOR'ed with data for lockless hashing scheme)
-        entry.hashKey.highPart ^= entry.perftVal;
-        entry.hashKey.lowPart ^= entry.perftVal;
-        if ((entry.hashKey.highPart == hash.highPart) && ((entry.hashKey.lowPart & hashBits) == (hash.lowPart & hashBits))
-            && (entry.depth == depth))
+        uint64 ttVal;
+        if (deepTTProbe(hashTable, hashBits, indexBits, hash, depth, &ttVal))
         {
             // hash hit
 #if PRINT_HASH_STATS == 1
             atomicAdd(&numHits[depth], 1);
 #endif
-            atomicAdd(perftCounter, entry.perftVal);
+            atomicAdd(perftCounter, ttVal);
 
             // mark it invalid so that no further work gets done on this board
             pos.whitePieces = 0;    // mark it invalid so that generatemoves doesn't generate moves 
@@ -932,29 +1187,11 @@ __global__ void calcPerftNFromPerftNminus1_hash128b_deep(uint64 *perftNCounters,
                 atomicAdd(perftNCounter, perftNminus1);
 
                 // store in hash table
-                HashEntryPerft128b oldEntry = hashTable[hash.lowPart & indexBits];
-                // extract data from the entry using XORs (hash part is stored XOR'ed with data for lockless hashing scheme)
-                oldEntry.hashKey.highPart ^= oldEntry.perftVal;
-                oldEntry.hashKey.lowPart ^= oldEntry.perftVal;
-                // replace only if old entry was shallower (or of same depth)
-                if (oldEntry.depth <= depth)
-                {
-                    HashEntryPerft128b newEntry;
-                    newEntry.perftVal = perftNminus1;
-                    newEntry.hashKey.highPart = hash.highPart;
-                    newEntry.hashKey.lowPart = (hash.lowPart & hashBits);
-                    newEntry.depth = depth;
-
-                    // XOR hash part with data part for lockless hashing
-                    newEntry.hashKey.lowPart ^= newEntry.perftVal;
-                    newEntry.hashKey.highPart ^= newEntry.perftVal;
-
-                    hashTable[hash.lowPart & indexBits] = newEntry;
+                deepTTStore(hashTable, hashBits, indexBits, hash, depth, perftNminus1);
 
 #if PRINT_HASH_STATS == 1
-                    atomicAdd(&numStores[depth], 1);
+                atomicAdd(&numStores[depth], 1);
 #endif
-                }
             }
         }
     }
@@ -1624,17 +1861,11 @@ __global__ void perft_bb_gpu_launcher_hash(HexaBitBoardPosition *pos, HashKey128
         HashKey128b newHash = makeMoveAndUpdateHash(&childBoards[nNewBoards], hash, moves[i], color);
 
         // check in hash table
-        HashEntryPerft128b entry;
-        entry = hashTable[newHash.lowPart & indexBits];
-        // extract data from the entry using XORs (hash part is stored XOR'ed with data for lockless hashing scheme)
-        entry.hashKey.highPart ^= entry.perftVal;
-        entry.hashKey.lowPart ^= entry.perftVal;
-
-        if ((entry.hashKey.highPart == newHash.highPart) && ((entry.hashKey.lowPart & hashBits) == (newHash.lowPart & hashBits))
-            && (entry.depth == (depth - 1)))
+        uint64 ttVal;
+        if (deepTTProbe(hashTable, hashBits, indexBits, newHash, depth - 1, &ttVal))
         {
             // hash hit
-            (*perftOut) += entry.perftVal;
+            (*perftOut) += ttVal;
             continue;
         }
 
@@ -1659,26 +1890,11 @@ __global__ void perft_bb_gpu_launcher_hash(HexaBitBoardPosition *pos, HashKey128
     {
         (*perftOut) += perfts[i];
 
-        HashKey128b posHash128b = hashes[i];
-
-        HashEntryPerft128b oldEntry;
-        oldEntry = hashTable[posHash128b.lowPart & indexBits];
-
-        // replace only if old entry was shallower (or of same depth)
-        if (hashTable && oldEntry.depth <= (depth - 1))
+        if (hashTable)
         {
-            HashEntryPerft128b newEntry;
-            newEntry.perftVal = perfts[i];
-            newEntry.hashKey.highPart = posHash128b.highPart;
-            newEntry.hashKey.lowPart = (posHash128b.lowPart & hashBits);
-            newEntry.depth = (depth - 1);
-
-            // XOR hash part with data part for lockless hashing
-            newEntry.hashKey.lowPart ^= newEntry.perftVal;
-            newEntry.hashKey.highPart ^= newEntry.perftVal;
-
-            hashTable[posHash128b.lowPart & indexBits] = newEntry;
+            deepTTStore(hashTable, hashBits, indexBits, hashes[i], depth - 1, perfts[i]);
         }
 
     }
 }
+#endif // #if CPU_ONLY_BUILD == 1
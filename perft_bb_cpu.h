@@ -0,0 +1,532 @@
+// host versions of the breadth first search kernels in perft_bb.h
+// used for the host only build (CPU_ONLY_BUILD)
+
+// every kernel launch becomes a plain loop over all its 'threads'
+// each CPU worker thread runs its own BFS in its own preallocated buffer, so no atomics are needed
+// (the transposition tables are shared between workers and use the same lockless XOR trick as the GPU version)
+
+uint32 maxMemoryUsed = 0;
+
+// counters of the root level are always 64 bit, other levels use 32 bit counters for shallow depths
+#define BFS_WIDE_COUNTERS(level, rootDepth, shallowHash) (((level) == (rootDepth)) || !(shallowHash)[level])
+
+// 1. makes the move on parent board to produce current board, also updates the hash
+// 2. looks up the transposition table and directly updates parent's counter in case of hash hit
+// 3. otherwise counts moves of the current board
+// (for 'shallow' depths - the perft value is stored in index bits of the hash entry)
+template <typename PT, typename CT>
+void makemove_and_count_moves_single_level_hash128b(HexaBitBoardPosition *parentBoards, HashKey128b *parentHashes,
+                                                    PT *parentCounters, int *indices,  CMove *moves,
+                                                    HashKey128b *hashTable, uint64 hashBits, uint64 indexBits,
+                                                    HexaBitBoardPosition *outPositions, HashKey128b *outHashes,
+                                                    int *moveCounts, CT *perftCountersCurrentDepth,
+                                                    int nThreads, int depth)
+{
+    uint64 ttHits = 0;
+    for (int index = 0; index < nThreads; index++)
+    {
+        int nMoves = 0;
+        int parentIndex = indices[index];
+        HexaBitBoardPosition pos = parentBoards[parentIndex];
+        HashKey128b hash = parentHashes[parentIndex];
+        CMove move = moves[index];
+
+        uint8 color = pos.chance;
+        hash = makeMoveAndUpdateHash(&pos, hash, move, color);
+
+        // check in transposition table
+        HashKey128b entry = hashTable[hash.lowPart & indexBits];
+        entry.highPart = entry.highPart ^ entry.lowPart;
+        if ((entry.highPart == hash.highPart) && ((entry.lowPart & hashBits) == (hash.lowPart & hashBits)))
+        {
+            // hash hit
+            parentCounters[parentIndex] += (uint32) (entry.lowPart & indexBits);
+            ttHits++;
+
+            // mark it invalid so that no further work gets done on this board
+            pos.whitePieces = 0;
+            hash.highPart = 0;
+        }
+        else
+        {
+            nMoves = countMoves(&pos, !color);
+        }
+
+        outPositions[index] = pos;
+        outHashes[index] = hash;
+        moveCounts[index] = nMoves;
+        perftCountersCurrentDepth[index] = 0;
+    }
+
+#if HOST_TT_STATS == 1
+    ttStatsProbes(TT_STATS_SHALLOW, depth, nThreads, ttHits, 1);
+#endif
+}
+
+// same as above function - but using deep hash tables
+template <typename PT>
+void makemove_and_count_moves_single_level_hash128b_deep(HexaBitBoardPosition *parentBoards, HashKey128b *parentHashes,
+                                                         PT *parentCounters, int *indices,  CMove *moves,
+                                                         HashEntryPerft128b *hashTable, uint64 hashBits, uint64 indexBits,
+                                                         HexaBitBoardPosition *outPositions, HashKey128b *outHashes,
+                                                         int *moveCounts, uint64 *perftCountersCurrentDepth,
+                                                         int nThreads, int depth)
+{
+    for (int index = 0; index < nThreads; index++)
+    {
+        int nMoves = 0;
+        int parentIndex = indices[index];
+        HexaBitBoardPosition pos = parentBoards[parentIndex];
+        HashKey128b hash = parentHashes[parentIndex];
+        CMove move = moves[index];
+
+        uint8 color = pos.chance;
+        hash = makeMoveAndUpdateHash(&pos, hash, move, color);
+
+        // check in transposition table
+        uint64 ttVal;
+        if (deepTTProbe(hashTable, hashBits, indexBits, hash, depth, &ttVal))
+        {
+            // hash hit
+            parentCounters[parentIndex] += ttVal;
+
+            // mark it invalid so that no further work gets done on this board
+            pos.whitePieces = 0;
+            hash.highPart = 0;
+        }
+        else
+        {
+            nMoves = countMoves(&pos, !color);
+        }
+
+        outPositions[index] = pos;
+        outHashes[index] = hash;
+        moveCounts[index] = nMoves;
+        perftCountersCurrentDepth[index] = 0;
+    }
+}
+
+#if FIND_DUPLICATES_IN_BFS == 1
+// write current board's index (in current level of BFS) to the hash table location so that we can figure out the duplicate entries
+// and then mark the boards whose index got overwritten by another board with same hash as duplicates
+template <typename CT>
+void findAndMarkDuplicates(HashKey128b *hashTable, uint64 hashBits, uint64 indexBits,
+                           HashKey128b *hashes, HexaBitBoardPosition *positions,
+                           CT *perftCountersCurrentDepth, int *moveCounts, int nThreads)
+{
+    for (int index = 0; index < nThreads && index <= indexBits; index++)
+    {
+        HashKey128b hash = hashes[index];
+        if (hash.highPart)
+        {
+            HashKey128b curEntry = hash;
+            curEntry.lowPart = (curEntry.lowPart & hashBits) | (index & indexBits);
+            hashTable[hash.lowPart & indexBits] = curEntry;
+        }
+    }
+
+    for (int index = 0; index < nThreads && index < indexBits; index++)
+    {
+        HashKey128b hash = hashes[index];
+        if (hash.highPart)
+        {
+            HashKey128b entry = hashTable[hash.lowPart & indexBits];
+            if ((entry.highPart == hash.highPart) && ((entry.lowPart & hashBits) == (hash.lowPart & hashBits)))
+            {
+                uint32 indexInHash = (entry.lowPart & indexBits);
+                if (indexInHash != index)
+                {
+                    // duplicate entry!
+                    moveCounts[index] = 0;
+                    positions[index].whitePieces = 0;
+                    hashes[index].highPart = ~0ull;
+                    perftCountersCurrentDepth[index] = indexInHash;     // pick perft value from this index
+                }
+            }
+        }
+    }
+}
+#endif
+
+// compute perft N from perft N-1 and store perft (N-1) in the given (shallow) hash table
+// 'depth' is the value of (n-1)
+template <typename PT>
+void calcPerftNFromPerftNminus1_hash128b(PT *perftNCounters, int *indices,
+                                         uint32 *perftNminus1Counters, HashKey128b *hashes,
+                                         HashKey128b *hashTable, uint64 hashBits, uint64 indexBits,
+                                         int nThreads, int depth)
+{
+    uint64 ttStores = 0, ttReplacements = 0;
+    for (int index = 0; index < nThreads; index++)
+    {
+        HashKey128b hash = hashes[index];
+
+        if (hash.highPart)  // hash == 0 means invalid entry - entry for which there was a hash hit
+        {
+            uint32 perftNminus1 = perftNminus1Counters[index];
+#if FIND_DUPLICATES_IN_BFS == 1
+            if (hash.highPart == ~0ull)
+            {
+                // this was a duplicate position and the value stored is actually pointer to the original index
+                perftNCounters[indices[index]] += perftNminus1Counters[perftNminus1];
+            }
+            else
+#endif
+            {
+                perftNCounters[indices[index]] += perftNminus1;
+
+                HashKey128b hashEntry = HashKey128b((hash.lowPart & hashBits) | perftNminus1, hash.highPart);
+                hashEntry.highPart ^= hashEntry.lowPart;
+#if HOST_TT_STATS == 1
+                HashKey128b oldEntry = hashTable[hash.lowPart & indexBits];
+                ttReplacements += oldEntry.highPart && ((oldEntry.lowPart & hashBits) != (hash.lowPart & hashBits));
+                ttStores++;
+#endif
+                hashTable[hash.lowPart & indexBits] = hashEntry;
+            }
+        }
+    }
+
+#if HOST_TT_STATS == 1
+    ttStatsStores(TT_STATS_SHALLOW, depth, ttStores, ttReplacements);
+#endif
+}
+
+// same as above but for levels that need deep hash tables
+void calcPerftNFromPerftNminus1_hash128b_deep(uint64 *perftNCounters, int *indices,
+                                              uint64 *perftNminus1Counters, HashKey128b *hashes,
+                                              HashEntryPerft128b *hashTable, uint64 hashBits, uint64 indexBits,
+                                              int nThreads, int depth)
+{
+    for (int index = 0; index < nThreads; index++)
+    {
+        HashKey128b hash = hashes[index];
+
+        if (hash.highPart)  // hash == 0 means invalid entry - entry for which there was a hash hit
+        {
+            uint64 perftNminus1 = perftNminus1Counters[index];
+
+#if FIND_DUPLICATES_IN_BFS == 1
+            if (hash.highPart == ~0ull)
+            {
+                // this was a duplicate position and the value stored is actually pointer to the original index
+                perftNCounters[indices[index]] += perftNminus1Counters[perftNminus1];
+            }
+            else
+#endif
+            {
+                perftNCounters[indices[index]] += perftNminus1;
+
+                deepTTStore(hashTable, hashBits, indexBits, hash, depth, perftNminus1);
+            }
+        }
+    }
+}
+
+// moveListIndex points to the start index in generatedMovesBase for storing generated moves for each board position
+void generate_moves_single_level(HexaBitBoardPosition *positions, CMove *generatedMovesBase, int *moveListIndex, int nThreads)
+{
+    for (int index = 0; index < nThreads; index++)
+    {
+        HexaBitBoardPosition *pos = &positions[index];
+        if (pos->whitePieces)    // pos.whitePieces == 0 indicates an invalid board (hash hit)
+        {
+            generateMoves(pos, pos->chance, generatedMovesBase + moveListIndex[index]);
+        }
+    }
+}
+
+// makes the move and adds the no. of moves of the resulting board to parent's counter (i.e, perft2 of the parent)
+#define LEAF_BATCH_SIZE 64
+template <typename PT>
+void makeMove_and_perft_single_level_indices(HexaBitBoardPosition *parentBoards, PT *parentCounters,
+                                             int *indices, CMove *moves, int nThreads)
+{
+#if USE_SIMD_COUNT_MOVES == 1
+    // children are made a batch at a time so that countMovesSimd() can count several of them at once
+    HexaBitBoardPosition children[LEAF_BATCH_SIZE];
+    uint32 counts[LEAF_BATCH_SIZE];
+    for (int base = 0; base < nThreads; base += LEAF_BATCH_SIZE)
+    {
+        int n = std::min(LEAF_BATCH_SIZE, nThreads - base);
+        for (int i = 0; i < n; i++)
+        {
+            children[i] = parentBoards[indices[base + i]];
+            makeMove(&children[i], moves[base + i], children[i].chance);
+        }
+
+        countMovesSimd(children, counts, n);
+
+        for (int i = 0; i < n; i++)
+            parentCounters[indices[base + i]] += counts[i];
+    }
+#else
+    for (int index = 0; index < nThreads; index++)
+    {
+        int parentIndex = indices[index];
+        HexaBitBoardPosition pos = parentBoards[parentIndex];
+        int color = pos.chance;
+
+        makeMove(&pos, moves[index], color);
+
+        parentCounters[parentIndex] += countMoves(&pos, !color);
+    }
+#endif
+}
+
+// replacement for the scan + interval expand of the GPU version:
+// moveCounts[] is converted to exclusive scan (indices to put moves on)
+// and moveListOffsets[] gets the index of parent board of every next level move
+int scanAndExpandMoveCounts(int *moveCounts, int currentLevelCount)
+{
+    int total = 0;
+    for (int i = 0; i < currentLevelCount; i++)
+    {
+        int nMoves = moveCounts[i];
+        moveCounts[i] = total;
+        total += nMoves;
+    }
+    return total;
+}
+
+void expandParentIndices(int *moveCounts, int currentLevelCount, int nextLevelCount, int *moveListOffsets)
+{
+    for (int i = 0; i < currentLevelCount; i++)
+    {
+        int end = (i == currentLevelCount - 1) ? nextLevelCount : moveCounts[i + 1];
+        for (int j = moveCounts[i]; j < end; j++)
+        {
+            moveListOffsets[j] = i;
+        }
+    }
+}
+
+// host version of perft_bb_gpu_simple_hash
+// same downsweep/upsweep breadth first search with the same transposition tables and memory accounting
+// (perfts[0] is set to ALLSET if the tree doesn't fit in preallocated buffer)
+void perft_bb_gpu_simple_hash(int count, HexaBitBoardPosition *positions, HashKey128b *hashes, uint64 *perfts, int depth,
+                              void *devMemory, TTInfo128b ttInfo, bool newBatch)
+{
+    void   **hashTables   = ttInfo.hashTable;
+    bool   *shallowHash   = ttInfo.shallowHash;
+    uint64 *indexBits     = ttInfo.indexBits;
+    uint64 *hashBits      = ttInfo.hashBits;
+
+    if (newBatch)
+    {
+        preAllocatedBuffer = devMemory;
+        preAllocatedMemoryUsed = 0;
+    }
+
+    HexaBitBoardPosition   *prevLevelBoards = NULL;
+    HashKey128b            *prevLevelHashes = NULL;
+    void                   *prevLevelPerftCounters = NULL;
+
+    int                     currentLevelCount = 0;
+    int                     *moveListOffsets = NULL;
+    int                     *moveCounts = NULL;
+    HexaBitBoardPosition    *currentLevelBoards = NULL;
+    HashKey128b             *currentLevelHashes = NULL;
+    void                    *currentLevelPerftCounters = NULL;
+
+    int                     nextLevelCount = 0;
+    CMove                  *childMoves;
+
+    // the tree: created/saved during downsweep pass, used during up-sweep pass
+    int                     levelCounts[MAX_PERFT_DEPTH];
+    void                   *perftCounters[MAX_PERFT_DEPTH];
+    HashKey128b            *boardHashes[MAX_PERFT_DEPTH];
+    int                    *parentIndices[MAX_PERFT_DEPTH];
+
+    // special case for first level (root)
+    int *moveListOffsetsRoot;
+    deviceMalloc(&moveListOffsetsRoot, (1+count) * sizeof(int));
+    uint8 color = positions->chance;
+    for (int i = 0; i < count; i++)
+    {
+        int nMoves = countMoves(&positions[i], color);
+        moveListOffsetsRoot[i] = nextLevelCount;
+        nextLevelCount += nMoves;
+
+        if (depth == 1)
+            perfts[i] += nMoves;
+    }
+
+    if (nextLevelCount == 0 || depth == 1)
+    {
+        return;
+    }
+
+    deviceMalloc(&childMoves, nextLevelCount * sizeof (CMove));
+    for (int i = 0; i < count; i++)
+    {
+        generateMoves(&positions[i], color, &childMoves[moveListOffsetsRoot[i]]);
+    }
+    prevLevelBoards = positions;
+    prevLevelPerftCounters = perfts;
+    prevLevelHashes = hashes;
+
+    currentLevelCount = nextLevelCount;
+
+    deviceMalloc(&moveListOffsets, currentLevelCount * sizeof(int));
+    expandParentIndices(moveListOffsetsRoot, count, currentLevelCount, moveListOffsets);
+
+    levelCounts[depth] = count;
+    perftCounters[depth] = prevLevelPerftCounters;
+    boardHashes[depth] = prevLevelHashes;
+    parentIndices[depth] = NULL;     // no-parent, this is the root
+
+    int curDepth = 0;
+
+    for (curDepth = depth - 1; curDepth > 1; curDepth--)
+    {
+        // estimate memory usage and exit early if we think the tree isn't going too fit in memory!
+        uint32 freeMemory = PREALLOCATED_MEMORY_SIZE - preAllocatedMemoryUsed;
+        float branchingFactor = ((float)currentLevelCount) / levelCounts[curDepth + 1];
+        float estMemoryNeededForLevel = ((73.0 + 6.0 * branchingFactor) * currentLevelCount);
+
+        if (estMemoryNeededForLevel * 1.2f > freeMemory)    // 20% margin
+        {
+            // return failure
+            perfts[0] = ALLSET;
+            return;
+        }
+
+        deviceMalloc(&currentLevelBoards, currentLevelCount * sizeof (HexaBitBoardPosition));
+        deviceMalloc(&moveCounts, sizeof(int) * currentLevelCount);
+        deviceMalloc(&currentLevelHashes, currentLevelCount * sizeof (HashKey128b));
+
+        if (shallowHash[curDepth])
+            deviceMalloc(&currentLevelPerftCounters, currentLevelCount * sizeof (uint32));
+        else
+            deviceMalloc(&currentLevelPerftCounters, currentLevelCount * sizeof (uint64));
+
+        // save pointers for upsweep pass
+        levelCounts[curDepth] = currentLevelCount;
+        parentIndices[curDepth] = moveListOffsets;
+        perftCounters[curDepth] = currentLevelPerftCounters;
+        boardHashes[curDepth] = currentLevelHashes;
+
+        bool widePrevCounters = BFS_WIDE_COUNTERS(curDepth + 1, depth, shallowHash);
+
+        if (shallowHash[curDepth])
+        {
+            HashKey128b *hashTable = (HashKey128b *)(hashTables[curDepth]);
+            if (widePrevCounters)
+            {
+                makemove_and_count_moves_single_level_hash128b(prevLevelBoards, prevLevelHashes,
+                                                               (uint64*) prevLevelPerftCounters, moveListOffsets, childMoves,
+                                                               hashTable, hashBits[curDepth], indexBits[curDepth],
+                                                               currentLevelBoards, currentLevelHashes,
+                                                               moveCounts, (uint32*) currentLevelPerftCounters,
+                                                               currentLevelCount, curDepth);
+            }
+            else
+            {
+                makemove_and_count_moves_single_level_hash128b(prevLevelBoards, prevLevelHashes,
+                                                               (uint32*) prevLevelPerftCounters, moveListOffsets, childMoves,
+                                                               hashTable, hashBits[curDepth], indexBits[curDepth],
+                                                               currentLevelBoards, currentLevelHashes,
+                                                               moveCounts, (uint32*) currentLevelPerftCounters,
+                                                               currentLevelCount, curDepth);
+            }
+
+#if FIND_DUPLICATES_IN_BFS == 1
+            // depth 1 hash table is used only for finding duplicates
+            findAndMarkDuplicates((HashKey128b *)(hashTables[1]), hashBits[1], indexBits[1], currentLevelHashes,
+                                  currentLevelBoards, (uint32*) currentLevelPerftCounters, moveCounts, currentLevelCount);
+#endif
+        }
+        else
+        {
+            // > 24 bit perft counters
+            HashEntryPerft128b *hashTable = (HashEntryPerft128b *)(hashTables[curDepth]);
+            makemove_and_count_moves_single_level_hash128b_deep(prevLevelBoards, prevLevelHashes,
+                                                                (uint64*) prevLevelPerftCounters, moveListOffsets, childMoves,
+                                                                hashTable, hashBits[curDepth], indexBits[curDepth],
+                                                                currentLevelBoards, currentLevelHashes,
+                                                                moveCounts, (uint64*)currentLevelPerftCounters,
+                                                                currentLevelCount, curDepth);
+#if FIND_DUPLICATES_IN_BFS == 1
+            findAndMarkDuplicates((HashKey128b *)(hashTables[1]), hashBits[1], indexBits[1], currentLevelHashes,
+                                  currentLevelBoards, (uint64*) currentLevelPerftCounters, moveCounts, currentLevelCount);
+#endif
+        }
+
+        nextLevelCount = scanAndExpandMoveCounts(moveCounts, currentLevelCount);
+
+        if (nextLevelCount == 0)
+        {
+            // unlikely, but possible
+            break;
+        }
+
+        deviceMalloc(&childMoves, sizeof(CMove)* nextLevelCount);
+        deviceMalloc(&moveListOffsets, sizeof(int)* nextLevelCount);
+
+        // exit with failure if we are going to exceed allocated memory!
+        if (preAllocatedMemoryUsed > PREALLOCATED_MEMORY_SIZE)
+        {
+            perfts[0] = ALLSET;
+            return;
+        }
+
+        expandParentIndices(moveCounts, currentLevelCount, nextLevelCount, moveListOffsets);
+        generate_moves_single_level(currentLevelBoards, childMoves, moveCounts, currentLevelCount);
+
+        // go to next level
+        currentLevelCount = nextLevelCount;
+        prevLevelBoards = currentLevelBoards;
+        prevLevelPerftCounters = currentLevelPerftCounters;
+        prevLevelHashes = currentLevelHashes;
+    }
+
+    curDepth++;
+
+    if (curDepth == 2)
+    {
+        // last level (by far the most expensive part)
+        if (BFS_WIDE_COUNTERS(2, depth, shallowHash))
+            makeMove_and_perft_single_level_indices(prevLevelBoards, (uint64*) prevLevelPerftCounters, moveListOffsets, childMoves, currentLevelCount);
+        else
+            makeMove_and_perft_single_level_indices(prevLevelBoards, (uint32*) prevLevelPerftCounters, moveListOffsets, childMoves, currentLevelCount);
+    }
+
+    // upsweep pass: propogate the perft values up to compute perft of root position
+    for (; curDepth < depth; curDepth++)
+    {
+        if (shallowHash[curDepth])
+        {
+            HashKey128b *hashTable = (HashKey128b*)(hashTables[curDepth]);
+
+            if (BFS_WIDE_COUNTERS(curDepth + 1, depth, shallowHash))
+            {
+                calcPerftNFromPerftNminus1_hash128b((uint64 *) perftCounters[curDepth + 1], parentIndices[curDepth],
+                                                    (uint32 *) perftCounters[curDepth], boardHashes[curDepth],
+                                                    hashTable, hashBits[curDepth], indexBits[curDepth],
+                                                    levelCounts[curDepth], curDepth);
+            }
+            else
+            {
+                calcPerftNFromPerftNminus1_hash128b((uint32 *) perftCounters[curDepth + 1], parentIndices[curDepth],
+                                                    (uint32 *) perftCounters[curDepth], boardHashes[curDepth],
+                                                    hashTable, hashBits[curDepth], indexBits[curDepth],
+                                                    levelCounts[curDepth], curDepth);
+            }
+        }
+        else
+        {
+            HashEntryPerft128b *hashTable = (HashEntryPerft128b*)(hashTables[curDepth]);
+
+            calcPerftNFromPerftNminus1_hash128b_deep((uint64 *) perftCounters[curDepth + 1], parentIndices[curDepth],
+                                                     (uint64 *) perftCounters[curDepth], boardHashes[curDepth],
+                                                     hashTable, hashBits[curDepth], indexBits[curDepth],
+                                                     levelCounts[curDepth], curDepth);
+        }
+    }
+
+    if (preAllocatedMemoryUsed > maxMemoryUsed)
+    {
+        maxMemoryUsed = preAllocatedMemoryUsed;
+    }
+}
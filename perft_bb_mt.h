@@ -0,0 +1,227 @@
+// multi-threaded CPU perft (without transposition tables)
+// built on the same generateMoveSet()/countMoves() helpers used by perft_bb()
+// this is the no-TT path: it is only used when USE_TRANSPOSITION_TABLE is 0 (see perft_bb_gpu_launcher)
+// the default (hashed) build runs perft_bb_cpu_launcher instead
+
+// every worker thread owns a deque of subtrees (tasks)
+// - the owner pushes and pops at the bottom (newest, smallest subtrees)
+// - other workers steal from the top (oldest, biggest subtrees)
+// a worker that is walking a big subtree hands out some of the remaining children of a node
+// as new tasks as soon as it sees some other worker idle (dynamic splitting)
+// - only nodes with at least MT_PERFT_MIN_SPLIT_DEPTH plies left are split
+// - at most one task per idle worker is handed out (minus what is already waiting in our deque)
+// perft counts just add up, so split children never need to be joined back: every worker
+// keeps it's own sum, and the total is the sum of these at the end
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+
+#define MAX_PERFT_THREADS 256
+
+// subtrees of this depth (or smaller) are always done serially using perft_bb()
+#define MT_PERFT_SERIAL_DEPTH 3
+
+// nodes with fewer plies left than this are never split (their children are too small to be worth a task)
+#define MT_PERFT_MIN_SPLIT_DEPTH 5
+
+struct PerftTask
+{
+    HexaBitBoardPosition pos;
+    uint32 depth;
+};
+
+// padded to avoid false sharing between workers
+struct alignas(64) PerftWorker
+{
+    std::mutex             lock;
+    std::deque<PerftTask>  tasks;
+    std::atomic<int>       numTasks;    // for checking the deque without taking the lock
+    uint64                 count;       // perft of all the tasks finished by this worker
+    uint64                 steals;      // no. of tasks stolen by this worker
+};
+
+static PerftWorker           perftWorkers[MAX_PERFT_THREADS];
+static int                   numPerftWorkers;
+static std::atomic<long long> pendingPerftTasks;
+static std::atomic<int>      idlePerftWorkers;
+
+void pushPerftTasks(int id, HexaBitBoardPosition *positions, uint32 n, uint32 depth)
+{
+    PerftWorker &w = perftWorkers[id];
+
+    // count them before they become visible to thieves (so that pendingPerftTasks never hits 0 early)
+    pendingPerftTasks += n;
+
+    std::lock_guard<std::mutex> guard(w.lock);
+    for (uint32 i = 0; i < n; i++)
+    {
+        PerftTask task;
+        task.pos = positions[i];
+        task.depth = depth;
+        w.tasks.push_back(task);
+    }
+    w.numTasks += n;
+}
+
+// hand out the children of pos for (at most maxTasks of) the moves the iterator hasn't reached yet
+// returns the no. of tasks pushed
+uint32 pushPerftTasks(int id, HexaBitBoardPosition *pos, MoveSet::Iterator *it, uint32 depth, uint32 maxTasks)
+{
+    HexaBitBoardPosition children[MAX_MOVES];
+    uint32 n = 0;
+    CMove move;
+    while (n < maxTasks && it->next(&move))
+    {
+        makeChildBoard(&children[n], pos, move);
+        n++;
+    }
+    if (n)
+        pushPerftTasks(id, children, n, depth);
+    return n;
+}
+
+bool popPerftTask(int id, PerftTask *task)
+{
+    PerftWorker &w = perftWorkers[id];
+    std::lock_guard<std::mutex> guard(w.lock);
+    if (w.tasks.empty())
+        return false;
+
+    *task = w.tasks.back();
+    w.tasks.pop_back();
+    w.numTasks--;
+    return true;
+}
+
+bool stealPerftTask(int id, PerftTask *task)
+{
+    for (int i = 1; i < numPerftWorkers; i++)
+    {
+        PerftWorker &victim = perftWorkers[(id + i) % numPerftWorkers];
+
+        // quick check without taking the lock
+        if (victim.numTasks.load(std::memory_order_relaxed) == 0)
+            continue;
+
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.tasks.empty())
+            continue;
+
+        *task = victim.tasks.front();
+        victim.tasks.pop_front();
+        victim.numTasks--;
+        perftWorkers[id].steals++;
+        return true;
+    }
+    return false;
+}
+
+uint64 perft_bb_mt_subtree(int id, HexaBitBoardPosition *pos, uint32 depth)
+{
+    if (depth <= MT_PERFT_SERIAL_DEPTH)
+        return perft_bb(pos, depth);
+
+    MoveSet moveSet;
+    generateMoveSet(pos, &moveSet);
+    uint32 nMoves = moveSet.count();
+
+    uint64 count = 0;
+    MoveSet::Iterator it(&moveSet);
+    CMove move;
+    for (uint32 i = 0; it.next(&move); i++)
+    {
+        // somebody is starving: keep this child and hand out one of the others to every idle worker
+        // that doesn't already have a task waiting for it in our deque
+        if (depth >= MT_PERFT_MIN_SPLIT_DEPTH && i + 1 < nMoves)
+        {
+            int wanted = idlePerftWorkers.load(std::memory_order_relaxed) -
+                         perftWorkers[id].numTasks.load(std::memory_order_relaxed);
+            if (wanted > 0)
+                i += pushPerftTasks(id, pos, &it, depth - 1, (uint32) wanted);
+        }
+
+        HexaBitBoardPosition newPosition;
+        makeChildBoard(&newPosition, pos, move);
+        count += perft_bb_mt_subtree(id, &newPosition, depth - 1);
+    }
+    return count;
+}
+
+void perftWorkerThread(int id)
+{
+    PerftWorker &w = perftWorkers[id];
+    PerftTask task;
+    bool idle = false;
+
+    while (pendingPerftTasks.load() > 0)
+    {
+        if (popPerftTask(id, &task) || stealPerftTask(id, &task))
+        {
+            if (idle)
+            {
+                idlePerftWorkers--;
+                idle = false;
+            }
+            w.count += perft_bb_mt_subtree(id, &task.pos, task.depth);
+            pendingPerftTasks--;
+        }
+        else
+        {
+            if (!idle)
+            {
+                idlePerftWorkers++;
+                idle = true;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    if (idle)
+        idlePerftWorkers--;
+}
+
+// compute perft using numThreads worker threads
+uint64 perft_bb_mt(HexaBitBoardPosition *pos, uint32 depth, int numThreads)
+{
+    if (numThreads > MAX_PERFT_THREADS)
+        numThreads = MAX_PERFT_THREADS;
+
+    if (numThreads <= 1 || depth <= MT_PERFT_SERIAL_DEPTH)
+        return perft_bb(pos, depth);
+
+    numPerftWorkers = numThreads;
+    idlePerftWorkers = 0;
+    pendingPerftTasks = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        perftWorkers[i].tasks.clear();
+        perftWorkers[i].numTasks = 0;
+        perftWorkers[i].count = 0;
+        perftWorkers[i].steals = 0;
+    }
+
+    // everything starts in the first worker's deque, rest of them steal from it
+    pushPerftTasks(0, pos, 1, depth);
+
+    std::thread threads[MAX_PERFT_THREADS];
+    for (int i = 1; i < numThreads; i++)
+        threads[i] = std::thread(perftWorkerThread, i);
+
+    perftWorkerThread(0);
+
+    for (int i = 1; i < numThreads; i++)
+        threads[i].join();
+
+    uint64 total = 0;
+    uint64 totalSteals = 0;
+    for (int i = 0; i < numThreads; i++)
+    {
+        total += perftWorkers[i].count;
+        totalSteals += perftWorkers[i].steals;
+    }
+    printf("\n%d worker threads, %llu tasks stolen\n", numThreads, totalSteals);
+
+    return total;
+}
@@ -1,5 +1,19 @@
 // this file contains the various compile time settings/swithes
 
+// build everything for the host only (no CUDA toolkit or GPU needed)
+// the BFS 'kernels' run as plain loops on CPU worker threads (one worker per 'GPU')
+// set from the Makefile (perft_cpu target) - don't change it here
+#ifndef CPU_ONLY_BUILD
+#define CPU_ONLY_BUILD 0
+#endif
+
+#if CPU_ONLY_BUILD == 1
+// the __device__ copies of lookup tables etc don't exist in host only build
+#ifndef SKIP_CUDA_CODE
+#define SKIP_CUDA_CODE
+#endif
+#endif
+
 #define DEBUG_PRINT_MOVES 0
 #if DEBUG_PRINT_MOVES == 1
     #define DEBUG_PRINT_DEPTH 6
@@ -23,7 +37,12 @@
 // 768 MB preallocated memory size (for holding the perft tree in GPU memory)
 // on systems with more video memory (like Titan X), we can use 3x of this to hold bigger trees
 //#define PREALLOCATED_MEMORY_SIZE (1536 * 1024 * 1024ull)
+#if CPU_ONLY_BUILD == 1
+// every CPU worker thread gets a buffer of this size (and the trees launched on CPU are smaller)
+#define PREALLOCATED_MEMORY_SIZE (256 * 1024 * 1024ull)
+#else
 #define PREALLOCATED_MEMORY_SIZE (3072 * 1024 * 1024ull)
+#endif
 
 // 512 KB ought to be enough for holding the stack for the serial part of the gpu perft
 #define GPU_SERIAL_PERFT_STACK_SIZE (512 * 1024)
@@ -51,6 +70,13 @@
 // and make sure we explore them only once
 #define FIND_DUPLICATES_IN_BFS 1
 
+// look up positions in the host side hash tables (launcher levels) with the smallest zobrist key of the
+// position and its symmetric variants (colors flipped + board mirrored vertically, and also mirrored
+// horizontally when there are no castling rights) - all of them have the same perft
+// (see computeSymmetricZobristKeys128b(), the keys of all the variants are updated move by move along with the
+// regular one. The GPU/BFS levels still use the plain incrementally updated keys)
+#define CANONICAL_TT_KEYS 1
+
 // windows 64 bit vs 32 bit vs linux 64 bit compromise :-/
 // Windows allows overclocking (gives about 10% extra performance)
 // Windows 32 bit build is 7% faster than windows 64 bit build (for some unknown reason??)!
@@ -84,6 +110,10 @@
 // print  various hash statistics
 #define PRINT_HASH_STATS 0
 
+// count probes/hits/stores of the host side hash tables (per thread counters, see ttStats() in perft_bb.h)
+// they are written to the file given with -ttstats=<file> periodically and at exit
+#define HOST_TT_STATS 1
+
 // move generation functions templated on chance
 // +9% benefit on GM204
 #define USE_TEMPLATE_CHANCE_OPT 1
@@ -124,6 +154,37 @@
 // and > 10% slower on GPU!
 #define USE_BYTE_LOOKUP_FANCY 0
 
+// use BMI2 PEXT (instead of magic multiply) to index the sliding attack tables on CPU
+// attack sets are stored compressed (16 bits per entry, 576 KB tables) and expanded with PDEP
+// selected at runtime, only on CPUs with fast PEXT/PDEP (not on AMD before Zen 3 where these are microcoded)
+// (needs USE_SLIDING_LUT; the GPU code is not affected)
+#define USE_PEXT_SLIDING 1
+
+// compile all the sliding attack lookups (kogge stone, plain, fancy and byte lookup fancy magics, PEXT)
+// into the CPU code and pick one at runtime: the fastest one in a short benchmark at startup
+// or the one given on command line (-sliding=<name>)
+// the settings above then only decide the default (and what the GPU code uses)
+// (needs USE_SLIDING_LUT)
+#define RUNTIME_SLIDING_BACKEND 1
+
+// count moves of several leaf positions at once using AVX2 (4 positions) or AVX-512 (8 positions)
+// in the CPU perft (last level of perft_bb()); picked at runtime based on CPU support
+// positions in check or with en-passent fall back to the regular countMoves
+// (host code only - not used when compiling with nvcc)
+#define USE_SIMD_COUNT_MOVES 1
+
+// compute the squares attacked by all enemy rooks and bishops (findAttackedSquares) with kogge stone fills
+// of all eight directions at once - in the four 64 bit lanes of two AVX2 registers, or two lanes of SSE2 registers
+// on CPUs without AVX2 (picked at runtime). Used regardless of the selected sliding attack lookup.
+// (host code only - not used when compiling with nvcc)
+#define USE_SIMD_KOGGE_STONE 1
+
+// one more level of templates (on top of USE_TEMPLATE_CHANCE_OPT) for countMoves and generateMoves:
+// the position is classified once (en-passent possible, castling rights, pinned pieces, pawns on 7th rank)
+// and a version of the move generator with the code for absent features compiled out is called
+// (host code only - on GPU the different versions would just make the warps diverge. Needs USE_TEMPLATE_CHANCE_OPT)
+#define USE_POSITION_CLASS_OPT 1
+
 
 #ifdef __CUDACC__
 #define CUDA_CALLABLE_MEMBER __host__ __device__
@@ -1,4 +1,8 @@
+#if CPU_ONLY_BUILD == 1
+#include "cuda_host.h"
+#else
 #include "cuda_runtime.h"
+#endif
 #include <chrono>
 
 